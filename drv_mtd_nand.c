@@ -19,7 +19,6 @@
 #define DBG_LVL     DBG_LOG
 #include <rtdbg.h>
 
-const nand_flash_chip       nand_flash_chip_table[] = SPI_NAND_FLASH_CHIP_TABLE;
 const nand_flash_chip_info  nand_flash_info_table[] = SPI_NAND_FLASH_CHIP_INFO;
 
 /*
@@ -31,6 +30,13 @@ const nand_flash_chip_info  nand_flash_info_table[] = SPI_NAND_FLASH_CHIP_INFO;
 #define NAND_ECC_DISABLE      4
 #define NAND_BUF_ENABLE       5     /* Just for winbond */
 #define NAND_BUF_DISABLE      6
+#define NAND_QE_ENABLE        7
+
+#ifdef NAND_USING_QSPI
+/* the chip is on a QSPI bus, a simulated chip has no SPI device */
+#define NAND_BUS_IS_QSPI(rtt_dev)                                                               \
+    ((rtt_dev)->rt_spi_device != RT_NULL && ((rtt_dev)->rt_spi_device->bus->mode & RT_SPI_BUS_MODE_QSPI))
+#endif
 
 /*
  * spi_nand_get_feature: read status, or get feature.
@@ -47,21 +53,73 @@ int spi_nand_get_feature(struct rt_mtd_nand_device *device, rt_uint8_t sr_addr,
 
     if ((sr_addr != NAND_SR1_ADDR) && (sr_addr != NAND_SR2_ADDR) && (sr_addr != NAND_SR3_ADDR))
     {
-        return RT_EINVAL;
+        return -RT_EINVAL;
     }
 
     cmd_data[0] = NAND_GET_FEATURE;
     cmd_data[1] = sr_addr;
 
-    nand_dev->spi.wr(spi, cmd_data, sizeof(cmd_data), sr_value, 1);
+    return nand_dev->spi.wr(spi, cmd_data, sizeof(cmd_data), sr_value, 1);
+}
+
+/*
+ * spi_nand_shadow_reg: the driver keeps a shadow of the protection and
+ * configuration registers, they only change by set feature or reset.
+ */
+static rt_uint8_t *spi_nand_shadow_reg(nand_flash_t nand_dev, rt_uint8_t sr_addr)
+{
+    if (sr_addr == NAND_SR1_ADDR)
+    {
+        return &nand_dev->sr1;
+    }
+    else if (sr_addr == NAND_SR2_ADDR)
+    {
+        return &nand_dev->sr2;
+    }
+
+    return RT_NULL;
+}
+
+/*
+ * spi_nand_get_shadow: get a register value from the shadow, read the chip
+ * if the register has no shadow.
+ */
+static int spi_nand_get_shadow(struct rt_mtd_nand_device *device, rt_uint8_t sr_addr, rt_uint8_t *sr_value)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    rt_uint8_t *shadow = spi_nand_shadow_reg(nand_dev, sr_addr);
+
+    if (shadow == RT_NULL)
+    {
+        return spi_nand_get_feature(device, sr_addr, sr_value);
+    }
+
+    *sr_value = *shadow;
     return RT_EOK;
 }
 
+/*
+ * spi_nand_sync_feature: refresh the register shadows from the chip.
+ */
+static void spi_nand_sync_feature(struct rt_mtd_nand_device *device)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    spi_nand_get_feature(device, NAND_SR1_ADDR, &nand_dev->sr1);
+    spi_nand_get_feature(device, NAND_SR2_ADDR, &nand_dev->sr2);
+}
+
+static rt_err_t spi_nand_die_select(struct rt_mtd_nand_device *device, rt_uint8_t die);
+
 int spi_nand_set_feature(struct rt_mtd_nand_device *device, rt_uint8_t cmd)
 {
     rt_uint8_t cmd_data[3];
+    rt_uint8_t die = 0;
     rt_uint8_t sr_addr = 0;
     rt_uint8_t sr_value;
+    rt_uint8_t *shadow = RT_NULL;
 
     struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
     nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
@@ -71,37 +129,43 @@ int spi_nand_set_feature(struct rt_mtd_nand_device *device, rt_uint8_t cmd)
     {
     case NAND_PROTECT_ENABLE:
         sr_addr = (nand_dev->chip_info.bp_bit >> 8) & 0xff;
-        spi_nand_get_feature(device, sr_addr, &sr_value);
+        spi_nand_get_shadow(device, sr_addr, &sr_value);
         sr_value |= ((nand_dev->chip_info.bp_bit) & 0xff);
         break;
 
     case NAND_PROTECT_DISABLE:
         sr_addr = (nand_dev->chip_info.bp_bit >> 8) & 0xff;
-        spi_nand_get_feature(device, sr_addr, &sr_value);
+        spi_nand_get_shadow(device, sr_addr, &sr_value);
         sr_value &= (~(nand_dev->chip_info.bp_bit) & 0xff);
         break;
 
     case NAND_ECC_ENABLE:
         sr_addr = (nand_dev->chip_info.ecc_bit >> 8) & 0xff;
-        spi_nand_get_feature(device, sr_addr, &sr_value);
+        spi_nand_get_shadow(device, sr_addr, &sr_value);
         sr_value |= ((nand_dev->chip_info.ecc_bit) & 0xff);
         break;
 
     case NAND_ECC_DISABLE:
         sr_addr = (nand_dev->chip_info.ecc_bit >> 8) & 0xff;
-        spi_nand_get_feature(device, sr_addr, &sr_value);
+        spi_nand_get_shadow(device, sr_addr, &sr_value);
         sr_value &= (~(nand_dev->chip_info.ecc_bit) & 0xff);
         break;
 
+    case NAND_QE_ENABLE:
+        sr_addr = (nand_dev->chip_info.qe_bit >> 8) & 0xff;
+        spi_nand_get_shadow(device, sr_addr, &sr_value);
+        sr_value |= ((nand_dev->chip_info.qe_bit) & 0xff);
+        break;
+
     case NAND_BUF_ENABLE:
         sr_addr = NAND_SR2_ADDR;
-        spi_nand_get_feature(device, sr_addr, &sr_value);
+        spi_nand_get_shadow(device, sr_addr, &sr_value);
         sr_value |= 0x08;
         break;
 
     case NAND_BUF_DISABLE:
         sr_addr = NAND_SR2_ADDR;
-        spi_nand_get_feature(device, sr_addr, &sr_value);
+        spi_nand_get_shadow(device, sr_addr, &sr_value);
         sr_value &= (~0x08);
         break;
 
@@ -111,424 +175,2139 @@ int spi_nand_set_feature(struct rt_mtd_nand_device *device, rt_uint8_t cmd)
         break;
 
     }
+
+    /* the register is already in the target state */
+    shadow = spi_nand_shadow_reg(nand_dev, sr_addr);
+    if (shadow != RT_NULL && *shadow == sr_value)
+    {
+        return RT_EOK;
+    }
+
     cmd_data[0] = NAND_SET_FEATURE;
     cmd_data[1] = sr_addr;
     cmd_data[2] = sr_value;
 
-    nand_dev->spi.wr(spi, cmd_data, sizeof(cmd_data), 0, 0);
+    /* the registers are per die, keep all dies the same */
+    for (die = 0; die < nand_dev->chip_info.die_num; die++)
+    {
+        spi_nand_die_select(device, die);
+        nand_dev->spi.wr(spi, cmd_data, sizeof(cmd_data), 0, 0);
+    }
+    if (shadow != RT_NULL)
+    {
+        *shadow = sr_value;
+    }
     return RT_EOK;
 }
 
-static rt_err_t spi_nand_wait_busy(struct rt_mtd_nand_device *device)
+/*
+ * spi_nand_unprotect_session_begin: unlock the array once for a burst of
+ * writes or erases, sessions may nest, the array is locked again when the
+ * outermost session ends.
+ */
+rt_err_t spi_nand_unprotect_session_begin(struct rt_mtd_nand_device *device)
 {
-    rt_uint8_t sr_addr = 0;
-    rt_uint8_t sr_value = 0;
-    rt_uint8_t sr_busy_bit_mask = 0;
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    nand_dev->spi.lock(spi);
+    if (nand_dev->unprotect_count++ == 0)
+    {
+        spi_nand_set_feature(device, NAND_PROTECT_DISABLE);
+    }
+    nand_dev->spi.unlock(spi);
+
+    return RT_EOK;
+}
 
+rt_err_t spi_nand_unprotect_session_end(struct rt_mtd_nand_device *device)
+{
     struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
     nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
 
-    sr_addr = (nand_dev->chip_info.busy_bit >> 8) & 0xff;
-    sr_busy_bit_mask = (nand_dev->chip_info.busy_bit) & 0xff;
+    RT_ASSERT(nand_dev->unprotect_count > 0);
 
-    while (1)
+    nand_dev->spi.lock(spi);
+    if (--nand_dev->unprotect_count == 0)
     {
-        spi_nand_get_feature(device, sr_addr, &sr_value);
-        if ((sr_value & sr_busy_bit_mask) == 0)
-        {
-            return RT_EOK;
-        }
+        spi_nand_set_feature(device, NAND_PROTECT_ENABLE);
     }
+    nand_dev->spi.unlock(spi);
+
+    return RT_EOK;
 }
 
-static rt_err_t _read_id(struct rt_mtd_nand_device *device)
+#define NAND_STATUS_STREAM_LEN        (8)
+#define NAND_TICK_US                  (1000000 / RT_TICK_PER_SECOND)
+
+/*
+ * spi_nand_get_status_stream: read the status byte several times in one Get
+ * Feature transaction, return 0 if one of them is ready, or the last status.
+ */
+static rt_err_t spi_nand_get_status_stream(struct rt_mtd_nand_device *device, rt_uint8_t sr_addr,
+                                           rt_uint8_t busy_mask, rt_uint8_t *sr_value)
 {
-    rt_uint8_t recv_buff[4] = { 0 };
-    int i = 0;
+    rt_uint8_t cmd_data[2];
+    rt_uint8_t status[NAND_STATUS_STREAM_LEN];
+    nand_spi_xfer xfer[2];
+    rt_err_t result;
+    int i;
+
     struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
     nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
-    const nand_spi *spi = &nand_dev->spi;
 
-    rt_uint8_t cmd_data = NAND_READ_ID;
+    cmd_data[0] = NAND_GET_FEATURE;
+    cmd_data[1] = sr_addr;
 
-    nand_dev->spi.wr(spi, &cmd_data, 1, recv_buff, 4);
+    xfer[0].send_buf = cmd_data;
+    xfer[0].recv_buf = RT_NULL;
+    xfer[0].length = sizeof(cmd_data);
+    xfer[0].cs_change = RT_FALSE;
+    xfer[1].send_buf = RT_NULL;
+    xfer[1].recv_buf = status;
+    xfer[1].length = sizeof(status);
+    xfer[1].cs_change = RT_FALSE;
 
-    LOG_I("Nand flash device id is 0x%x%x%x.", recv_buff[1], recv_buff[2], recv_buff[3]);
+    result = nand_dev->spi.xfer(&nand_dev->spi, xfer, 2);
+    if (result != RT_EOK)
+    {
+        return result;
+    }
 
-    /* find device from chip table */
-    for (i = 0; i < sizeof(nand_flash_chip_table) / sizeof(nand_flash_chip); i++)
+    for (i = 0; i < NAND_STATUS_STREAM_LEN; i++)
     {
-        if ((nand_flash_chip_table[i].mf_id == recv_buff[1])
-                && (nand_flash_chip_table[i].type_id == recv_buff[2])
-                && (nand_flash_chip_table[i].capacity_id == recv_buff[3]))
+        if ((status[i] & busy_mask) == 0)
         {
-            nand_dev->chip.name = nand_flash_chip_table[i].name;
-            nand_dev->chip.mf_id = nand_flash_chip_table[i].mf_id;
-            nand_dev->chip.type_id = nand_flash_chip_table[i].type_id;
-            nand_dev->chip.capacity_id = nand_flash_chip_table[i].capacity_id;
-            LOG_I("Nand flash device name is %s.", nand_dev->chip.name);
-            return RT_EOK;
-        }
-        else
-        {
-            LOG_I("Unkonwn nand, device id is 0x%x%x%x.", recv_buff[1], recv_buff[2], recv_buff[3]);
-            return RT_ERROR;
+            break;
         }
     }
+    *sr_value = status[i < NAND_STATUS_STREAM_LEN ? i : NAND_STATUS_STREAM_LEN - 1];
 
     return RT_EOK;
 }
 
-static rt_err_t _read_page(struct rt_mtd_nand_device *device,
-                           rt_off_t page,
-                           rt_uint8_t *data,
-                           rt_uint32_t data_len,
-                           rt_uint8_t *spare,
-                           rt_uint32_t spare_len)
-{
-    int res = RT_EOK;
-    rt_uint8_t sr2;
-
-    rt_uint8_t page_data[4], column_data[4];
-    rt_uint16_t column_addr = 0;
-    rt_uint8_t oob[NAND_PAGE_OOB_SIZE];
+/* busy wait operation, the timing comes from the chip descriptor */
+#define NAND_OP_READ                  (0)
+#define NAND_OP_PROG                  (1)
+#define NAND_OP_ERASE                 (2)
+#define NAND_OP_RESET                 (3)
 
-    RT_ASSERT(device != NULL);
-    RT_ASSERT(data_len <= device->page_size);
-    RT_ASSERT(spare_len <= device->oob_size);
+/*
+ * spi_nand_wait_busy: wait the OIP/BUSY bit clear after the operation op.
+ * expect_us is the typical operation time. An operation longer than two
+ * ticks sleeps most of it at first. Then the poll interval starts from a
+ * quarter of expect_us and doubles up to expect_us, a poll interval of
+ * a tick or longer sleeps, a shorter one delays and yields the CPU.
+ * The timeout is twice the max operation time, or nand_dev->retry if the
+ * chip doesn't give one. A program or erase reporting its fail bit in the
+ * ready status returns -RT_EIO, a failed status read returns its error.
+ */
+static rt_err_t spi_nand_wait_busy(struct rt_mtd_nand_device *device, rt_uint8_t op)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint8_t sr_addr = 0;
+    rt_uint8_t sr_value = 0;
+    rt_uint8_t sr_busy_bit_mask = 0;
+    rt_uint32_t interval = 0;
+    rt_uint32_t expect_us = 0, max_us = 0;
+    rt_tick_t start = 0, timeout = 0;
+    rt_bool_t stream = RT_FALSE;
 
     struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
     nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
-    const nand_spi *spi = &nand_dev->spi;
+    const nand_flash_timing *timing = &nand_dev->chip_info.timing;
 
-    page = page + (device->block_start) * (device->pages_per_block);
-    if (page >= (device->block_end) * device->pages_per_block)
+    switch (op)
     {
-        LOG_E("failed to read page, the page %d is out of bound.", page);
-        return -RT_ERROR;
+    case NAND_OP_READ:
+        expect_us = timing->read_us;
+        max_us = timing->read_max_us;
+        break;
+    case NAND_OP_PROG:
+        expect_us = timing->prog_us;
+        max_us = timing->prog_max_us;
+        break;
+    case NAND_OP_ERASE:
+        expect_us = timing->erase_us;
+        max_us = timing->erase_max_us;
+        break;
+    default:
+        expect_us = timing->reset_max_us / 4;
+        max_us = timing->reset_max_us;
+        break;
     }
 
-    res = spi_nand_get_feature(device, NAND_SR2_ADDR, &sr2);
-    if (res != RT_EOK)
+    timeout = nand_dev->retry.timeout;
+    if (max_us != 0)
     {
-        return res;
+        timeout = rt_tick_from_millisecond((2 * max_us + 999) / 1000) + 1;
     }
 
-    /* 0x13 dummy[8bit] page_addr[16bit] */
-    page_data[0] = NAND_READ_PAGE_TO_CACHE;
-    page_data[1] = DUMMY_CMD;
-    page_data[2] = (page >> 8) & 0xff;
-    page_data[3] = page & 0xff;
+    sr_addr = (nand_dev->chip_info.busy_bit >> 8) & 0xff;
+    sr_busy_bit_mask = (nand_dev->chip_info.busy_bit) & 0xff;
+    stream = (nand_dev->chip_info.feature & NAND_FEATURE_STATUS_STREAM) ? RT_TRUE : RT_FALSE;
 
-    nand_dev->spi.wr(spi, page_data, 4, 0, 0);
-#ifdef NAND_USING_QSPI
-    //TODO: Organize commands and data,and send them through QSPI
-    nand_dev->spi.qspi_wr(spi, 0, (nand_qspi_cmd_format *)&nand_dev->qspi_cmd_format, &page_data, 4, 0, 0);
-#endif
+    NAND_STAT_BUSY_BEGIN(device);
+    start = rt_tick_get();
+    if (expect_us >= 2 * NAND_TICK_US)
+    {
+        NAND_STAT_TIME(sleep_start);
+        rt_thread_delay(expect_us * 3 / 4 / NAND_TICK_US);
+        NAND_STAT_PHASE(device, NAND_STAT_DELAY, sleep_start);
+    }
 
-    rt_hw_us_delay(500);
+    interval = expect_us / 4;
+    if (interval < nand_dev->retry.interval)
+    {
+        interval = nand_dev->retry.interval;
+    }
 
-    res = strcmp(nand_dev->chip.name, "W25N01GV");
-    if ((res) || ((!res) && (sr2 & NAND_SR2_BUF_BIT_MASK)))
+    while (1)
     {
-        if (data != RT_NULL && data_len != 0)
+        /* the status stream holds the bus, only use it for the short waits */
+        result = -RT_ENOSYS;
+        if (stream && interval < NAND_TICK_US)
         {
-            /* 0x03 cl_addr[16bit] dummy[8bit] */
-            column_data[0] = NAND_READ_FROM_CACHE;
-            column_data[1] = (column_addr >> 8) & 0x0f; //only CA[11:0] is effective
-            column_data[2] = column_addr & 0xff;
-            column_data[3] = DUMMY_CMD;
-
-            nand_dev->spi.wr(spi, column_data, 4, data, (data_len));
-#ifdef NAND_USING_QSPI
-            //TODO: Organize commands and data,and send them through QSPI
-            nand_dev->spi.qspi_wr(spi, 0, 0, &column_data, 4, data, (data_len));
-#endif
-
-            rt_hw_us_delay(500);
-            column_addr = NAND_PAGE_DATA_SIZE;
-            /* 0x03 cl_addr[16bit] dummy[8bit] */
-            column_data[0] = NAND_READ_FROM_CACHE;
-            column_data[1] = (column_addr >> 8) & 0x0f; /* only CA[11:0] is effective */
-            column_data[2] = column_addr & 0xff;
-            column_data[3] = DUMMY_CMD;
-
-            nand_dev->spi.wr(spi, column_data, 4, oob, (NAND_PAGE_OOB_SIZE));
-#ifdef NAND_USING_QSPI
-            //TODO: Organize commands and data,and send them through QSPI
-            nand_dev->spi.qspi_wr(spi, 0, 0, &column_data, 4, oob, (NAND_PAGE_OOB_SIZE));
-#endif
-
-            /* verify ECC */
-#ifdef RT_USING_NFTLaa
-            if (nftl_ecc_verify256(data, NAND_PAGE_DATA_SIZE, oob) != RT_MTD_EOK)
+            result = spi_nand_get_status_stream(device, sr_addr, sr_busy_bit_mask, &sr_value);
+        }
+        if (result != RT_EOK)
+        {
+            result = spi_nand_get_feature(device, sr_addr, &sr_value);
+        }
+        NAND_STAT_POLL(device);
+        if (result != RT_EOK)
+        {
+            /* a lost status byte doesn't mean ready */
+            NAND_STAT_BUSY_END(device);
+            LOG_E("wait busy status read failed, err %d.", result);
+            return result;
+        }
+        if ((sr_value & sr_busy_bit_mask) == 0)
+        {
+            nand_dev->status = sr_value;
+            NAND_STAT_BUSY_END(device);
+            if ((op == NAND_OP_PROG && (sr_value & nand_dev->chip_info.prog_fail))
+                    || (op == NAND_OP_ERASE && (sr_value & nand_dev->chip_info.erase_fail)))
             {
-                res = -RT_MTD_EECC;
-                LOG_E("ECC failed!, page:%d", page);
+                LOG_W("%s failed, status 0x%02x.", op == NAND_OP_PROG ? "program" : "erase", sr_value);
+                return -RT_EIO;
             }
-#endif
-
+            return RT_EOK;
         }
-        if (spare != RT_NULL && spare_len != 0)
+        if (rt_tick_get() - start > timeout)
         {
-            column_addr = NAND_PAGE_DATA_SIZE;
-            /* 0x03 cl_addr[16bit] dummy[8bit] */
-            column_data[0] = NAND_READ_FROM_CACHE;
-            column_data[1] = (column_addr >> 8) & 0x0f; /* only CA[11:0] is effective */
-            column_data[2] = column_addr & 0xff;
-            column_data[3] = DUMMY_CMD;
-
-            nand_dev->spi.wr(spi, column_data, 4, oob, (NAND_PAGE_OOB_SIZE));
-#ifdef NAND_USING_QSPI
-            //TODO: Organize commands and data,and send them through QSPI
-            nand_dev->spi.qspi_wr(spi, 0, 0, &column_data, 4, oob, (NAND_PAGE_OOB_SIZE));
-#endif
+            break;
+        }
 
-            if (spare != RT_NULL)
+        {
+            NAND_STAT_TIME(delay_start);
+            if (interval >= NAND_TICK_US)
+            {
+                rt_thread_delay(interval / NAND_TICK_US);
+            }
+            else
             {
-                rt_memcpy(spare, oob, NAND_PAGE_OOB_SIZE);
+                rt_hw_us_delay(interval);
+                rt_thread_yield();
             }
+            NAND_STAT_PHASE(device, NAND_STAT_DELAY, delay_start);
         }
 
-    }
-    else
-    {
-        // TODO: this is only in winbond(BUF=0,read begin with the page, end with all nand)
-        /* 0x03 dummy[24bit] */
-        column_data[0] = NAND_READ_FROM_CACHE;
-        column_data[1] = DUMMY_CMD;
-        column_data[2] = DUMMY_CMD;
-        column_data[3] = DUMMY_CMD;
-        rt_kprintf("BUF bit=0,will read one page to end of the nand,TODO......\n");
-        return RT_ERROR;
+        if (interval < expect_us)
+        {
+            interval <<= 1;
+        }
     }
 
-    return RT_EOK;
+    NAND_STAT_BUSY_END(device);
+    LOG_E("wait busy timeout, status 0x%02x.", sr_value);
+    return -RT_ETIMEOUT;
 }
 
-static rt_err_t spi_nand_write_enable(struct rt_mtd_nand_device *device)
+/*
+ * spi_nand_die_addr: split a chip page into the die and the page in the die,
+ * the blocks are interleaved over the dies.
+ */
+static rt_off_t spi_nand_die_addr(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint8_t *die)
 {
-    rt_uint8_t cmd_data = NAND_WRITE_ENABLE;
+    rt_uint32_t block = 0;
 
     struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
     nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
-    const nand_spi *spi = &nand_dev->spi;
 
-    nand_dev->spi.wr(spi, &cmd_data, 1, 0, 0);
+    if (nand_dev->chip_info.die_num <= 1)
+    {
+        *die = 0;
+        return page;
+    }
 
-    return RT_EOK;
+    block = page / device->pages_per_block;
+    *die = block % nand_dev->chip_info.die_num;
+
+    return (block / nand_dev->chip_info.die_num) * device->pages_per_block + page % device->pages_per_block;
 }
 
-static rt_err_t spi_nand_write_disable(struct rt_mtd_nand_device *device)
+/*
+ * spi_nand_blank_mark: record whether the chip block is known erased, a block
+ * is blank after a finished erase until its first program.
+ */
+static void spi_nand_blank_mark(struct rt_mtd_nand_device *device, rt_uint32_t block, rt_bool_t blank)
 {
-    rt_uint8_t cmd_data = NAND_WRITE_DISABLE;//0x04
-
     struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
     nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
-    const nand_spi *spi = &nand_dev->spi;
 
-    nand_dev->spi.wr(spi, &cmd_data, 1, 0, 0);
-    return RT_EOK;
+    if (nand_dev->blank_map == RT_NULL || block >= device->block_end)
+    {
+        return;
+    }
+
+    if (blank)
+    {
+        nand_dev->blank_map[block >> 3] |= 1 << (block & 0x7);
+#ifdef NAND_USING_REFRESH
+        /* the erase clears the read disturb */
+        nand_refresh_erased(device, block - device->block_start);
+#endif
+    }
+    else
+    {
+        nand_dev->blank_map[block >> 3] &= ~(1 << (block & 0x7));
+    }
 }
 
-rt_err_t _write_page(struct rt_mtd_nand_device *device,
-                     rt_off_t page,
-                     const rt_uint8_t *data, rt_uint32_t data_len,
-                     const rt_uint8_t *spare, rt_uint32_t spare_len)
+/*
+ * spi_nand_die_select: make the die active by Software Die Select, a
+ * program or erase in flight on the die is waited first, its error is kept
+ * in die_result until spi_nand_die_finish. A finished erase marks its block
+ * blank.
+ */
+static rt_err_t spi_nand_die_select(struct rt_mtd_nand_device *device, rt_uint8_t die)
 {
-    rt_uint8_t cmd_data[3], execute_data[4];
-    rt_uint16_t column_addr = 0;
-    rt_uint8_t oob[NAND_PAGE_OOB_SIZE];
-
-    RT_ASSERT(data_len <= device->page_size);
-    RT_ASSERT(spare_len <= device->oob_size);
+    rt_err_t result = RT_EOK;
+    rt_uint8_t cmd_data[2];
 
     struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
     nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
     const nand_spi *spi = &nand_dev->spi;
 
-    page = page + device->block_start * device->pages_per_block;
-    if (page >= (device->block_end) * device->pages_per_block)
+    if (nand_dev->chip_info.die_num > 1 && nand_dev->die_sel != die)
     {
-        return -RT_ERROR;
+        /* 0xc2 die_id[8bit] */
+        cmd_data[0] = NAND_DIE_SELECT;
+        cmd_data[1] = die;
+        result = nand_dev->spi.wr(spi, cmd_data, sizeof(cmd_data), 0, 0);
+        if (result != RT_EOK)
+        {
+            return result;
+        }
+        nand_dev->die_sel = die;
     }
 
-    if (data != RT_NULL && data_len != 0)   /* write data */
+    if (nand_dev->die_busy & (1 << die))
     {
-        column_addr = 0;
-        /* 0x02 cl_addr[16bit] write_buff */
-        cmd_data[0] = NAND_WRITE;
-        cmd_data[1] = (column_addr >> 8) & 0x0f; /* only CA[11:0] is effective */
-        cmd_data[2] = column_addr & 0xff;
-
-        spi_nand_set_feature(device, NAND_PROTECT_DISABLE);
-        spi_nand_write_enable(device);
-        rt_hw_us_delay(900);
-
-        rt_spi_send_then_send(rtt_dev->rt_spi_device, cmd_data, sizeof(cmd_data), data, (data_len));
-
-        /* Progrom Excute: 0x10 dummy[8bit] page_addr[16bit] */
-        execute_data[0] = NAND_WRITE_EXECUTE;
-        execute_data[1] = DUMMY_CMD;
-        execute_data[2] = (page >> 8) & 0xff;
-        execute_data[3] = page & 0xff;
-
-        nand_dev->spi.wr(spi, execute_data, sizeof(execute_data), 0, 0);
-#ifdef NAND_USING_QSPI
-        //TODO: Organize commands and data,and send them through QSPI
-        nand_dev->spi.qspi_wr(spi, 0, 0, &execute_data, sizeof(execute_data), 0, 0);
-#endif
-
-        /* wait busy */
-        spi_nand_wait_busy(device);
-        spi_nand_write_disable(device);
-        spi_nand_set_feature(device, NAND_PROTECT_ENABLE);
-
-        rt_hw_us_delay(500);
-        if (spare != RT_NULL && spare_len != 0)         /* write spare */
+        result = spi_nand_wait_busy(device, nand_dev->die_op[die]);
+        if (result != RT_EOK)
         {
-            if (spare != RT_NULL && spare_len > 0)
-            {
-                memcpy(oob, spare, spare_len);
-            }
+            nand_dev->die_result[die] = result;
+        }
+        else if (nand_dev->die_op[die] == NAND_OP_ERASE)
+        {
+            spi_nand_blank_mark(device, nand_dev->die_block[die], RT_TRUE);
+        }
+        nand_dev->die_busy &= ~(1 << die);
+    }
 
-#ifdef RT_USING_NFTLxx
-            nftl_ecc_compute256(data, NAND_PAGE_DATA_SIZE, oob);
-#endif
-            column_addr = NAND_PAGE_DATA_SIZE;
+    return result;
+}
 
-            /* 0x02 cl_addr[16bit] write_buff */
-            cmd_data[0] = NAND_WRITE;
-            cmd_data[1] = (column_addr >> 8) & 0x0f;  /* only CA[11:0] is effective */
-            cmd_data[2] = column_addr & 0xff;
+/*
+ * spi_nand_die_enter: select the die of the chip page, return the page in the die.
+ */
+static rt_off_t spi_nand_die_enter(struct rt_mtd_nand_device *device, rt_off_t page)
+{
+    rt_uint8_t die = 0;
+    rt_off_t die_page;
 
-            spi_nand_set_feature(device, NAND_PROTECT_DISABLE);
-            spi_nand_write_enable(device);
-            rt_hw_us_delay(900);
+    die_page = spi_nand_die_addr(device, page, &die);
+    spi_nand_die_select(device, die);
 
-            rt_spi_send_then_send(rtt_dev->rt_spi_device, cmd_data, sizeof(cmd_data), oob, (spare_len));
+    return die_page;
+}
 
-            /* Progrom Excute: 0x10 dummy[8bit] page_addr[16bit]  */
-            execute_data[0] = NAND_WRITE_EXECUTE;
-            execute_data[1] = DUMMY_CMD;
-            execute_data[2] = (page >> 8) & 0xff;
-            execute_data[3] = page & 0xff;
+/*
+ * spi_nand_die_span: the pages from the chip page that can be read in one
+ * run, a run can't go to the next block of a multi-die chip, it is in
+ * another die.
+ */
+static rt_uint32_t spi_nand_die_span(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t page_count)
+{
+    rt_uint32_t left = 0;
 
-            nand_dev->spi.wr(spi, execute_data, sizeof(execute_data), 0, 0);
-#ifdef NAND_USING_QSPI
-            //TODO: Organize commands and data,and send them through QSPI
-            nand_dev->spi.qspi_wr(spi, 0, 0, &execute_data, sizeof(execute_data), 0, 0);
-#endif
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
 
-            /* wait busy */
-            spi_nand_wait_busy(device);
-            spi_nand_write_disable(device);
-            spi_nand_set_feature(device, NAND_PROTECT_ENABLE);
-        }
-    }
-    else if (spare != RT_NULL && spare_len != 0)   /* write spare */
+    if (nand_dev->chip_info.die_num <= 1)
     {
-        column_addr = NAND_PAGE_DATA_SIZE;
+        return page_count;
+    }
 
-        /* 0x02 cl_addr[16bit] write_buff */
-        cmd_data[0] = NAND_WRITE;
-        cmd_data[1] = (column_addr >> 8) & 0x0f;  /* only CA[11:0] is effective */
-        cmd_data[2] = column_addr & 0xff;
+    left = device->pages_per_block - page % device->pages_per_block;
 
-        spi_nand_set_feature(device, NAND_PROTECT_DISABLE);
-        spi_nand_write_enable(device);
-        rt_hw_us_delay(900);
+    return page_count < left ? page_count : left;
+}
 
-        rt_spi_send_then_send(rtt_dev->rt_spi_device, cmd_data, sizeof(cmd_data), spare, (spare_len));
+/*
+ * spi_nand_die_of_page: the die holding the page.
+ */
+rt_uint8_t spi_nand_die_of_page(struct rt_mtd_nand_device *device, rt_off_t page)
+{
+    rt_uint8_t die = 0;
 
-        /* Progrom Excute: 0x10 dummy[8bit] page_addr[16bit] */
-        execute_data[0] = NAND_WRITE_EXECUTE;
-        execute_data[1] = DUMMY_CMD;
-        execute_data[2] = (page >> 8) & 0xff;
-        execute_data[3] = page & 0xff;
+    spi_nand_die_addr(device, page + device->block_start * device->pages_per_block, &die);
 
-        nand_dev->spi.wr(spi, execute_data, sizeof(execute_data), 0, 0);
-#ifdef NAND_USING_QSPI
-        //TODO: Organize commands and data,and send them through QSPI
-        nand_dev->spi.qspi_wr(spi, 0, 0, &execute_data, sizeof(execute_data), 0, 0);
-#endif
+    return die;
+}
 
-        /* wait busy */
-        spi_nand_wait_busy(device);
-        spi_nand_write_disable(device);
-        spi_nand_set_feature(device, NAND_PROTECT_ENABLE);
+/*
+ * spi_nand_die_finish: wait the program or erase started on the die by
+ * spi_nand_program_start/spi_nand_erase_start, return and clear its result.
+ */
+rt_err_t spi_nand_die_finish(struct rt_mtd_nand_device *device, rt_uint8_t die)
+{
+    rt_err_t result = RT_EOK;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    nand_dev->spi.lock(spi);
+    spi_nand_die_select(device, die);
+    result = nand_dev->die_result[die];
+    nand_dev->die_result[die] = RT_EOK;
+    nand_dev->spi.unlock(spi);
+
+    return result;
+}
+
+/*
+ * spi_nand_block_is_blank: RT_TRUE if the block is known erased and not
+ * programmed since. Blocks erased before boot are not known blank.
+ */
+rt_bool_t spi_nand_block_is_blank(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    block += device->block_start;
+    if (nand_dev->blank_map == RT_NULL || block >= device->block_end)
+    {
+        return RT_FALSE;
+    }
+
+    return (nand_dev->blank_map[block >> 3] >> (block & 0x7)) & 0x1 ? RT_TRUE : RT_FALSE;
+}
+
+static rt_err_t _read_id(struct rt_mtd_nand_device *device)
+{
+    rt_uint8_t recv_buff[4] = { 0 };
+    int i = 0;
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    rt_uint8_t cmd_data = NAND_READ_ID;
+
+    nand_dev->spi.wr(spi, &cmd_data, 1, recv_buff, 4);
+
+    LOG_I("Nand flash device id is 0x%x%x%x.", recv_buff[1], recv_buff[2], recv_buff[3]);
+
+    /* find device from chip table */
+    for (i = 0; i < sizeof(nand_flash_info_table) / sizeof(nand_flash_chip_info); i++)
+    {
+        if ((nand_flash_info_table[i].mf_id == recv_buff[1])
+                && (nand_flash_info_table[i].type_id == recv_buff[2])
+                && (nand_flash_info_table[i].capacity_id == recv_buff[3]))
+        {
+            nand_dev->chip.name = nand_flash_info_table[i].name;
+            nand_dev->chip.mf_id = nand_flash_info_table[i].mf_id;
+            nand_dev->chip.type_id = nand_flash_info_table[i].type_id;
+            nand_dev->chip.capacity_id = nand_flash_info_table[i].capacity_id;
+            nand_dev->chip_info = nand_flash_info_table[i];
+            LOG_I("Nand flash device name is %s.", nand_dev->chip.name);
+            return RT_EOK;
+        }
+    }
+
+    LOG_I("Unkonwn nand, device id is 0x%x%x%x.", recv_buff[1], recv_buff[2], recv_buff[3]);
+    return -RT_ERROR;
+}
+
+#if RT_NAND_DMA_ALIGN > 1
+/* the buffer can be DMA'd directly, a partial cache line can't be invalidated */
+#define NAND_DMA_ALIGNED(buf, len)    (((((rt_ubase_t)(buf)) | (len)) & (RT_NAND_DMA_ALIGN - 1)) == 0)
+
+/*
+ * spi_nand_dma_buf: the buffer to transfer len bytes of buf at offset of the
+ * bounce buffer, buf itself if it is aligned or there is no bounce buffer.
+ */
+static rt_uint8_t *spi_nand_dma_buf(nand_flash_t nand_dev, const rt_uint8_t *buf, rt_uint32_t len, rt_uint32_t offset)
+{
+    if (buf == RT_NULL || nand_dev->dma_buf == RT_NULL || NAND_DMA_ALIGNED(buf, len))
+    {
+        return (rt_uint8_t *)buf;
+    }
+
+    return nand_dev->dma_buf + RT_ALIGN(offset, RT_NAND_DMA_ALIGN);
+}
+#endif /* RT_NAND_DMA_ALIGN > 1 */
+
+/*
+ * spi_nand_read_cache: read data from the chip cache, starting at column_addr.
+ * buf2 (optional) receives the bytes right after buf, the two buffers are
+ * filled in one Read from Cache transaction on a SPI bus.
+ * On a QSPI bus the fast read cmd format selected at probe is used.
+ */
+static rt_err_t spi_nand_read_cache(struct rt_mtd_nand_device *device,
+                                    rt_uint16_t column_addr,
+                                    rt_uint8_t *buf,
+                                    rt_uint32_t len,
+                                    rt_uint8_t *buf2,
+                                    rt_uint32_t len2)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint8_t column_data[4];
+    nand_spi_xfer xfer[3];
+    rt_uint8_t *rx_buf = buf, *rx_buf2 = buf2;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    if (buf2 == RT_NULL || len2 == 0)
+    {
+        buf2 = RT_NULL;
+        len2 = 0;
+    }
+
+#if RT_NAND_DMA_ALIGN > 1
+    rx_buf = spi_nand_dma_buf(nand_dev, buf, len, 0);
+    rx_buf2 = spi_nand_dma_buf(nand_dev, buf2, len2, len);
+#endif
+
+#ifdef NAND_USING_QSPI
+    if (NAND_BUS_IS_QSPI(rtt_dev))
+    {
+        /* only CA[11:0] is effective */
+        result = nand_dev->spi.qspi_wr(spi, column_addr & 0x0fff, &nand_dev->qspi_cmd_format, RT_NULL, 0, rx_buf, len);
+        if (result == RT_EOK && buf2 != RT_NULL)
+        {
+            result = nand_dev->spi.qspi_wr(spi, (column_addr + len) & 0x0fff, &nand_dev->qspi_cmd_format,
+                                           RT_NULL, 0, rx_buf2, len2);
+        }
+        goto __exit;
+    }
+#endif
+
+    /* 0x03 cl_addr[16bit] dummy[8bit] */
+    column_data[0] = NAND_READ_FROM_CACHE;
+    column_data[1] = (column_addr >> 8) & 0x0f; /* only CA[11:0] is effective */
+    column_data[2] = column_addr & 0xff;
+    column_data[3] = DUMMY_CMD;
+
+    if (buf2 == RT_NULL)
+    {
+        result = nand_dev->spi.wr(spi, column_data, sizeof(column_data), rx_buf, len);
+        goto __exit;
+    }
+
+    xfer[0].send_buf = column_data;
+    xfer[0].recv_buf = RT_NULL;
+    xfer[0].length = sizeof(column_data);
+    xfer[0].cs_change = RT_FALSE;
+    xfer[1].send_buf = RT_NULL;
+    xfer[1].recv_buf = rx_buf;
+    xfer[1].length = len;
+    xfer[1].cs_change = RT_FALSE;
+    xfer[2].send_buf = RT_NULL;
+    xfer[2].recv_buf = rx_buf2;
+    xfer[2].length = len2;
+    xfer[2].cs_change = RT_FALSE;
+
+    result = nand_dev->spi.xfer(spi, xfer, 3);
+
+__exit:
+    /* the bounced parts back to the caller */
+    if (result == RT_EOK && rx_buf != buf)
+    {
+        rt_memcpy(buf, rx_buf, len);
+    }
+    if (result == RT_EOK && rx_buf2 != buf2)
+    {
+        rt_memcpy(buf2, rx_buf2, len2);
+    }
+
+    return result;
+}
+
+/*
+ * spi_nand_ecc_result: decode the on-chip ECC status of the last page loaded
+ * to the cache, RT_EOK, -RT_MTD_EECC_CORRECT or -RT_MTD_EECC. The status
+ * read by the busy wait is used if the ECC bits are in the same register,
+ * unless reread is set.
+ */
+static rt_err_t spi_nand_ecc_result(struct rt_mtd_nand_device *device, rt_bool_t reread)
+{
+#ifdef NAND_USING_HW_ECC
+    rt_uint8_t sr_addr = 0;
+    rt_uint8_t sr_value = 0;
+    rt_uint8_t mask = 0;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    sr_addr = (nand_dev->chip_info.ecc_status >> 8) & 0xff;
+    mask = nand_dev->chip_info.ecc_status & 0xff;
+    if (mask == 0)
+    {
+        return RT_EOK;
+    }
+
+    if (!reread && sr_addr == ((nand_dev->chip_info.busy_bit >> 8) & 0xff))
+    {
+        sr_value = nand_dev->status;
+    }
+    else if (spi_nand_get_feature(device, sr_addr, &sr_value) != RT_EOK)
+    {
+        return -RT_ERROR;
+    }
+
+    /* the status value, right aligned */
+    sr_value &= mask;
+    while (!(mask & 0x1))
+    {
+        mask >>= 1;
+        sr_value >>= 1;
+    }
+
+    if (nand_dev->chip_info.ecc_fail & (1 << sr_value))
+    {
+        nand_dev->bitflips = NAND_BITFLIPS_UNCORRECTABLE;
+        return -RT_MTD_EECC;
+    }
+    if (sr_value != 0)
+    {
+        /* the chip doesn't tell how many bits */
+        if (nand_dev->bitflips == 0)
+        {
+            nand_dev->bitflips = 1;
+        }
+        return -RT_MTD_EECC_CORRECT;
+    }
+#endif /* NAND_USING_HW_ECC */
+
+    return RT_EOK;
+}
+
+/*
+ * spi_nand_ecc_merge: keep the worst ECC result of a multi-page read in *ecc,
+ * an ECC result turns into RT_EOK so the read goes on, other errors are
+ * returned as they are.
+ */
+static rt_err_t spi_nand_ecc_merge(rt_err_t *ecc, rt_err_t result)
+{
+    if (result == -RT_MTD_EECC || (result == -RT_MTD_EECC_CORRECT && *ecc == RT_EOK))
+    {
+        *ecc = result;
+        return RT_EOK;
+    }
+    if (result == -RT_MTD_EECC_CORRECT)
+    {
+        return RT_EOK;
+    }
+
+    return result;
+}
+
+/*
+ * spi_nand_read_account: charge page_count reads from the chip page on and
+ * the bitflips of the ECC decodes since the last account to their blocks.
+ */
+static void spi_nand_read_account(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t page_count)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+#ifdef NAND_USING_REFRESH
+    rt_uint32_t i = 0;
+
+    for (i = 0; i < page_count; i++)
+    {
+        nand_refresh_account(device, (page + i) / device->pages_per_block - device->block_start,
+                             nand_dev->bitflips);
+    }
+#endif
+
+    nand_dev->bitflips = 0;
+}
+
+/*
+ * spi_nand_page_to_cache: Page Data Read, load one page from the array to the
+ * chip cache, return the on-chip ECC result of the page.
+ */
+static rt_err_t spi_nand_page_to_cache(struct rt_mtd_nand_device *device, rt_off_t page)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint8_t page_data[4];
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    page = spi_nand_die_enter(device, page);
+
+    /* 0x13 dummy[8bit] page_addr[16bit] */
+    page_data[0] = NAND_READ_PAGE_TO_CACHE;
+    page_data[1] = DUMMY_CMD;
+    page_data[2] = (page >> 8) & 0xff;
+    page_data[3] = page & 0xff;
+
+    nand_dev->spi.wr(spi, page_data, sizeof(page_data), 0, 0);
+
+    /* wait tR */
+    result = spi_nand_wait_busy(device, NAND_OP_READ);
+    if (result != RT_EOK)
+    {
+        return result;
+    }
+
+    return spi_nand_ecc_result(device, RT_FALSE);
+}
+
+#ifdef NAND_USING_SW_ECC
+/*
+ * spi_nand_read_cache_ecc: read the data with the whole spare, copy the
+ * requested spare, then check the data by the software ECC. A whole spare
+ * request is read in place of the ECC spare buffer. The ECC checks whole
+ * sectors, a read ending inside a sector goes through the ECC data buffer.
+ */
+static rt_err_t spi_nand_read_cache_ecc(struct rt_mtd_nand_device *device,
+                                        rt_uint8_t *data,
+                                        rt_uint32_t data_len,
+                                        rt_uint8_t *spare,
+                                        rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint32_t read_len = RT_ALIGN(data_len, NAND_ECC_SECTOR_SIZE);
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    rt_uint8_t *oob_buf = nand_dev->ecc->oob_buf;
+    rt_uint8_t *data_buf = read_len == data_len ? data : nand_dev->ecc->data_buf;
+
+    if (spare != RT_NULL && spare_len == device->oob_size)
+    {
+        oob_buf = spare;
+    }
+
+    if (read_len == device->page_size)
+    {
+        result = spi_nand_read_cache(device, 0, data_buf, read_len, oob_buf, device->oob_size);
+    }
+    else
+    {
+        result = spi_nand_read_cache(device, 0, data_buf, read_len, RT_NULL, 0);
+        if (result == RT_EOK)
+        {
+            result = spi_nand_read_cache(device, device->page_size, oob_buf, device->oob_size, RT_NULL, 0);
+        }
+    }
+    if (result != RT_EOK)
+    {
+        return result;
+    }
+
+    if (spare != RT_NULL && spare_len != 0 && oob_buf != spare)
+    {
+        rt_memcpy(spare, oob_buf, spare_len);
+    }
+
+    /* an uncorrectable sector is copied out as read */
+    result = nand_ecc_page_correct(device, data_buf, read_len, oob_buf);
+    if (data_buf != data)
+    {
+        rt_memcpy(data, data_buf, data_len);
+    }
+
+    return result;
+}
+#endif /* NAND_USING_SW_ECC */
+
+/*
+ * spi_nand_read_cache_page: read the requested data and spare of the page
+ * already loaded in the chip cache, return the software ECC result if any.
+ */
+static rt_err_t spi_nand_read_cache_page(struct rt_mtd_nand_device *device,
+                                         rt_uint8_t *data,
+                                         rt_uint32_t data_len,
+                                         rt_uint8_t *spare,
+                                         rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+
+#ifdef NAND_USING_SW_ECC
+    nand_flash_t nand_dev = (nand_flash_t)rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device)->user_data;
+
+    if (nand_dev->ecc != RT_NULL && data != RT_NULL && data_len != 0)
+    {
+        return spi_nand_read_cache_ecc(device, data, data_len, spare, spare_len);
+    }
+#endif
+
+    if (data != RT_NULL && data_len != 0)
+    {
+        if (spare != RT_NULL && spare_len != 0 && data_len == device->page_size)
+        {
+            /* data and spare are contiguous in cache, stream them in one transaction */
+            return spi_nand_read_cache(device, 0, data, data_len, spare, spare_len);
+        }
+
+        result = spi_nand_read_cache(device, 0, data, data_len, RT_NULL, 0);
+        if (result != RT_EOK)
+        {
+            return result;
+        }
+    }
+
+    if (spare != RT_NULL && spare_len != 0)
+    {
+        result = spi_nand_read_cache(device, device->page_size, spare, spare_len, RT_NULL, 0);
+    }
+
+    return result;
+}
+
+rt_err_t _read_page(struct rt_mtd_nand_device *device,
+                    rt_off_t page,
+                    rt_uint8_t *data,
+                    rt_uint32_t data_len,
+                    rt_uint8_t *spare,
+                    rt_uint32_t spare_len)
+{
+    int res = RT_EOK;
+    rt_err_t ecc = RT_EOK;
+
+    RT_ASSERT(device != NULL);
+    RT_ASSERT(data_len <= device->page_size);
+    RT_ASSERT(spare_len <= device->oob_size);
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    page = page + (device->block_start) * (device->pages_per_block);
+    if (page >= (device->block_end) * device->pages_per_block)
+    {
+        LOG_E("failed to read page, the page %d is out of bound.", page);
+        return -RT_ERROR;
+    }
+
+    NAND_STAT_TIME(lock_start);
+    nand_dev->spi.lock(spi);
+    NAND_STAT_BEGIN(device, NAND_STAT_READ, lock_start);
+
+    /* BUF=0 reads to the end of the array, page read needs the buffer read mode */
+    if ((nand_dev->chip_info.feature & NAND_FEATURE_CONT_READ) && !(nand_dev->sr2 & NAND_SR2_BUF_BIT_MASK))
+    {
+        spi_nand_set_feature(device, NAND_BUF_ENABLE);
+    }
+
+    /* the page is read out even if it is uncorrectable */
+    res = spi_nand_ecc_merge(&ecc, spi_nand_page_to_cache(device, page));
+    if (res != RT_EOK)
+    {
+        goto __exit;
+    }
+
+    res = spi_nand_ecc_merge(&ecc, spi_nand_read_cache_page(device, data, data_len, spare, spare_len));
+    if (res == RT_EOK && ecc == -RT_MTD_EECC)
+    {
+        LOG_E("page %d ECC uncorrectable.", page);
+    }
+    if (res == RT_EOK)
+    {
+        spi_nand_read_account(device, page, 1);
+    }
+
+__exit:
+    NAND_STAT_END(device);
+    nand_dev->spi.unlock(spi);
+
+    return res == RT_EOK ? ecc : res;
+}
+
+/*
+ * spi_nand_read_cont: Continuous Read mode (BUF=0), the chip keeps moving
+ * to the next page while the chip select stays low, only the main area of
+ * each page is output.
+ */
+static rt_err_t spi_nand_read_cont(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint8_t *buf,
+                                   rt_uint32_t page_count)
+{
+    rt_err_t result = RT_EOK;
+    rt_err_t ecc = RT_EOK;
+    rt_uint8_t cmd_data[4];
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    spi_nand_set_feature(device, NAND_BUF_DISABLE);
+
+    result = spi_nand_ecc_merge(&ecc, spi_nand_page_to_cache(device, page));
+    if (result != RT_EOK)
+    {
+        goto __exit;
+    }
+
+#ifdef NAND_USING_QSPI
+    if (NAND_BUS_IS_QSPI(rtt_dev))
+    {
+        /* the column address cycles turn into dummy cycles */
+        nand_qspi_cmd_format cont_format = nand_dev->qspi_cmd_format;
+
+        cont_format.dummy_cycles += cont_format.address_size / cont_format.address_lines;
+        cont_format.address_size = 0;
+        cont_format.address_lines = 0;
+
+        result = nand_dev->spi.qspi_wr(spi, 0, &cont_format, RT_NULL, 0, buf, page_count * device->page_size);
+    }
+    else
+#endif
+    {
+        /* 0x03 dummy[24bit] */
+        cmd_data[0] = NAND_READ_FROM_CACHE;
+        cmd_data[1] = DUMMY_CMD;
+        cmd_data[2] = DUMMY_CMD;
+        cmd_data[3] = DUMMY_CMD;
+
+        result = nand_dev->spi.wr(spi, cmd_data, sizeof(cmd_data), buf, page_count * device->page_size);
+    }
+
+    /* the ECC status holds the worst page of the continuous read, it is charged to every page */
+    if (result == RT_EOK)
+    {
+        result = spi_nand_ecc_merge(&ecc, spi_nand_ecc_result(device, RT_TRUE));
+    }
+    if (result == RT_EOK)
+    {
+        spi_nand_read_account(device, page, page_count);
+    }
+
+__exit:
+    spi_nand_set_feature(device, NAND_BUF_ENABLE);
+    return result == RT_EOK ? ecc : result;
+}
+
+/*
+ * spi_nand_read_cache_pipe: Cache Read Random, page N is read out of the
+ * cache while page N+1 is loaded from the array. page is the chip page,
+ * data and spare are filled with data_len and spare_len bytes per page.
+ */
+static rt_err_t spi_nand_read_cache_pipe(struct rt_mtd_nand_device *device,
+                                         rt_off_t page,
+                                         rt_uint32_t page_count,
+                                         rt_uint8_t *data,
+                                         rt_uint32_t data_len,
+                                         rt_uint8_t *spare,
+                                         rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+    rt_err_t ecc = RT_EOK;
+    rt_uint32_t i = 0;
+    rt_uint8_t cmd_data[4];
+    rt_uint8_t die = 0;
+    rt_off_t next_page;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    result = spi_nand_ecc_merge(&ecc, spi_nand_page_to_cache(device, page));
+    if (result != RT_EOK)
+    {
+        return result;
+    }
+
+    for (i = 0; i < page_count; i++)
+    {
+        if (page_count > 1)
+        {
+            if (i < page_count - 1)
+            {
+                /* 0x30 dummy[8bit] page_addr[16bit]: page i to cache, start loading page i+1 */
+                next_page = spi_nand_die_addr(device, page + i + 1, &die);
+                cmd_data[0] = NAND_CACHE_READ_RANDOM;
+                cmd_data[1] = DUMMY_CMD;
+                cmd_data[2] = (next_page >> 8) & 0xff;
+                cmd_data[3] = next_page & 0xff;
+                nand_dev->spi.wr(spi, cmd_data, 4, 0, 0);
+            }
+            else
+            {
+                /* 0x3f: the last page to cache, end the cache read */
+                cmd_data[0] = NAND_CACHE_READ_END;
+                nand_dev->spi.wr(spi, cmd_data, 1, 0, 0);
+            }
+
+            result = spi_nand_wait_busy(device, NAND_OP_READ);
+            if (result == RT_EOK)
+            {
+                result = spi_nand_ecc_merge(&ecc, spi_nand_ecc_result(device, RT_FALSE));
+            }
+            if (result != RT_EOK)
+            {
+                return result;
+            }
+        }
+
+        result = spi_nand_ecc_merge(&ecc, spi_nand_read_cache_page(device,
+                                    data ? data + i * data_len : RT_NULL, data_len,
+                                    spare ? spare + i * spare_len : RT_NULL, spare_len));
+        if (result != RT_EOK)
+        {
+            return result;
+        }
+        spi_nand_read_account(device, page + i, 1);
+    }
+
+    return ecc;
+}
+
+/*
+ * spi_nand_read_pages: read page_count consecutive pages, data holds
+ * page_count * data_len bytes and spare holds page_count * spare_len bytes.
+ * On chips with cache read, the array load of the next page overlaps the
+ * transfer of the current one, otherwise the pages are read one by one.
+ */
+rt_err_t spi_nand_read_pages(struct rt_mtd_nand_device *device,
+                             rt_off_t page,
+                             rt_uint32_t page_count,
+                             rt_uint8_t *data,
+                             rt_uint32_t data_len,
+                             rt_uint8_t *spare,
+                             rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+    rt_err_t ecc = RT_EOK;
+    rt_uint32_t i = 0, count = 0;
+
+    RT_ASSERT(device != RT_NULL);
+    RT_ASSERT(data_len <= device->page_size);
+    RT_ASSERT(spare_len <= device->oob_size);
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    if (page_count == 0)
+    {
+        return RT_EOK;
+    }
+
+    if (page + (device->block_start) * (device->pages_per_block) + page_count
+            > (device->block_end) * device->pages_per_block)
+    {
+        LOG_E("failed to read pages, the page %d count %d is out of bound.", page, page_count);
+        return -RT_ERROR;
+    }
+
+    if (!(nand_dev->chip_info.feature & NAND_FEATURE_CACHE_READ))
+    {
+        for (i = 0; i < page_count && result == RT_EOK; i++)
+        {
+            result = spi_nand_ecc_merge(&ecc, _read_page(device, page + i,
+                                        data ? data + i * data_len : RT_NULL, data_len,
+                                        spare ? spare + i * spare_len : RT_NULL, spare_len));
+        }
+        return result == RT_EOK ? ecc : result;
+    }
+
+    nand_dev->spi.lock(spi);
+    page = page + (device->block_start) * (device->pages_per_block);
+    while (page_count > 0 && result == RT_EOK)
+    {
+        count = spi_nand_die_span(device, page, page_count);
+        result = spi_nand_ecc_merge(&ecc, spi_nand_read_cache_pipe(device, page, count, data, data_len,
+                                    spare, spare_len));
+
+        page += count;
+        page_count -= count;
+        data = data ? data + count * data_len : RT_NULL;
+        spare = spare ? spare + count * spare_len : RT_NULL;
+    }
+    nand_dev->spi.unlock(spi);
+
+    return result == RT_EOK ? ecc : result;
+}
+
+/*
+ * spi_nand_read_stream: read the main area of page_count consecutive pages
+ * into buf, buf should hold page_count * page_size bytes.
+ * Continuous Read or the cache read pipeline is used if the chip supports it,
+ * otherwise the pages are read one by one.
+ */
+rt_err_t spi_nand_read_stream(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint8_t *buf,
+                              rt_uint32_t page_count)
+{
+    rt_err_t result = RT_EOK;
+    rt_err_t ecc = RT_EOK;
+    rt_uint32_t i = 0, count = 0;
+    rt_uint16_t feature;
+
+    RT_ASSERT(device != RT_NULL);
+    RT_ASSERT(buf != RT_NULL);
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    if (page_count == 0)
+    {
+        return RT_EOK;
+    }
+
+    page = page + (device->block_start) * (device->pages_per_block);
+    if (page + page_count > (device->block_end) * device->pages_per_block)
+    {
+        LOG_E("failed to read stream, the page %d count %d is out of bound.", page, page_count);
+        return -RT_ERROR;
+    }
+
+    feature = nand_dev->chip_info.feature;
+#ifdef NAND_USING_SW_ECC
+    /* Continuous Read doesn't output the spare, the parity can't be checked */
+    if (nand_dev->ecc != RT_NULL)
+    {
+        feature &= ~NAND_FEATURE_CONT_READ;
+    }
+#endif
+#if RT_NAND_DMA_ALIGN > 1
+    /* the stream is too long to bounce, an unaligned buffer is read page by page */
+    if (nand_dev->dma_buf != RT_NULL && !NAND_DMA_ALIGNED(buf, 0))
+    {
+        feature &= ~NAND_FEATURE_CONT_READ;
+    }
+#endif
+
+    nand_dev->spi.lock(spi);
+
+    if (feature & (NAND_FEATURE_CONT_READ | NAND_FEATURE_CACHE_READ))
+    {
+        while (page_count > 0 && result == RT_EOK)
+        {
+            count = spi_nand_die_span(device, page, page_count);
+            if (feature & NAND_FEATURE_CONT_READ)
+            {
+                result = spi_nand_read_cont(device, page, buf, count);
+            }
+            else
+            {
+                result = spi_nand_read_cache_pipe(device, page, count, buf, device->page_size, RT_NULL, 0);
+            }
+            result = spi_nand_ecc_merge(&ecc, result);
+
+            page += count;
+            page_count -= count;
+            buf += count * device->page_size;
+        }
+    }
+    else
+    {
+        page = page - (device->block_start) * (device->pages_per_block);
+        for (i = 0; i < page_count && result == RT_EOK; i++)
+        {
+            result = spi_nand_ecc_merge(&ecc, _read_page(device, page + i, buf + i * device->page_size,
+                                        device->page_size, RT_NULL, 0));
+        }
+    }
+
+    nand_dev->spi.unlock(spi);
+
+    return result == RT_EOK ? ecc : result;
+}
+
+static rt_err_t spi_nand_write_enable(struct rt_mtd_nand_device *device)
+{
+    rt_uint8_t cmd_data = NAND_WRITE_ENABLE;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    return nand_dev->spi.wr(spi, &cmd_data, 1, 0, 0);
+}
+
+static rt_err_t spi_nand_write_disable(struct rt_mtd_nand_device *device)
+{
+    rt_uint8_t cmd_data = NAND_WRITE_DISABLE;//0x04
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    nand_dev->spi.wr(spi, &cmd_data, 1, 0, 0);
+    return RT_EOK;
+}
+
+/*
+ * spi_nand_xfer_add: append a send segment to the command chain of max
+ * segments, cs_change ends the command with it.
+ */
+static void spi_nand_xfer_add(nand_spi_xfer *xfer, rt_size_t max, rt_size_t *count, const rt_uint8_t *buf,
+                              rt_size_t len, rt_bool_t cs_change)
+{
+    RT_ASSERT(*count < max);
+
+    xfer[*count].send_buf = buf;
+    xfer[*count].recv_buf = RT_NULL;
+    xfer[*count].length = len;
+    xfer[*count].cs_change = cs_change;
+    (*count)++;
+}
+
+/*
+ * spi_nand_enable_cmd: Write Enable and the command in one chained transfer,
+ * one after the other if the bus can't chain them.
+ */
+static rt_err_t spi_nand_enable_cmd(struct rt_mtd_nand_device *device, const rt_uint8_t *cmd_data, rt_size_t len)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint8_t enable_data = NAND_WRITE_ENABLE;
+    nand_spi_xfer xfer[2];
+    rt_size_t count = 0;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    spi_nand_xfer_add(xfer, sizeof(xfer) / sizeof(xfer[0]), &count, &enable_data, 1, RT_TRUE);
+    spi_nand_xfer_add(xfer, sizeof(xfer) / sizeof(xfer[0]), &count, cmd_data, len, RT_FALSE);
+
+    result = nand_dev->spi.xfer(spi, xfer, count);
+    if (result == -RT_ENOSYS)
+    {
+        spi_nand_write_enable(device);
+        result = nand_dev->spi.wr(spi, cmd_data, len, 0, 0);
+    }
+
+    return result;
+}
+
+/*
+ * spi_nand_program_load: load data into the chip cache, starting at column_addr.
+ * random: RT_FALSE, Program Load, the rest of the cache is reset to 0xFF.
+ *         RT_TRUE,  Random Program Load, the rest of the cache is kept.
+ * Quad Program Load is used when the QSPI bus and the chip QE bit allow it.
+ */
+static rt_err_t spi_nand_program_load(struct rt_mtd_nand_device *device,
+                                      rt_bool_t random,
+                                      rt_uint16_t column_addr,
+                                      const rt_uint8_t *buf,
+                                      rt_uint32_t len)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint8_t cmd_data[3];
+    nand_spi_xfer xfer[2];
+    rt_size_t count = 0;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+#if RT_NAND_DMA_ALIGN > 1
+    const rt_uint8_t *tx_buf = spi_nand_dma_buf(nand_dev, buf, len, column_addr);
+
+    if (tx_buf != buf)
+    {
+        rt_memcpy((rt_uint8_t *)tx_buf, buf, len);
+        buf = tx_buf;
+    }
+#endif
+
+#ifdef NAND_USING_QSPI
+    if (nand_dev->quad_load)
+    {
+        /* 0x32/0x34 cl_addr[16bit] write_buff[x4] */
+        nand_qspi_cmd_format load_format =
+        {
+            .instruction = random ? NAND_QUAD_RANDOM_WRITE : NAND_QUAD_WRITE,
+            .instruction_lines = 1,
+            .address_size = 16,
+            .address_lines = 1,
+            .alternate_bytes_lines = 0,
+            .dummy_cycles = 0,
+            .data_lines = 4,
+        };
+
+        /* only CA[11:0] is effective */
+        return nand_dev->spi.qspi_wr(&nand_dev->spi, column_addr & 0x0fff, &load_format,
+                                     (rt_uint8_t *)buf, len, RT_NULL, 0);
+    }
+#endif
+
+    /* 0x02/0x84 cl_addr[16bit] write_buff */
+    cmd_data[0] = random ? NAND_RANDOM_WRITE : NAND_WRITE;
+    cmd_data[1] = (column_addr >> 8) & 0x0f; /* only CA[11:0] is effective */
+    cmd_data[2] = column_addr & 0xff;
+
+    spi_nand_xfer_add(xfer, sizeof(xfer) / sizeof(xfer[0]), &count, cmd_data, sizeof(cmd_data), RT_FALSE);
+    spi_nand_xfer_add(xfer, sizeof(xfer) / sizeof(xfer[0]), &count, buf, len, RT_FALSE);
+
+    result = nand_dev->spi.xfer(&nand_dev->spi, xfer, count);
+    if (result == -RT_ENOSYS)
+    {
+        /* the QSPI controller can't chain segments */
+        result = rt_spi_send_then_send(rtt_dev->rt_spi_device, cmd_data, sizeof(cmd_data), buf, len);
+    }
+
+    return result;
+}
+
+/*
+ * spi_nand_program_spare: on software ECC, the spare to program holds the
+ * parity of the data sectors at its end, it is built in the ECC spare
+ * buffer and replaces the caller spare.
+ */
+static void spi_nand_program_spare(struct rt_mtd_nand_device *device,
+                                   const rt_uint8_t *data, rt_uint32_t data_len,
+                                   const rt_uint8_t **spare, rt_uint32_t *spare_len)
+{
+#ifdef NAND_USING_SW_ECC
+    nand_flash_t nand_dev = (nand_flash_t)rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device)->user_data;
+
+    if (nand_dev->ecc != RT_NULL && data != RT_NULL && data_len != 0)
+    {
+        rt_memset(nand_dev->ecc->oob_buf, 0xff, device->oob_size);
+        if (*spare != RT_NULL && *spare_len != 0)
+        {
+            rt_memcpy(nand_dev->ecc->oob_buf, *spare, *spare_len);
+        }
+        nand_ecc_page_encode(device, data, data_len, nand_dev->ecc->oob_buf);
+        *spare = nand_dev->ecc->oob_buf;
+        *spare_len = device->oob_size;
+    }
+#endif
+}
+
+/*
+ * spi_nand_program_page_load: load data and spare of one page into the chip
+ * cache, Program Load data at column 0, Random Program Load spare at column
+ * the page size, so they share one Program Execute. keep loads the first
+ * part by Random Program Load, the page in the cache is patched.
+ */
+static rt_err_t spi_nand_program_page_load(struct rt_mtd_nand_device *device, rt_bool_t keep,
+                                           const rt_uint8_t *data, rt_uint32_t data_len,
+                                           const rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+
+    if (data != RT_NULL && data_len != 0)   /* load data */
+    {
+        result = spi_nand_program_load(device, keep, 0, data, data_len);
+        if (result != RT_EOK)
+        {
+            return result;
+        }
+        keep = RT_TRUE;
+    }
+
+    if (spare != RT_NULL && spare_len != 0)   /* load spare */
+    {
+        /* keep the page data already loaded in cache */
+        result = spi_nand_program_load(device, keep, device->page_size, spare, spare_len);
+    }
+
+    return result;
+}
+
+/*
+ * spi_nand_program_execute: program the chip cache to the array page,
+ * page is the page in the active die, @see spi_nand_die_enter. enable sends
+ * the Write Enable with it.
+ */
+static rt_err_t spi_nand_program_execute(struct rt_mtd_nand_device *device, rt_off_t page, rt_bool_t enable)
+{
+    rt_uint8_t execute_data[4];
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    /* Progrom Excute: 0x10 dummy[8bit] page_addr[16bit] */
+    execute_data[0] = NAND_WRITE_EXECUTE;
+    execute_data[1] = DUMMY_CMD;
+    execute_data[2] = (page >> 8) & 0xff;
+    execute_data[3] = page & 0xff;
+
+    if (enable)
+    {
+        return spi_nand_enable_cmd(device, execute_data, sizeof(execute_data));
+    }
+
+    return nand_dev->spi.wr(spi, execute_data, sizeof(execute_data), 0, 0);
+}
+
+/*
+ * spi_nand_program_chain: Write Enable, the Program Loads and Program
+ * Execute of one page in one chained transfer, the chip select is released
+ * between the commands. The data and spare of a whole page are contiguous
+ * in the cache, they go in one Program Load. Returns -RT_ENOSYS if the bus
+ * can't chain commands or Quad Program Load is used.
+ */
+static rt_err_t spi_nand_program_chain(struct rt_mtd_nand_device *device, rt_off_t page, rt_bool_t keep,
+                                       const rt_uint8_t *data, rt_uint32_t data_len,
+                                       const rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    rt_uint8_t enable_data = NAND_WRITE_ENABLE;
+    rt_uint8_t load_data[3], spare_load_data[3], execute_data[4];
+    nand_spi_xfer xfer[6];
+    rt_size_t count = 0;
+    rt_uint16_t column_addr = 0;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+#ifdef NAND_USING_QSPI
+    if (nand_dev->quad_load)
+    {
+        return -RT_ENOSYS;
+    }
+#endif
+
+    if (data == RT_NULL || data_len == 0)
+    {
+        data = RT_NULL;
+        data_len = 0;
+        column_addr = device->page_size;
+    }
+    if (spare == RT_NULL || spare_len == 0)
+    {
+        spare = RT_NULL;
+        spare_len = 0;
+    }
+
+#if RT_NAND_DMA_ALIGN > 1
+    {
+        const rt_uint8_t *tx_data = spi_nand_dma_buf(nand_dev, data, data_len, 0);
+        const rt_uint8_t *tx_spare = spi_nand_dma_buf(nand_dev, spare, spare_len, device->page_size);
+
+        if (tx_data != data)
+        {
+            data = rt_memcpy((rt_uint8_t *)tx_data, data, data_len);
+        }
+        if (tx_spare != spare)
+        {
+            spare = rt_memcpy((rt_uint8_t *)tx_spare, spare, spare_len);
+        }
+    }
+#endif
+
+    spi_nand_xfer_add(xfer, sizeof(xfer) / sizeof(xfer[0]), &count, &enable_data, 1, RT_TRUE);
+
+    if (data != RT_NULL || spare != RT_NULL)
+    {
+        /* 0x02/0x84 cl_addr[16bit]: data at column 0, or the spare alone */
+        load_data[0] = keep ? NAND_RANDOM_WRITE : NAND_WRITE;
+        load_data[1] = (column_addr >> 8) & 0x0f;
+        load_data[2] = column_addr & 0xff;
+        spi_nand_xfer_add(xfer, sizeof(xfer) / sizeof(xfer[0]), &count, load_data, sizeof(load_data), RT_FALSE);
+        if (data != RT_NULL)
+        {
+            spi_nand_xfer_add(xfer, sizeof(xfer) / sizeof(xfer[0]), &count, data, data_len, RT_FALSE);
+        }
+        if (data != RT_NULL && spare != RT_NULL && data_len != device->page_size)
+        {
+            /* 0x84: the spare column, the data loaded is kept */
+            xfer[count - 1].cs_change = RT_TRUE;
+            spare_load_data[0] = NAND_RANDOM_WRITE;
+            spare_load_data[1] = (device->page_size >> 8) & 0x0f;
+            spare_load_data[2] = device->page_size & 0xff;
+            spi_nand_xfer_add(xfer, sizeof(xfer) / sizeof(xfer[0]), &count, spare_load_data,
+                              sizeof(spare_load_data), RT_FALSE);
+        }
+        if (spare != RT_NULL)
+        {
+            spi_nand_xfer_add(xfer, sizeof(xfer) / sizeof(xfer[0]), &count, spare, spare_len, RT_FALSE);
+        }
+        xfer[count - 1].cs_change = RT_TRUE;
+    }
+
+    /* 0x10 dummy[8bit] page_addr[16bit] */
+    execute_data[0] = NAND_WRITE_EXECUTE;
+    execute_data[1] = DUMMY_CMD;
+    execute_data[2] = (page >> 8) & 0xff;
+    execute_data[3] = page & 0xff;
+    spi_nand_xfer_add(xfer, sizeof(xfer) / sizeof(xfer[0]), &count, execute_data, sizeof(execute_data), RT_FALSE);
+
+    return nand_dev->spi.xfer(spi, xfer, count);
+}
+
+/*
+ * spi_nand_program_page: write enable, load and program one page of the
+ * active die, in one bus transfer when the bus can chain the commands.
+ * keep patches the page already in the cache, @see spi_nand_program_page_load.
+ */
+static rt_err_t spi_nand_program_page(struct rt_mtd_nand_device *device, rt_off_t page, rt_bool_t keep,
+                                      const rt_uint8_t *data, rt_uint32_t data_len,
+                                      const rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+
+    spi_nand_program_spare(device, data, data_len, &spare, &spare_len);
+
+    result = spi_nand_program_chain(device, page, keep, data, data_len, spare, spare_len);
+    if (result != -RT_ENOSYS)
+    {
+        return result;
+    }
+
+    /* one command at a time */
+    result = spi_nand_write_enable(device);
+    if (result == RT_EOK)
+    {
+        result = spi_nand_program_page_load(device, keep, data, data_len, spare, spare_len);
+    }
+    if (result == RT_EOK)
+    {
+        result = spi_nand_program_execute(device, page, RT_FALSE);
+    }
+
+    return result;
+}
+
+/*
+ * spi_nand_program_cmd: start programming data and spare of the chip page in
+ * one program cycle, the busy wait is up to the caller. The array should be
+ * unprotected.
+ */
+static rt_err_t spi_nand_program_cmd(struct rt_mtd_nand_device *device, rt_off_t page,
+                                     const rt_uint8_t *data, rt_uint32_t data_len,
+                                     const rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    spi_nand_blank_mark(device, page / device->pages_per_block, RT_FALSE);
+    page = spi_nand_die_enter(device, page);
+
+    return spi_nand_program_page(device, page, RT_FALSE, data, data_len, spare, spare_len);
+}
+
+rt_err_t _write_page(struct rt_mtd_nand_device *device,
+                     rt_off_t page,
+                     const rt_uint8_t *data, rt_uint32_t data_len,
+                     const rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+
+    RT_ASSERT(data_len <= device->page_size);
+    RT_ASSERT(spare_len <= device->oob_size);
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    page = page + device->block_start * device->pages_per_block;
+    if (page >= (device->block_end) * device->pages_per_block)
+    {
+        return -RT_ERROR;
+    }
+
+    if ((data == RT_NULL || data_len == 0) && (spare == RT_NULL || spare_len == 0))
+    {
+        return RT_EOK;
+    }
+
+    NAND_STAT_TIME(lock_start);
+    nand_dev->spi.lock(spi);
+    NAND_STAT_BEGIN(device, NAND_STAT_WRITE, lock_start);
+
+    spi_nand_unprotect_session_begin(device);
+
+    result = spi_nand_program_cmd(device, page, data, data_len, spare, spare_len);
+    if (result == RT_EOK)
+    {
+        /* wait busy */
+        result = spi_nand_wait_busy(device, NAND_OP_PROG);
+    }
+    spi_nand_write_disable(device);
+    spi_nand_unprotect_session_end(device);
+
+    NAND_STAT_END(device);
+    nand_dev->spi.unlock(spi);
+
+    return result;
+}
+
+/*
+ * spi_nand_write_pages: program page_count consecutive pages of one block,
+ * data holds page_count * data_len bytes and spare holds page_count *
+ * spare_len bytes. The array is unlocked once for the whole batch, the
+ * batch stops at the first page that fails.
+ */
+rt_err_t spi_nand_write_pages(struct rt_mtd_nand_device *device,
+                              rt_off_t page,
+                              rt_uint32_t page_count,
+                              const rt_uint8_t *data, rt_uint32_t data_len,
+                              const rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint32_t i = 0;
+    rt_off_t chip_page;
+    const rt_uint8_t *page_data, *page_spare;
+
+    RT_ASSERT(device != RT_NULL);
+    RT_ASSERT(data_len <= device->page_size);
+    RT_ASSERT(spare_len <= device->oob_size);
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    if (page_count == 0)
+    {
+        return RT_EOK;
+    }
+
+    chip_page = page + device->block_start * device->pages_per_block;
+    if ((chip_page + page_count > (device->block_end) * device->pages_per_block)
+            || (page / device->pages_per_block != (page + page_count - 1) / device->pages_per_block))
+    {
+        LOG_E("failed to write pages, the page %d count %d is out of one block.", page, page_count);
+        return -RT_ERROR;
+    }
+
+    nand_dev->spi.lock(spi);
+    spi_nand_unprotect_session_begin(device);
+
+    spi_nand_blank_mark(device, chip_page / device->pages_per_block, RT_FALSE);
+    /* the pages of one block are in one die */
+    chip_page = spi_nand_die_enter(device, chip_page);
+
+    for (i = 0; i < page_count && result == RT_EOK; i++)
+    {
+        page_data = data ? data + i * data_len : RT_NULL;
+        page_spare = spare ? spare + i * spare_len : RT_NULL;
+
+        result = spi_nand_program_page(device, chip_page + i, RT_FALSE, page_data, data_len, page_spare, spare_len);
+        if (result == RT_EOK)
+        {
+            result = spi_nand_wait_busy(device, NAND_OP_PROG);
+        }
+    }
+    if (result != RT_EOK)
+    {
+        LOG_E("failed to write pages, page %d err %d.", page + i - 1, result);
+    }
+
+    spi_nand_write_disable(device);
+    spi_nand_unprotect_session_end(device);
+#ifdef NAND_USING_PAGE_CACHE
+    nand_cache_invalidate(device, page, page_count);
+#endif
+    nand_dev->spi.unlock(spi);
+
+    return result;
+}
+
+/*
+ * spi_nand_erase_cmd: start erasing the chip block, the busy wait is up to
+ * the caller. The array should be unprotected.
+ */
+static rt_err_t spi_nand_erase_cmd(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    rt_uint8_t erase_cmd[4];
+    int res = RT_EOK;
+    rt_off_t page_addr = 0;
+
+    /* blank again once the erase is known to be done */
+    spi_nand_blank_mark(device, block, RT_FALSE);
+    page_addr = spi_nand_die_enter(device, block * (device->pages_per_block));
+
+    /* write enable, block erase: 0xd8 dummy[8bit] page_addr[16bit] */
+    erase_cmd[0] = NAND_BLOCK_ERASE;
+    erase_cmd[1] = DUMMY_CMD;
+    erase_cmd[2] = (page_addr >> 8) & 0xff;
+    erase_cmd[3] = page_addr & 0xff;
+
+    res = spi_nand_enable_cmd(device, erase_cmd, sizeof(erase_cmd));
+    if (res != 0)
+    {
+        LOG_E("erase block err. err num %x.", res);
+        res = -RT_ERROR;
+    }
+
+    return res;
+}
+
+rt_err_t _erase_block(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    int res = RT_EOK;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    if (block + device->block_start >= device->block_end)
+    {
+        LOG_E("failed to erase block, the block %d is out of bound.", block);
+        return -RT_ERROR;
+    }
+
+    NAND_STAT_TIME(lock_start);
+    nand_dev->spi.lock(spi);
+    NAND_STAT_BEGIN(device, NAND_STAT_ERASE, lock_start);
+
+    spi_nand_unprotect_session_begin(device);
+
+    res = spi_nand_erase_cmd(device, block + device->block_start);
+    if (res == RT_EOK)
+    {
+        /* wait busy */
+        res = spi_nand_wait_busy(device, NAND_OP_ERASE);
+    }
+    if (res == RT_EOK)
+    {
+        spi_nand_blank_mark(device, block + device->block_start, RT_TRUE);
+    }
+    /* write disable */
+    spi_nand_write_disable(device);
+    spi_nand_unprotect_session_end(device);
+
+    NAND_STAT_END(device);
+    nand_dev->spi.unlock(spi);
+
+    return res;
+}
+
+/*
+ * spi_nand_program_start: start programming the page and return without
+ * waiting, the die stays busy until it is accessed again or
+ * spi_nand_die_finish collects the result. The caller should hold an
+ * unprotected session, @see spi_nand_unprotect_session_begin.
+ */
+rt_err_t spi_nand_program_start(struct rt_mtd_nand_device *device, rt_off_t page,
+                                const rt_uint8_t *data, rt_uint32_t data_len,
+                                const rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+    rt_off_t chip_page;
+
+    RT_ASSERT(data_len <= device->page_size);
+    RT_ASSERT(spare_len <= device->oob_size);
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    RT_ASSERT(nand_dev->unprotect_count > 0);
+
+    chip_page = page + device->block_start * device->pages_per_block;
+    if (chip_page >= device->block_end * device->pages_per_block)
+    {
+        return -RT_ERROR;
+    }
+
+    nand_dev->spi.lock(spi);
+    result = spi_nand_program_cmd(device, chip_page, data, data_len, spare, spare_len);
+    if (result == RT_EOK)
+    {
+        nand_dev->die_busy |= 1 << nand_dev->die_sel;
+        nand_dev->die_op[nand_dev->die_sel] = NAND_OP_PROG;
+    }
+#ifdef NAND_USING_PAGE_CACHE
+    nand_cache_invalidate(device, page, 1);
+#endif
+    nand_dev->spi.unlock(spi);
+
+    return result;
+}
+
+/*
+ * spi_nand_erase_start: start erasing the block and return without waiting,
+ * @see spi_nand_program_start.
+ */
+rt_err_t spi_nand_erase_start(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    rt_err_t result = RT_EOK;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    RT_ASSERT(nand_dev->unprotect_count > 0);
+
+    if (block + device->block_start >= device->block_end)
+    {
+        return -RT_ERROR;
+    }
+
+    nand_dev->spi.lock(spi);
+    result = spi_nand_erase_cmd(device, block + device->block_start);
+    if (result == RT_EOK)
+    {
+        nand_dev->die_busy |= 1 << nand_dev->die_sel;
+        nand_dev->die_op[nand_dev->die_sel] = NAND_OP_ERASE;
+        nand_dev->die_block[nand_dev->die_sel] = block + device->block_start;
+    }
+#ifdef NAND_USING_PAGE_CACHE
+    nand_cache_invalidate(device, block * device->pages_per_block, device->pages_per_block);
+#endif
+    nand_dev->spi.unlock(spi);
+
+    return result;
+}
+
+/*
+ * spi_nand_erase_blocks: erase block_count consecutive blocks, on a
+ * multi-die chip the erase of the next block starts on the other die while
+ * the current one is still busy.
+ */
+rt_err_t spi_nand_erase_blocks(struct rt_mtd_nand_device *device, rt_uint32_t block, rt_uint32_t block_count)
+{
+    rt_err_t result = RT_EOK, die_result;
+    rt_uint32_t i = 0;
+    rt_uint8_t die = 0;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    if (nand_dev->chip_info.die_num <= 1)
+    {
+        for (i = 0; i < block_count; i++)
+        {
+            die_result = device->ops->erase_block(device, block + i);
+            if (die_result != RT_EOK && result == RT_EOK)
+            {
+                result = die_result;
+            }
+        }
+        return result;
+    }
+
+    nand_dev->spi.lock(spi);
+    spi_nand_unprotect_session_begin(device);
+
+    for (i = 0; i < block_count; i++)
+    {
+        /* the previous erase of this die is waited when it is selected */
+        die_result = spi_nand_erase_start(device, block + i);
+        if (die_result != RT_EOK && result == RT_EOK)
+        {
+            result = die_result;
+        }
     }
 
-    rt_hw_us_delay(900);
+    for (die = 0; die < nand_dev->chip_info.die_num; die++)
+    {
+        die_result = spi_nand_die_finish(device, die);
+        if (die_result != RT_EOK && result == RT_EOK)
+        {
+            result = die_result;
+        }
+    }
 
-    return 0;
+    spi_nand_write_disable(device);
+    spi_nand_unprotect_session_end(device);
+    nand_dev->spi.unlock(spi);
+
+    return result;
 }
 
-rt_err_t _erase_block(struct rt_mtd_nand_device *device, rt_uint32_t block)
+/*
+ * spi_nand_move_page_by_host: copy the page through the host RAM, used when
+ * the chip can't move the page internally.
+ */
+static rt_err_t spi_nand_move_page_by_host(struct rt_mtd_nand_device *device, rt_off_t src_page, rt_off_t dst_page,
+                                           const rt_uint8_t *spare, rt_uint32_t spare_len)
 {
-    rt_uint8_t erase_cmd[4];
-    int res = RT_EOK;
-    rt_uint16_t page_addr = 0;
+    rt_err_t result = RT_EOK;
+    rt_uint8_t *page_buf = RT_NULL;
+
+    page_buf = (rt_uint8_t *)rt_malloc(device->page_size + device->oob_size);
+    if (page_buf == RT_NULL)
+    {
+        return -RT_ENOMEM;
+    }
+
+    result = _read_page(device, src_page, page_buf, device->page_size,
+                        page_buf + device->page_size, device->oob_size);
+    if (result == RT_EOK || result == -RT_MTD_EECC_CORRECT)
+    {
+        if (spare != RT_NULL && spare_len != 0)
+        {
+            rt_memcpy(page_buf + device->page_size, spare, spare_len);
+        }
+        result = _write_page(device, dst_page, page_buf, device->page_size,
+                             page_buf + device->page_size, device->oob_size);
+    }
+
+    rt_free(page_buf);
+#ifdef NAND_USING_PAGE_CACHE
+    nand_cache_invalidate(device, dst_page, 1);
+#endif
+
+    return result;
+}
+
+/*
+ * spi_nand_copyback: move src_page to dst_page inside the chip (internal data
+ * move), Page Data Read the source to the chip cache, patch the spare by
+ * Random Program Load if spare is given, then Program Execute to the
+ * destination. The page data doesn't go through the bus.
+ * The source and the destination must be in the same plane, or the page is
+ * copied through the host RAM.
+ */
+rt_err_t spi_nand_copyback(struct rt_mtd_nand_device *device, rt_off_t src_page, rt_off_t dst_page,
+                           const rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+    rt_off_t src, dst;
+
+    RT_ASSERT(device != RT_NULL);
+    RT_ASSERT(spare_len <= device->oob_size);
 
     struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
     nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
     const nand_spi *spi = &nand_dev->spi;
 
-    /* write enable */
-    spi_nand_set_feature(device, NAND_PROTECT_DISABLE);
+    src = src_page + device->block_start * device->pages_per_block;
+    dst = dst_page + device->block_start * device->pages_per_block;
+    if (src >= device->block_end * device->pages_per_block || dst >= device->block_end * device->pages_per_block)
+    {
+        LOG_E("failed to move page, the page %d -> %d is out of bound.", src_page, dst_page);
+        return -RT_ERROR;
+    }
 
-    spi_nand_write_enable(device);
-    rt_hw_us_delay(200);
+    /* the chip cache is per plane and per die, cross plane move goes through the host */
+    if (!(nand_dev->chip_info.feature & NAND_FEATURE_COPYBACK)
+#ifdef NAND_USING_SW_ECC
+            /* the page is corrected by the host */
+            || nand_dev->ecc != RT_NULL
+#endif
+            || (src / device->pages_per_block) % device->plane_num != (dst / device->pages_per_block) % device->plane_num
+            || spi_nand_die_of_page(device, src_page) != spi_nand_die_of_page(device, dst_page))
+    {
+        return spi_nand_move_page_by_host(device, src_page, dst_page, spare, spare_len);
+    }
 
-    /* block erase: 0xd8 dummy[8bit] page_addr[16bit] */
-    block = block + device->block_start;
-    page_addr = block * (device->pages_per_block);
+    nand_dev->spi.lock(spi);
 
-    erase_cmd[0] = NAND_BLOCK_ERASE;
-    erase_cmd[1] = DUMMY_CMD;
-    erase_cmd[2] = (page_addr >> 8) & 0xff;
-    erase_cmd[3] = page_addr & 0xff;
+    /* BUF=0 doesn't keep the page in the cache, same as the page read */
+    if ((nand_dev->chip_info.feature & NAND_FEATURE_CONT_READ) && !(nand_dev->sr2 & NAND_SR2_BUF_BIT_MASK))
+    {
+        spi_nand_set_feature(device, NAND_BUF_ENABLE);
+    }
 
-    res = nand_dev->spi.wr(spi, erase_cmd, sizeof(erase_cmd), 0, 0);
-    if (res != 0)
+    /* the chip corrects the page in the cache, an uncorrectable page is not copied */
+    result = spi_nand_page_to_cache(device, src);
+    if (result == -RT_MTD_EECC_CORRECT)
     {
-        LOG_E("erase block err. err num %x.", res);
-        return -RT_ERROR;
+        result = RT_EOK;
+    }
+    if (result != RT_EOK)
+    {
+        goto __exit;
+    }
+
+    spi_nand_unprotect_session_begin(device);
+    spi_nand_blank_mark(device, dst / device->pages_per_block, RT_FALSE);
+    dst = spi_nand_die_enter(device, dst);
+
+    /* keep the page data in cache, only patch the spare */
+    result = spi_nand_program_page(device, dst, RT_TRUE, RT_NULL, 0, spare, spare_len);
+    if (result == RT_EOK)
+    {
+        result = spi_nand_wait_busy(device, NAND_OP_PROG);
     }
 
-    /* wait busy */
-    spi_nand_wait_busy(device);
-    /* write disable */
     spi_nand_write_disable(device);
-    spi_nand_set_feature(device, NAND_PROTECT_ENABLE);
+    spi_nand_unprotect_session_end(device);
 
-    return RT_EOK;
+__exit:
+    nand_dev->spi.unlock(spi);
+
+#ifdef NAND_USING_PAGE_CACHE
+    nand_cache_invalidate(device, dst_page, 1);
+#endif
+
+    return result;
 }
 
 rt_err_t _move_page(struct rt_mtd_nand_device *device, rt_off_t src_page, rt_off_t dst_page)
 {
-    return RT_EOK;
+    return spi_nand_copyback(device, src_page, dst_page, RT_NULL, 0);
+}
+
+/*
+ * spi_nand_check_bad_marker: the bad block marker is the first spare byte
+ * of the first two pages of the block, a good block keeps 0xff in both.
+ */
+rt_bool_t spi_nand_check_bad_marker(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint8_t marker = 0;
+    rt_uint32_t i = 0;
+
+    for (i = 0; i < 2; i++)
+    {
+        result = _read_page(device, block * device->pages_per_block + i, RT_NULL, 0, &marker, 1);
+        if ((result != RT_EOK && result != -RT_MTD_EECC_CORRECT) || marker != 0xff)
+        {
+            return RT_TRUE;
+        }
+    }
+
+    return RT_FALSE;
+}
+
+/*
+ * spi_nand_write_bad_marker: write the bad block marker, the block is not
+ * erased first, it may fail on a worn block.
+ */
+rt_err_t spi_nand_write_bad_marker(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint8_t marker = 0x00;
+    rt_off_t page = block * device->pages_per_block;
+
+    result = _write_page(device, page, RT_NULL, 0, &marker, 1);
+#ifdef NAND_USING_PAGE_CACHE
+    nand_cache_invalidate(device, page, 1);
+#endif
+
+    return result;
 }
 
 rt_err_t _check_block(struct rt_mtd_nand_device *device, rt_uint32_t block)
 {
-    return RT_EOK;
+#ifdef NAND_USING_BBT
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    if (nand_dev->bbt != RT_NULL)
+    {
+        return nand_bbt_check_block(device, block);
+    }
+#endif
+
+    return spi_nand_check_bad_marker(device, block) ? -RT_ERROR : RT_EOK;
 }
 
 rt_err_t _mark_badblock(struct rt_mtd_nand_device *device, rt_uint32_t block)
 {
-    return RT_EOK;
+    rt_err_t result = RT_EOK;
+#ifdef NAND_USING_BBT
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+#endif
+
+    result = spi_nand_write_bad_marker(device, block);
+
+#ifdef NAND_USING_BBT
+    /* the table still knows the block if the marker write failed */
+    if (nand_dev->bbt != RT_NULL)
+    {
+        result = nand_bbt_mark_block(device, block);
+    }
+#endif
+
+    return result;
 }
 
-int spi_erase_all_nand(struct rt_mtd_nand_device *device)
+/*
+ * spi_nand_erase_run: erase a run of consecutive good blocks, the blocks of
+ * a failed run are erased again one by one and the failing ones are marked bad.
+ */
+static rt_uint32_t spi_nand_erase_run(struct rt_mtd_nand_device *device, rt_uint32_t block, rt_uint32_t block_count)
 {
-    int i = 0;
+    rt_uint32_t i = 0;
+    rt_uint32_t bad = 0;
+
+    if (spi_nand_erase_blocks(device, block, block_count) == RT_EOK)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < block_count; i++)
+    {
+        if (device->ops->erase_block(device, block + i) != RT_EOK)
+        {
+            LOG_W("erase block %d failed, mark it bad.", block + i);
+            device->ops->mark_badblock(device, block + i);
+            bad++;
+        }
+    }
+
+    return bad;
+}
+
+/**
+ * spi_nand_erase_all: erase all the good blocks of the device. The blocks
+ * known blank are skipped, and so are the bad blocks and the blocks reserved
+ * for the bad block table. The erases of consecutive blocks are overlapped on
+ * multi-die chips.
+ *
+ * @param device the nand device
+ * @param progress called after each run of blocks with the blocks done and the
+ *        total, RT_NULL if not needed
+ * @param parameter the progress callback parameter
+ *
+ * @return RT_EOK, or -RT_ERROR if some blocks failed and were marked bad
+ */
+rt_err_t spi_nand_erase_all(struct rt_mtd_nand_device *device, nand_erase_progress_t progress, void *parameter)
+{
+    rt_uint32_t block_num = device->block_end - device->block_start;
+    rt_uint32_t block = 0, run = 0;
+    rt_uint32_t skip = 0, bad = 0;
+    rt_bool_t erase;
+
+    for (block = 0; block < block_num; block++)
+    {
+        erase = !spi_nand_block_is_blank(device, block) && device->ops->check_block(device, block) == RT_EOK;
+        if (erase)
+        {
+            run++;
+        }
+        else
+        {
+            skip++;
+        }
+
+        /* flush the run at a skipped block, at the end, or when it is long enough */
+        if (run > 0 && (!erase || block == block_num - 1 || run == RT_NAND_ERASE_RUN_BLOCKS))
+        {
+            bad += spi_nand_erase_run(device, block + 1 - run - (erase ? 0 : 1), run);
+            run = 0;
+            if (progress && block < block_num - 1)
+            {
+                progress(device, block + 1, block_num, parameter);
+            }
+        }
+    }
 
-    for (i = 0; i < NAND_BLOCK_NUM; i++) //1024 blocks
+    if (progress)
     {
-        _erase_block(device, i * 64);
+        progress(device, block_num, block_num, parameter);
     }
-    return 0;
+
+    LOG_I("erased %d blocks, %d skipped, %d failed.", block_num - skip - bad, skip, bad);
+
+    return bad ? -RT_ERROR : RT_EOK;
+}
+
+int spi_erase_all_nand(struct rt_mtd_nand_device *device)
+{
+    return spi_nand_erase_all(device, RT_NULL, RT_NULL);
 }
 void spi_nand_reset(struct rt_mtd_nand_device *device)
 {
@@ -537,29 +2316,147 @@ void spi_nand_reset(struct rt_mtd_nand_device *device)
     const nand_spi *spi = &nand_dev->spi;
 
     rt_uint8_t cmd_data = NAND_RESET;
+    rt_uint8_t die = 0;
 
-    nand_dev->spi.wr(spi, &cmd_data, 1, 0, 0);
+    nand_dev->spi.lock(spi);
+
+    /* reset only affects the active die, select and reset each die in turn */
+    for (die = 0; die < nand_dev->chip_info.die_num; die++)
+    {
+        spi_nand_die_select(device, die);
+        nand_dev->spi.wr(spi, &cmd_data, 1, 0, 0);
+        spi_nand_wait_busy(device, NAND_OP_RESET);
+    }
+
+    /* the registers are back to the power-on state */
+    spi_nand_sync_feature(device);
+    if (nand_dev->unprotect_count > 0)
+    {
+        spi_nand_set_feature(device, NAND_PROTECT_DISABLE);
+    }
+
+    nand_dev->spi.unlock(spi);
 }
 
 static const struct rt_mtd_nand_driver_ops nand_ops =
 {
     _read_id,
+#ifdef NAND_USING_PAGE_CACHE
+    nand_cache_read_page,
+    nand_cache_write_page,
+    _move_page,
+    nand_cache_erase_block,
+#else
     _read_page,
     _write_page,
-    0,
+    _move_page,
     _erase_block,
-    0,
-    0,
+#endif
+    _check_block,
+    _mark_badblock,
 };
 
+/*
+ * spi_nand_device_check: RT_TRUE if the MTD nand device is a nand_flash
+ * device of this driver, so it can be taken as a spi_nand_flash_mtd.
+ */
+rt_bool_t spi_nand_device_check(struct rt_mtd_nand_device *device)
+{
+    return (device != RT_NULL && device->ops == &nand_ops) ? RT_TRUE : RT_FALSE;
+}
+
+/*
+ * spi_nand_clock_limit: lower the SPI clock to the chip max clock, the
+ * configured clock is kept if it is slower, it is the board limit.
+ */
+static void spi_nand_clock_limit(struct rt_mtd_nand_device *device, rt_uint32_t max_hz)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    struct rt_spi_device *spi_dev = rtt_dev->rt_spi_device;
+    struct rt_spi_configuration spi_cfg;
+#ifdef NAND_USING_QSPI
+    struct rt_qspi_configuration qspi_cfg;
+#endif
+
+    if (max_hz == 0 || spi_dev == RT_NULL || spi_dev->config.max_hz <= max_hz)
+    {
+        return;
+    }
+
+    LOG_I("Nand flash SPI clock %d Hz is limited to %d Hz.", spi_dev->config.max_hz, max_hz);
+
+#ifdef NAND_USING_QSPI
+    if (spi_dev->bus->mode & RT_SPI_BUS_MODE_QSPI)
+    {
+        qspi_cfg = ((struct rt_qspi_device *)spi_dev)->config;
+        qspi_cfg.parent.max_hz = max_hz;
+        rt_qspi_configure((struct rt_qspi_device *)spi_dev, &qspi_cfg);
+        return;
+    }
+#endif
+
+    spi_cfg = spi_dev->config;
+    spi_cfg.max_hz = max_hz;
+    rt_spi_configure(spi_dev, &spi_cfg);
+}
+
+/*
+ * spi_nand_deinit: undo rt_hw_nand_init when the device can't be registered,
+ * nothing else knows the device yet, the threads are idle.
+ */
+static void spi_nand_deinit(struct rt_mtd_nand_device *device)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+#ifdef NAND_USING_REFRESH
+    nand_refresh_deinit(device);
+#endif
+#ifdef NAND_USING_ERASE_POOL
+    nand_erase_pool_deinit(device);
+#endif
+#ifdef NAND_USING_ASYNC
+    nand_async_deinit(device);
+#endif
+#ifdef NAND_USING_BBT
+    nand_bbt_deinit(device);
+#endif
+#ifdef NAND_USING_STAT
+    nand_stat_deinit(device);
+#endif
+#ifdef NAND_USING_SW_ECC
+    nand_ecc_delete(nand_dev->ecc);
+    nand_dev->ecc = RT_NULL;
+#endif
+#ifdef NAND_USING_PAGE_CACHE
+    nand_cache_deinit(device);
+#endif
+#if RT_NAND_DMA_ALIGN > 1
+    if (nand_dev->dma_buf != RT_NULL)
+    {
+        rt_free_align(nand_dev->dma_buf);
+        nand_dev->dma_buf = RT_NULL;
+    }
+#endif
+    rt_free(nand_dev->blank_map);
+    nand_dev->blank_map = RT_NULL;
+    device->ops = RT_NULL;
+}
+
 int rt_hw_nand_init(struct rt_mtd_nand_device *device)
 {
     rt_err_t result = RT_EOK;
-    rt_uint8_t i = 0;
 
     struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
     nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
 
+    /* don't start anything for a device that can't be registered */
+    if (rt_device_find(nand_dev->name) != RT_NULL)
+    {
+        LOG_E("Nand flash device %s already exists.", nand_dev->name);
+        return -RT_ERROR;
+    }
+
     /* get nand device id information */
     result = _read_id(device);
     if (result != RT_EOK)
@@ -567,47 +2464,57 @@ int rt_hw_nand_init(struct rt_mtd_nand_device *device)
         return -RT_ERROR;
     }
 
-    /* get nand device capacity and register information */
-    for (i = 0; i < sizeof(nand_flash_info_table) / sizeof(nand_flash_chip_info); i++)
+    LOG_I("Nand flash capacity is %d Gbit.", nand_dev->chip_info.capacity);
+
+    /* geometry from the chip descriptor */
+    device->page_size       = nand_dev->chip_info.page_size;
+    device->pages_per_block = nand_dev->chip_info.pages_per_block;
+    device->plane_num       = nand_dev->chip_info.plane_num;
+    device->oob_size        = nand_dev->chip_info.oob_size;
+    device->oob_free        = device->oob_size - (device->page_size * 3 / 256);
+    device->block_start     = 0;
+    device->block_end       = nand_dev->chip_info.blocks_per_die * nand_dev->chip_info.die_num;
+    device->block_total     = device->block_end;
+
+    /* nothing is known blank at boot */
+    nand_dev->blank_map = (rt_uint8_t *)rt_malloc((device->block_end + 7) / 8);
+    if (nand_dev->blank_map != RT_NULL)
     {
-        if (nand_dev->chip.name == nand_flash_info_table[i].name)
-        {
-            nand_dev->chip_info.name = nand_dev->chip.name;
-            nand_dev->chip_info.capacity = nand_flash_info_table[i].capacity;
-            nand_dev->chip_info.ecc_bit = nand_flash_info_table[i].ecc_bit;
-            nand_dev->chip_info.bp_bit = nand_flash_info_table[i].bp_bit;
-            nand_dev->chip_info.busy_bit = nand_flash_info_table[i].busy_bit;
-            nand_dev->chip_info.qe_bit = nand_flash_info_table[i].qe_bit;
-
-            LOG_I("Nand flash capacity is %d Gbit.", nand_dev->chip_info.capacity);
-            break;
-        }
+        rt_memset(nand_dev->blank_map, 0, (device->block_end + 7) / 8);
     }
 
-    if (nand_dev->chip_info.capacity == 1)
+#if RT_NAND_DMA_ALIGN > 1
+    /* the unaligned page data goes through it, room for data and spare at aligned offsets */
+    nand_dev->dma_buf = (rt_uint8_t *)rt_malloc_align(device->page_size + device->oob_size + RT_NAND_DMA_ALIGN,
+                                                      RT_NAND_DMA_ALIGN);
+    if (nand_dev->dma_buf == RT_NULL)
     {
-        device->page_size       = 2048;
-        device->pages_per_block = 64;
-        device->plane_num       = 1;
-        device->oob_size        = 64;
-        device->oob_free        = 64 - ((2048) * 3 / 256);
-        device->block_start     = 0;
-        device->block_end       = 1024;
-        device->block_total     = 1024;
+        LOG_W("Nand flash DMA bounce buffer alloc failed, unaligned buffers are transferred directly.");
     }
-    else
+#endif
+
+    spi_nand_clock_limit(device, nand_dev->chip_info.max_hz);
+
+#ifdef NAND_USING_QSPI
+    /* the read mode depends on the chip id, pick it before any read goes out */
+    if (NAND_BUS_IS_QSPI(rtt_dev))
     {
-        // TODO: add other capacity config
-        LOG_I("TODO: other capacity config.");
+        nand_qspi_fast_read_enable(nand_dev, ((struct rt_qspi_device *)rtt_dev->rt_spi_device)->config.qspi_dl_width);
     }
+#endif
 
-    device->ops = &nand_ops;
-    result = rt_mtd_nand_register_device(nand_dev->name, device);
-    if (result != RT_EOK)
+    /* read the protection and configuration registers into the shadows */
+    spi_nand_sync_feature(device);
+
+#ifdef NAND_USING_PAGE_CACHE
+    if (nand_cache_init(device) != RT_EOK)
     {
-        rt_device_unregister((rt_device_t)device);
-        return -RT_ERROR;
+        LOG_W("Nand flash page cache alloc failed, run without cache.");
     }
+#endif
+
+    /* the modules below go through the ops, the device is registered once they are all up */
+    device->ops = &nand_ops;
 
 #ifdef NAND_USING_HW_ECC
     //spi_nand_ecc_enable(device);
@@ -617,8 +2524,70 @@ int rt_hw_nand_init(struct rt_mtd_nand_device *device)
     spi_nand_set_feature(device, NAND_ECC_DISABLE);
 #endif
 
+#ifdef NAND_USING_SW_ECC
+    if (nand_ecc_init(device) != RT_EOK)
+    {
+        LOG_W("Nand flash software ECC init failed, run without ECC.");
+    }
+#endif
+
     spi_nand_set_feature(device, NAND_BUF_ENABLE);
 
+#ifdef NAND_USING_QSPI
+    /* x4 program load needs the QSPI bus in 4 data lines and the chip QE bit set */
+    if (NAND_BUS_IS_QSPI(rtt_dev)
+            && (((struct rt_qspi_device *)rtt_dev->rt_spi_device)->config.qspi_dl_width == 4)
+            && (nand_dev->chip_info.qe_bit != 0))
+    {
+        spi_nand_set_feature(device, NAND_QE_ENABLE);
+        nand_dev->quad_load = RT_TRUE;
+        LOG_I("Nand flash quad program load enabled.");
+    }
+#endif
+
+#ifdef NAND_USING_STAT
+    if (nand_stat_init(device) != RT_EOK)
+    {
+        LOG_W("Nand flash statistics init failed.");
+    }
+#endif
+
+#ifdef NAND_USING_BBT
+    if (nand_bbt_init(device) != RT_EOK)
+    {
+        LOG_W("Nand flash bad block table init failed, check the block markers.");
+    }
+#endif
+
+#ifdef NAND_USING_ASYNC
+    if (nand_async_init(device) != RT_EOK)
+    {
+        LOG_W("Nand flash async engine init failed.");
+    }
+#endif
+
+#ifdef NAND_USING_ERASE_POOL
+    if (nand_erase_pool_init(device) != RT_EOK)
+    {
+        LOG_W("Nand flash erase pool init failed.");
+    }
+#endif
+
+#ifdef NAND_USING_REFRESH
+    if (nand_refresh_init(device) != RT_EOK)
+    {
+        LOG_W("Nand flash refresh init failed.");
+    }
+#endif
+
+    result = rt_mtd_nand_register_device(nand_dev->name, device);
+    if (result != RT_EOK)
+    {
+        LOG_E("Nand flash device %s register failed.", nand_dev->name);
+        spi_nand_deinit(device);
+        return -RT_ERROR;
+    }
+
     LOG_I("Nand flash init success.");
     return RT_EOK;
 }
@@ -17,19 +17,29 @@
 #define NAND_READ_ID                    0x9f    /* Read id */
 #define NAND_READ_PAGE_TO_CACHE         0x13    /* Read Page Data to cache */
 #define NAND_READ_FROM_CACHE            0x03    /* Read data from cache*/
-#define NAND_QUAD_READ                  0x6b
+#define NAND_DUAL_READ                  0x3b    /* Read data from cache x2 */
+#define NAND_DUAL_IO_READ               0xbb    /* Read data from cache dual I/O */
+#define NAND_QUAD_READ                  0x6b    /* Read data from cache x4 */
+#define NAND_QUAD_IO_READ               0xeb    /* Read data from cache quad I/O */
+#define NAND_CACHE_READ_RANDOM          0x30    /* Cache Read Random */
+#define NAND_CACHE_READ_SEQ             0x31    /* Cache Read Sequential */
+#define NAND_CACHE_READ_END             0x3f    /* Cache Read End */
 
 /* write cmd */
 #define NAND_WRITE_ENABLE               0x06
 #define NAND_WRITE_DISABLE              0x04
 #define NAND_WRITE                      0x02
-#define NAND_QUAD_WRITE                 0x32
+#define NAND_QUAD_WRITE                 0x32    /* Quad Program Load */
+#define NAND_RANDOM_WRITE               0x84    /* Random Program Load */
+#define NAND_QUAD_RANDOM_WRITE          0x34    /* Random Quad Program Load */
 #define NAND_WRITE_EXECUTE              0x10
 
 /* Erase cmd */
 #define NAND_BLOCK_ERASE                0xd8
 /* Reset cmd */
 #define NAND_RESET                      0xff
+/* Software Die Select cmd */
+#define NAND_DIE_SELECT                 0xc2
 /* Dummy cmd */
 #define DUMMY_CMD                       0x00
 
@@ -51,7 +61,17 @@
 #define NAND_SR2_OTPL_BIT_MASK          0x80
 #define NAND_SR3_BUSY_BIT_MASK          0x01
 #define NAND_SR3_WEL_BIT_MASK           0x02
+#define NAND_SR3_EFAIL_BIT_MASK         0x04
+#define NAND_SR3_PFAIL_BIT_MASK         0x08
 
+/* nand flash chip feature */
+#define NAND_FEATURE_CONT_READ          (1 << 0)    /* Continuous Read mode (Winbond BUF=0) */
+#define NAND_FEATURE_CACHE_READ         (1 << 1)    /* Cache Read Random/Sequential/End (0x30/0x31/0x3f) */
+#define NAND_FEATURE_STATUS_STREAM      (1 << 3)    /* Get Feature streams the status byte while CS stays low */
+#define NAND_FEATURE_COPYBACK           (1 << 4)    /* Program Execute keeps the cache loaded by Page Data Read */
+
+/* max stacked dies in one package */
+#define NAND_DIE_MAX                    (4)
 
 
 /* Nand flash config */
@@ -78,6 +98,8 @@ typedef struct
     rt_uint8_t data_lines;
 } nand_qspi_cmd_format;
 
+#endif /* NAND_USING_QSPI */
+
 enum nand_qspi_wr_mode
 {
     NORMAL_SPI_READ = 1 << 0,               /**< mormal spi read mode */
@@ -86,7 +108,304 @@ enum nand_qspi_wr_mode
     QUAD_OUTPUT = 1 << 3,                   /**< qspi fast read quad output */
     QUAD_IO = 1 << 4,                       /**< qspi fast read quad input/output */
 };
-#endif /* NAND_USING_QSPI */
+
+/* max segments of one nand_spi xfer */
+#define NAND_SPI_XFER_MAX             (8)
+
+/*
+ * DMA alignment of the page data buffers, in bytes. Caller buffers aligned
+ * in address and length are transferred directly, the others go through an
+ * aligned bounce buffer. 1 transfers every buffer directly.
+ */
+#ifndef RT_NAND_DMA_ALIGN
+#define RT_NAND_DMA_ALIGN             (1)
+#endif
+
+/**
+ * SPI transfer segment. The segments of one xfer share one chip select
+ * cycle up to a segment with cs_change set, the next segment starts a new
+ * command, so a whole command sequence goes in one xfer.
+ */
+typedef struct
+{
+    const rt_uint8_t *send_buf;                  /**< data to send, RT_NULL for read segment */
+    rt_uint8_t *recv_buf;                        /**< data to receive, RT_NULL for write segment */
+    rt_size_t length;                            /**< segment length */
+    rt_bool_t cs_change;                         /**< release the chip select after this segment */
+} nand_spi_xfer;
+
+#ifdef NAND_USING_PAGE_CACHE
+/* page cache entry number */
+#ifndef RT_NAND_PAGE_CACHE_NUM
+#define RT_NAND_PAGE_CACHE_NUM        (4)
+#endif
+
+/* page cache entry valid flag */
+#define NAND_CACHE_DATA_VALID         (1 << 0)
+#define NAND_CACHE_SPARE_VALID        (1 << 1)
+
+struct nand_page_cache_entry
+{
+    rt_off_t page;                               /**< cached page */
+    rt_uint8_t flag;                             /**< valid flag, @see NAND_CACHE_DATA_VALID */
+    rt_uint32_t age;                             /**< last access stamp, for LRU */
+    rt_uint8_t *data;                            /**< page data and spare */
+};
+
+struct nand_page_cache
+{
+    struct nand_page_cache_entry entry[RT_NAND_PAGE_CACHE_NUM];
+    rt_uint32_t stamp;                           /**< access stamp counter */
+    rt_uint32_t hit;                             /**< hit counter */
+    rt_uint32_t miss;                            /**< miss counter */
+};
+#endif /* NAND_USING_PAGE_CACHE */
+
+#ifdef NAND_USING_BBT
+/* reserved blocks at the end of the device for the bad block table */
+#ifndef RT_NAND_BBT_BLOCKS
+#define RT_NAND_BBT_BLOCKS            (4)
+#endif
+
+#define NAND_BBT_MAGIC                (0x30544242)    /* "BBT0" */
+#define NAND_BBT_COPIES               (2)             /* main and mirror */
+
+/* block state, 2 bits per block */
+#define NAND_BBT_BLOCK_GOOD           (0x0)
+#define NAND_BBT_BLOCK_WORN           (0x1)           /* marked bad at runtime */
+#define NAND_BBT_BLOCK_RESERVED       (0x2)           /* holds the table */
+#define NAND_BBT_BLOCK_FACTORY_BAD    (0x3)
+
+/* table header in the first page of a table block, the bitmap follows */
+struct nand_bbt_header
+{
+    rt_uint32_t magic;
+    rt_uint32_t version;
+    rt_uint32_t block_num;
+    rt_uint32_t crc;                             /**< crc32 of the bitmap */
+};
+
+struct nand_bbt
+{
+    rt_uint32_t version;                         /**< version of the table in flash */
+    rt_uint32_t block_num;                       /**< blocks covered by the table */
+    rt_int32_t copy_block[NAND_BBT_COPIES];      /**< blocks holding the table, -1 if none */
+    rt_uint8_t *bitmap;                          /**< 2 bits per block */
+};
+#endif /* NAND_USING_BBT */
+
+#ifdef NAND_USING_SW_ECC
+#ifdef NAND_USING_HW_ECC
+#error "NAND_USING_SW_ECC runs with the on-die ECC off, don't define NAND_USING_HW_ECC"
+#endif
+
+/* software ECC correctable bits per sector, 1: Hamming, 4 or 8: BCH */
+#ifndef RT_NAND_SW_ECC_STRENGTH
+#define RT_NAND_SW_ECC_STRENGTH       (4)
+#endif
+
+#define NAND_ECC_SECTOR_SIZE          (512)
+
+struct nand_bch;
+
+/**
+ * software ECC engine, the parity of each sector is ecc->bytes bytes
+ */
+struct nand_ecc
+{
+    rt_uint8_t strength;                         /**< correctable bits per sector */
+    rt_uint8_t bytes;                            /**< parity bytes per sector */
+    struct nand_bch *bch;                        /**< BCH tables, RT_NULL for Hamming */
+    rt_uint8_t *oob_buf;                         /**< spare of the page in process, used under the device lock */
+    rt_uint8_t *data_buf;                        /**< the sector a read or write ends inside */
+};
+#endif /* NAND_USING_SW_ECC */
+
+/* max blocks erased in one run by spi_nand_erase_all, between progress reports */
+#ifndef RT_NAND_ERASE_RUN_BLOCKS
+#define RT_NAND_ERASE_RUN_BLOCKS      (16)
+#endif
+
+/* bulk erase progress callback, done and total are in blocks */
+typedef void (*nand_erase_progress_t)(struct rt_mtd_nand_device *device, rt_uint32_t done,
+                                      rt_uint32_t total, void *parameter);
+
+#ifdef NAND_USING_ERASE_POOL
+/* pre-erased blocks kept ready */
+#ifndef RT_NAND_ERASE_POOL_SIZE
+#define RT_NAND_ERASE_POOL_SIZE       (8)
+#endif
+
+#ifndef RT_NAND_ERASE_POOL_THREAD_STACK_SIZE
+#define RT_NAND_ERASE_POOL_THREAD_STACK_SIZE  (1024)
+#endif
+
+/* below the async driver thread, the erases run when the bus is idle */
+#ifndef RT_NAND_ERASE_POOL_THREAD_PRIORITY
+#define RT_NAND_ERASE_POOL_THREAD_PRIORITY    (RT_THREAD_PRIORITY_MAX - 2)
+#endif
+
+/**
+ * pre-erase pool, the free blocks given back by the upper layer are erased
+ * in the background until RT_NAND_ERASE_POOL_SIZE blocks are ready
+ */
+struct nand_erase_pool
+{
+    struct rt_mutex lock;
+    rt_uint8_t *dirty_map;                       /**< free blocks to erase, 1 bit per block */
+    rt_uint32_t dirty_num;
+    rt_uint32_t dirty_cursor;                    /**< next block to look at, the blocks are taken round robin */
+    rt_uint32_t ready[RT_NAND_ERASE_POOL_SIZE];  /**< erased blocks, FIFO */
+    rt_uint32_t ready_head;
+    rt_uint32_t ready_num;
+    struct rt_semaphore sem;                     /**< wakes the erase thread */
+    rt_thread_t thread;
+};
+#endif /* NAND_USING_ERASE_POOL */
+
+/* bitflips of a read the ECC can't correct */
+#define NAND_BITFLIPS_UNCORRECTABLE   (0xff)
+
+#ifdef NAND_USING_REFRESH
+/* reads of a block since its last erase that trigger a refresh (read disturb) */
+#ifndef RT_NAND_REFRESH_READS
+#define RT_NAND_REFRESH_READS         (100000)
+#endif
+
+/*
+ * corrected bits in one ECC sector that trigger a refresh. The on-chip ECC
+ * only flags a correction, counted as 1 bit, so the first correction does.
+ */
+#ifndef RT_NAND_REFRESH_BITFLIPS
+#ifdef NAND_USING_SW_ECC
+#define RT_NAND_REFRESH_BITFLIPS      ((RT_NAND_SW_ECC_STRENGTH * 3 + 3) / 4)
+#else
+#define RT_NAND_REFRESH_BITFLIPS      (1)
+#endif
+#endif
+
+#ifndef RT_NAND_REFRESH_THREAD_STACK_SIZE
+#define RT_NAND_REFRESH_THREAD_STACK_SIZE     (1024)
+#endif
+
+/* the lowest priority above idle, a refresh only runs when nothing else does */
+#ifndef RT_NAND_REFRESH_THREAD_PRIORITY
+#define RT_NAND_REFRESH_THREAD_PRIORITY       (RT_THREAD_PRIORITY_MAX - 2)
+#endif
+
+/*
+ * refresh handler, relocates the data of the block and gives it back for
+ * erase. block is relative to the device, return RT_EOK when done.
+ */
+typedef rt_err_t (*nand_refresh_handler_t)(struct rt_mtd_nand_device *device, rt_uint32_t block, void *parameter);
+
+/**
+ * read disturb and bitflip tracking, the counters are cleared by the erase
+ * of the block
+ */
+struct nand_refresh
+{
+    rt_uint32_t *reads;                          /**< reads since the last erase, per block */
+    rt_uint8_t *bitflips;                        /**< worst corrected bits per sector since the last erase, per block */
+    rt_uint8_t *pending;                         /**< blocks waiting for refresh, 1 bit per block */
+    rt_uint32_t pending_num;
+    rt_uint32_t read_limit;                      /**< @see RT_NAND_REFRESH_READS */
+    rt_uint8_t bitflip_limit;                    /**< @see RT_NAND_REFRESH_BITFLIPS */
+    rt_uint32_t refreshed;                       /**< blocks refreshed */
+    rt_uint32_t failed;                          /**< refresh failures */
+    nand_refresh_handler_t handler;
+    void *parameter;
+    struct rt_semaphore sem;                     /**< wakes the refresh thread */
+    rt_thread_t thread;
+};
+#endif /* NAND_USING_REFRESH */
+
+#ifdef NAND_USING_STAT
+/*
+ * free running microsecond clock of the latency statistics, the default
+ * is the OS tick. Define it to a cycle counter based clock for a real
+ * breakdown, like ((rt_uint32_t)(DWT->CYCCNT / (SystemCoreClock / 1000000))).
+ */
+#ifndef RT_NAND_STAT_TIME_US
+#define RT_NAND_STAT_TIME_US()        ((rt_uint32_t)rt_tick_get() * (1000000 / RT_TICK_PER_SECOND))
+#define NAND_STAT_TICK_CLOCK
+#endif
+
+/* latency histogram buckets, bucket N counts [2^(N-1), 2^N) microseconds */
+#ifndef RT_NAND_STAT_BUCKETS
+#define RT_NAND_STAT_BUCKETS          (24)
+#endif
+
+/* SPI command opcodes counted */
+#ifndef RT_NAND_STAT_OPCODES
+#define RT_NAND_STAT_OPCODES          (24)
+#endif
+
+/* operations measured */
+#define NAND_STAT_READ                0
+#define NAND_STAT_WRITE               1
+#define NAND_STAT_ERASE               2
+#define NAND_STAT_OP_NUM              3
+
+/* operation phases, all but the total are exclusive */
+#define NAND_STAT_TOTAL               0       /* the whole operation */
+#define NAND_STAT_LOCK                1       /* wait for the device lock */
+#define NAND_STAT_CMD                 2       /* SPI commands without page data */
+#define NAND_STAT_XFER                3       /* page data transfer, read from cache and program load */
+#define NAND_STAT_BUSY                4       /* status polls of the busy wait */
+#define NAND_STAT_DELAY               5       /* sleeps and delays of the busy wait */
+#define NAND_STAT_PHASE_NUM           6
+
+struct nand_stat_hist
+{
+    rt_uint32_t count;
+    rt_uint32_t max_us;
+    rt_uint64_t sum_us;
+    rt_uint32_t bucket[RT_NAND_STAT_BUCKETS];
+};
+
+struct nand_stat_opcode
+{
+    rt_uint8_t opcode;
+    rt_uint32_t count;                           /**< transactions */
+    rt_uint64_t bytes;                           /**< bytes on the bus, the command bytes included */
+};
+
+/**
+ * latency and traffic statistics, updated with the device locked
+ */
+struct nand_stat
+{
+    rt_uint8_t op;                               /**< operation in process */
+    rt_uint8_t depth;                            /**< nested operations, only the outer one is measured */
+    rt_bool_t in_busy;
+    rt_uint32_t start;                           /**< operation start time */
+    rt_uint32_t busy_start;
+    rt_uint32_t busy_delay;                      /**< delay time at the busy wait start */
+    rt_uint32_t phase_us[NAND_STAT_PHASE_NUM];   /**< phases of the operation in process */
+    struct nand_stat_hist hist[NAND_STAT_OP_NUM][NAND_STAT_PHASE_NUM];
+    rt_uint32_t busy_polls[NAND_STAT_OP_NUM];    /**< status polls of the busy waits */
+    struct nand_stat_opcode opcode[RT_NAND_STAT_OPCODES];
+    rt_uint32_t opcode_num;
+    rt_uint32_t opcode_lost;                     /**< transactions of the opcodes over RT_NAND_STAT_OPCODES */
+};
+
+#define NAND_STAT_TIME(t)                    rt_uint32_t t = RT_NAND_STAT_TIME_US()
+#define NAND_STAT_BEGIN(device, op, start)   nand_stat_begin(device, op, start)
+#define NAND_STAT_END(device)                nand_stat_end(device)
+#define NAND_STAT_PHASE(device, phase, start) nand_stat_phase(device, phase, start)
+#define NAND_STAT_BUSY_BEGIN(device)         nand_stat_busy_begin(device)
+#define NAND_STAT_BUSY_END(device)           nand_stat_busy_end(device)
+#define NAND_STAT_POLL(device)               nand_stat_poll(device)
+#else
+#define NAND_STAT_TIME(t)
+#define NAND_STAT_BEGIN(device, op, start)
+#define NAND_STAT_END(device)
+#define NAND_STAT_PHASE(device, phase, start)
+#define NAND_STAT_BUSY_BEGIN(device)
+#define NAND_STAT_BUSY_END(device)
+#define NAND_STAT_POLL(device)
+#endif /* NAND_USING_STAT */
 
 /**
  * SPI device
@@ -98,6 +417,8 @@ typedef struct __nand_spi
     /* SPI bus write read data function */
     rt_err_t (*wr)(const struct __nand_spi *spi, const rt_uint8_t *write_buf, rt_size_t write_size,
                    rt_uint8_t *read_buf, rt_size_t read_size);
+    /* SPI bus scatter-gather transfer, segments are sent in one chip select cycle */
+    rt_err_t (*xfer)(const struct __nand_spi *spi, const nand_spi_xfer *xfer, rt_size_t count);
 #ifdef NAND_USING_QSPI
     /* Quad Load Program */
     rt_err_t (*qspi_wr)(const struct __nand_spi *spi,  rt_uint32_t addr, nand_qspi_cmd_format *qspi_cmd_format,
@@ -121,17 +442,120 @@ typedef struct
     rt_uint8_t capacity_id;                         /**< capacity ID */
 } nand_flash_chip;
 
-/* nand flash chip REGISTER information */
+/* nand flash chip operation time, in microseconds */
+typedef struct
+{
+    rt_uint32_t read_us;                         /**< typical tR, with on-chip ECC */
+    rt_uint32_t read_max_us;
+    rt_uint32_t prog_us;                         /**< typical tPROG */
+    rt_uint32_t prog_max_us;
+    rt_uint32_t erase_us;                        /**< typical tBERS */
+    rt_uint32_t erase_max_us;
+    rt_uint32_t reset_max_us;                    /**< max tRST */
+} nand_flash_timing;
+
+/* nand flash chip descriptor */
 typedef struct
 {
     char *name;                                  /**< flash chip name */
+    rt_uint8_t  mf_id;                           /**< manufacturer ID */
+    rt_uint8_t  type_id;                         /**< memory type ID */
+    rt_uint8_t  capacity_id;                     /**< capacity ID */
     rt_uint8_t  capacity;                            /**< flash chip capacity */
+    rt_uint16_t page_size;                       /**< main area bytes of a page */
+    rt_uint16_t oob_size;                        /**< spare area bytes of a page */
+    rt_uint16_t pages_per_block;
+    rt_uint16_t blocks_per_die;
+    rt_uint8_t  plane_num;
+    rt_uint8_t  die_num;                         /**< stacked die number, selected by Software Die Select */
     rt_uint16_t bp_bit;
     rt_uint16_t ecc_bit;
     rt_uint16_t qe_bit;
     rt_uint16_t busy_bit;
+    rt_uint8_t  prog_fail;                       /**< program fail bits, in the register of busy_bit */
+    rt_uint8_t  erase_fail;                      /**< erase fail bits, in the register of busy_bit */
+    rt_uint16_t ecc_status;                      /**< ECC status bits, (SR_ADDR<<8)|MASK */
+    rt_uint8_t  ecc_fail;                        /**< bit N set: ECC status N is uncorrectable */
+    rt_uint8_t  read_mode;                       /**< supported read mode, @see nand_qspi_wr_mode */
+    rt_uint16_t feature;                         /**< chip feature, @see NAND_FEATURE_CONT_READ */
+    rt_uint32_t max_hz;                          /**< max SPI clock of the read commands */
+    nand_flash_timing timing;
 } nand_flash_chip_info;
 
+#ifdef NAND_USING_SIM
+/* SPI clock of the simulated bus, 0 for no bus time */
+#ifndef RT_NAND_SIM_BUS_HZ
+#define RT_NAND_SIM_BUS_HZ            (50000000)
+#endif
+
+/* partial programs of a page between erases */
+#ifndef RT_NAND_SIM_NOP
+#define RT_NAND_SIM_NOP               (4)
+#endif
+
+/* bitflips of a page the simulated on-chip ECC corrects */
+#ifndef RT_NAND_SIM_ECC_BITS
+#define RT_NAND_SIM_ECC_BITS          (1)
+#endif
+
+/* injected bitflips, @see spi_nand_sim_flip */
+#ifndef RT_NAND_SIM_FLIP_MAX
+#define RT_NAND_SIM_FLIP_MAX          (16)
+#endif
+
+struct nand_sim_die
+{
+    rt_uint8_t sr1;                              /**< protection register */
+    rt_uint8_t sr2;                              /**< configuration register */
+    rt_uint8_t sr3;                              /**< status register, the busy bit is from busy_until */
+    rt_bool_t wel;                               /**< write enable latch */
+    rt_uint64_t busy_until;                      /**< the array operation end, in microseconds */
+    rt_uint64_t data_ready;                      /**< the data register load end of a cache read */
+    rt_uint32_t data_page;                       /**< page in the data register */
+    rt_uint8_t data_ecc;                         /**< ECC status bits of the data register page */
+    rt_uint8_t *cache;                           /**< cache register, page and spare */
+    rt_uint8_t *data;                            /**< data register, the next page of a cache read */
+};
+
+/**
+ * simulated SPI NAND chip behind the nand_spi interface
+ */
+struct nand_sim
+{
+    nand_flash_chip_info chip;                   /**< the simulated chip descriptor */
+    nand_flash_timing timing;                    /**< tR, tPROG, tBERS of the simulation */
+    rt_uint32_t bus_hz;
+    rt_uint32_t page_bytes;                      /**< page and spare */
+    rt_uint32_t die_pages;
+    rt_uint8_t die_sel;
+    struct nand_sim_die die[NAND_DIE_MAX];
+    rt_uint8_t *array;                           /**< RAM storage, RT_NULL if file backed */
+    void *file;                                  /**< backing file */
+    rt_uint8_t *nop;                             /**< partial programs per page */
+    rt_uint8_t *tx_buf;                          /**< the send segments of one transaction */
+    rt_uint8_t *rx_buf;                          /**< the receive segments of one transaction */
+    rt_uint8_t *page_buf;                        /**< array page in process */
+    rt_uint32_t bus_debt_ns;                     /**< bus time not delayed yet */
+    rt_uint32_t flip_page[RT_NAND_SIM_FLIP_MAX]; /**< array page of each injected bitflip */
+    rt_uint32_t flip_bit[RT_NAND_SIM_FLIP_MAX];  /**< bit in the page and spare */
+    rt_uint8_t flip_num;                         /**< injected bitflips, cleared by the block erase */
+
+    struct
+    {
+        rt_uint32_t reads;                       /**< Page Data Read and cache read loads */
+        rt_uint32_t programs;
+        rt_uint32_t erases;
+        rt_uint32_t prog_fails;                  /**< NOP over limit, protected or WEL not set */
+        rt_uint32_t erase_fails;
+        rt_uint32_t busy_drops;                  /**< commands ignored by a busy chip */
+        rt_uint32_t ecc_corrects;                /**< page reads with bitflips the ECC corrected */
+        rt_uint32_t ecc_fails;                   /**< page reads with too many bitflips */
+        rt_uint64_t bus_bytes;
+        rt_uint64_t bus_us;
+    } stat;
+};
+#endif /* NAND_USING_SIM */
+
 typedef struct
 {
     char *name;                                  /**< nand flash name */
@@ -141,69 +565,356 @@ typedef struct
     nand_spi spi;                                /**< SPI device */
     rt_bool_t init_ok;                                /**< initialize OK flag */
     rt_bool_t addr_in_4_byte;                         /**< flash is in 4-Byte addressing */
+    rt_uint8_t sr1;                                   /**< shadow of the protection register */
+    rt_uint8_t sr2;                                   /**< shadow of the configuration register */
+    rt_uint8_t status;                                /**< status register read when the chip went ready */
+    rt_size_t unprotect_count;                        /**< nested unprotected session count */
+    rt_uint8_t die_sel;                               /**< the active die */
+    rt_uint8_t die_busy;                              /**< dies with a program or erase in flight, 1 bit per die */
+    rt_err_t die_result[NAND_DIE_MAX];                /**< result of the last program or erase of each die */
+    rt_uint8_t die_op[NAND_DIE_MAX];                  /**< the operation in flight of each die */
+    rt_uint32_t die_block[NAND_DIE_MAX];              /**< chip block of the erase in flight of each die */
+    rt_uint8_t *blank_map;                            /**< blocks known erased, 1 bit per chip block */
+    rt_uint8_t bitflips;                              /**< worst corrected bits per sector of the read in process */
+#if RT_NAND_DMA_ALIGN > 1
+    rt_uint8_t *dma_buf;                              /**< aligned bounce buffer of the unaligned page data */
+#endif
 
     struct
     {
-        void (*delay)(void);                     /**< every retry's delay */
-        rt_size_t times;                            /**< default times for error retry */
+        rt_uint32_t interval;                    /**< min busy poll interval, in microseconds */
+        rt_tick_t timeout;                       /**< busy timeout, in ticks */
     } retry;
 
     void *user_data;                             /**< some user data */
 
 #ifdef NAND_USING_QSPI
     nand_qspi_cmd_format qspi_cmd_format;        /**< fast read cmd format */
+    rt_bool_t quad_load;                              /**< use Quad Program Load (0x32/0x34) */
+#endif
+
+#ifdef NAND_USING_PAGE_CACHE
+    struct nand_page_cache *cache;               /**< RAM page cache, RT_NULL if not allocated */
+#endif
+#ifdef NAND_USING_BBT
+    struct nand_bbt *bbt;                        /**< bad block table, RT_NULL if not built */
+#endif
+#ifdef NAND_USING_SW_ECC
+    struct nand_ecc *ecc;                        /**< software ECC, RT_NULL if not running */
+#endif
+#ifdef NAND_USING_ERASE_POOL
+    struct nand_erase_pool *pool;                /**< pre-erase pool, RT_NULL if not started */
+#endif
+#ifdef NAND_USING_REFRESH
+    struct nand_refresh *refresh;                /**< read disturb tracking, RT_NULL if not started */
+#endif
+#ifdef NAND_USING_SIM
+    struct nand_sim *sim;                        /**< simulated chip, RT_NULL on a real SPI bus */
+#endif
+#ifdef NAND_USING_STAT
+    struct nand_stat *stat;                      /**< latency statistics, RT_NULL if not started */
+    nand_spi stat_bus;                           /**< the SPI device interface wrapped by the statistics */
 #endif
 
 } nand_flash, *nand_flash_t;
 
+#ifdef NAND_USING_ASYNC
+/* async request operation */
+#define NAND_ASYNC_READ               1
+#define NAND_ASYNC_WRITE              2
+#define NAND_ASYNC_ERASE              3
+
+/**
+ * async request, owned by the caller until it is completed
+ */
+struct nand_async_req
+{
+    rt_list_t list;                              /**< queue node, used by the driver */
+    rt_uint8_t op;                               /**< @see NAND_ASYNC_READ */
+    rt_off_t page;                               /**< first page, or the block for erase */
+    rt_uint32_t page_count;                      /**< page count, 1 for a single page */
+    rt_uint8_t *data;                            /**< page_count * data_len bytes */
+    rt_uint32_t data_len;
+    rt_uint8_t *spare;                           /**< page_count * spare_len bytes */
+    rt_uint32_t spare_len;
+    rt_err_t result;                             /**< operation result, set before completion */
+    void (*done)(struct nand_async_req *req);    /**< completion callback, run in the driver thread */
+    rt_sem_t sem;                                /**< released on completion if not RT_NULL */
+    void *user_data;
+};
+
+struct nand_async
+{
+    rt_list_t queue;                             /**< pending requests */
+    struct rt_semaphore sem;                     /**< pending request count */
+    rt_thread_t thread;                          /**< driver worker thread */
+};
+
+#ifndef RT_NAND_ASYNC_THREAD_STACK_SIZE
+#define RT_NAND_ASYNC_THREAD_STACK_SIZE   (1024)
+#endif
+
+#ifndef RT_NAND_ASYNC_THREAD_PRIORITY
+#define RT_NAND_ASYNC_THREAD_PRIORITY     (RT_THREAD_PRIORITY_MAX / 2)
+#endif
+#endif /* NAND_USING_ASYNC */
+
+#ifdef NAND_USING_STRIPE
+/* max chips in one striped device */
+#ifndef RT_NAND_STRIPE_MAX
+#define RT_NAND_STRIPE_MAX            (4)
+#endif
+
+/**
+ * striped device, a logical page is the same page of every member, member N
+ * holds the slice N of the page data and spare
+ */
+struct nand_stripe
+{
+    struct rt_mtd_nand_device parent;
+    rt_size_t member_num;
+    struct rt_mtd_nand_device *member[RT_NAND_STRIPE_MAX];
+};
+#endif /* NAND_USING_STRIPE */
+
 struct spi_nand_flash_mtd
 {
     struct rt_mtd_nand_device           mtd_nand_device;
     struct rt_spi_device *              rt_spi_device;
     struct rt_mutex                     lock;
     void *                              user_data;
+#ifdef NAND_USING_ASYNC
+    struct nand_async *                 async;
+#endif
 };
 typedef struct spi_nand_flash_mtd *rt_spi_nand_flash_device_t;
 
 /*
- * FLASH id info
- *
- * | name | mf_id | type_id | capacity_id
- */
-#define SPI_NAND_FLASH_CHIP_TABLE                 \
-{                                                 \
-    {"W25N01GV",          0xef, 0xaa, 0x21},      \
-    {"TC58CYG0S3HRAIJ",   0x98, 0xd2, 0x40},      \
-}
-
-/*
- * FLASH register mask info
- *
- * | name | capacity | ((SR_ADDR<<8)|SR-MASK)
+ * FLASH chip descriptor, @see nand_flash_chip_info
  *
  *capacity:
  *      1: nand capacity is 1Gbit
  *      2: nand capacity is 2Gbit
  *      4: nand capacity is 4Gbit
  *      other.
+ * geometry:
+ *      the page main and spare size, pages per block, blocks per die, the
+ *      chip has die_num * blocks_per_die blocks.
  * Status Register addr and bit-MASK:
  *      (BP)          chip blk protect  bits mask
  *      (ECC-EN)      ecc enable        bit  mask
  *      (QE)          qspi enable       bit  mask
  *      (OIP/BUSY)    chip busy         bit  mask
+ *      (P-FAIL)      program fail      bits mask, in the busy register
+ *      (E-FAIL)      erase fail        bits mask, in the busy register
+ *      (ECC-STATUS)  ecc status        bits mask, ecc_fail lists the
+ *                    uncorrectable status values
+ * read_mode:
+ *      the Read from Cache commands, the fastest one the QSPI bus allows
+ *      is used, @see nand_qspi_wr_mode
+ * feature:
+ *      NAND_FEATURE_CONT_READ   the chip has the BUF bit and Continuous Read mode
+ *      NAND_FEATURE_CACHE_READ  the chip supports Cache Read Random/Sequential/End
+ *      NAND_FEATURE_STATUS_STREAM  Get Feature keeps shifting the status byte out
+ *                               until CS goes high
+ *      NAND_FEATURE_COPYBACK    internal data move, @see spi_nand_copyback
+ * max_hz:
+ *      the SPI clock is lowered to it if the bus is configured faster
+ * timing:
+ *      the typical time sets the busy poll interval, the max time the timeout
+ * die_num:
+ *      stacked dies in the package, the blocks are interleaved over the dies,
+ *      block N is block N / die_num of die N % die_num. The dies have the same
+ *      register layout.
  */
-#define SPI_NAND_FLASH_CHIP_INFO                                           \
-{                                                                          \
-    {"W25N01GV",          1,  (NAND_SR1_ADDR<<8)|NAND_SR1_BP_BIT_MASK,     \
-                              (NAND_SR2_ADDR<<8)|NAND_SR2_ECC_BIT_MASK,    \
-                              (NAND_SR2_ADDR<<8)|NAND_SR2_QE_BIT_MASK,     \
-                              (NAND_SR3_ADDR<<8)|NAND_SR3_BUSY_BIT_MASK},  \
-    {"TC58CYG0S3HRAIJ",   1,  (NAND_SR1_ADDR<<8)|0x38,                     \
-                              (NAND_SR2_ADDR<<8)|NAND_SR2_ECC_BIT_MASK,    \
-                              (NAND_SR2_ADDR<<8)|NAND_SR2_QE_BIT_MASK,     \
-                              (NAND_SR3_ADDR<<8)|NAND_SR3_BUSY_BIT_MASK},  \
+#define SPI_NAND_FLASH_CHIP_INFO                                                    \
+{                                                                                   \
+    {                                                                               \
+        .name = "W25N01GV", .mf_id = 0xef, .type_id = 0xaa, .capacity_id = 0x21,    \
+        .capacity = 1,                                                              \
+        .page_size = 2048, .oob_size = 64, .pages_per_block = 64,                   \
+        .blocks_per_die = 1024, .plane_num = 1, .die_num = 1,                       \
+        .bp_bit = (NAND_SR1_ADDR<<8)|NAND_SR1_BP_BIT_MASK,                          \
+        .ecc_bit = (NAND_SR2_ADDR<<8)|NAND_SR2_ECC_BIT_MASK,                        \
+        .qe_bit = (NAND_SR2_ADDR<<8)|NAND_SR2_QE_BIT_MASK,                          \
+        .busy_bit = (NAND_SR3_ADDR<<8)|NAND_SR3_BUSY_BIT_MASK,                      \
+        .prog_fail = NAND_SR3_PFAIL_BIT_MASK,                                       \
+        .erase_fail = NAND_SR3_EFAIL_BIT_MASK,                                      \
+        .ecc_status = (NAND_SR3_ADDR<<8)|0x30, .ecc_fail = (1<<2)|(1<<3),           \
+        .read_mode = NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO,       \
+        .feature = NAND_FEATURE_CONT_READ|NAND_FEATURE_STATUS_STREAM|               \
+                   NAND_FEATURE_COPYBACK,                                           \
+        .max_hz = 104000000,                                                        \
+        .timing = {50, 60, 250, 700, 2000, 10000, 500},                             \
+    },                                                                              \
+    {                                                                               \
+        .name = "TC58CYG0S3HRAIJ", .mf_id = 0x98, .type_id = 0xd2, .capacity_id = 0x40, \
+        .capacity = 1,                                                              \
+        .page_size = 2048, .oob_size = 64, .pages_per_block = 64,                   \
+        .blocks_per_die = 1024, .plane_num = 1, .die_num = 1,                       \
+        .bp_bit = (NAND_SR1_ADDR<<8)|0x38,                                          \
+        .ecc_bit = (NAND_SR2_ADDR<<8)|NAND_SR2_ECC_BIT_MASK,                        \
+        .qe_bit = (NAND_SR2_ADDR<<8)|NAND_SR2_QE_BIT_MASK,                          \
+        .busy_bit = (NAND_SR3_ADDR<<8)|NAND_SR3_BUSY_BIT_MASK,                      \
+        .prog_fail = NAND_SR3_PFAIL_BIT_MASK,                                       \
+        .erase_fail = NAND_SR3_EFAIL_BIT_MASK,                                      \
+        .ecc_status = (NAND_SR3_ADDR<<8)|0x30, .ecc_fail = (1<<2),                  \
+        .read_mode = NORMAL_SPI_READ|DUAL_OUTPUT|QUAD_OUTPUT,                       \
+        .feature = NAND_FEATURE_CACHE_READ|NAND_FEATURE_COPYBACK,                   \
+        .max_hz = 133000000,                                                        \
+        .timing = {40, 115, 330, 600, 3000, 7000, 500},                             \
+    },                                                                              \
+    {                                                                               \
+        .name = "W25M02GV", .mf_id = 0xef, .type_id = 0xab, .capacity_id = 0x21,    \
+        .capacity = 2,                                                              \
+        .page_size = 2048, .oob_size = 64, .pages_per_block = 64,                   \
+        .blocks_per_die = 1024, .plane_num = 1, .die_num = 2,                       \
+        .bp_bit = (NAND_SR1_ADDR<<8)|NAND_SR1_BP_BIT_MASK,                          \
+        .ecc_bit = (NAND_SR2_ADDR<<8)|NAND_SR2_ECC_BIT_MASK,                        \
+        .qe_bit = (NAND_SR2_ADDR<<8)|NAND_SR2_QE_BIT_MASK,                          \
+        .busy_bit = (NAND_SR3_ADDR<<8)|NAND_SR3_BUSY_BIT_MASK,                      \
+        .prog_fail = NAND_SR3_PFAIL_BIT_MASK,                                       \
+        .erase_fail = NAND_SR3_EFAIL_BIT_MASK,                                      \
+        .ecc_status = (NAND_SR3_ADDR<<8)|0x30, .ecc_fail = (1<<2)|(1<<3),           \
+        .read_mode = NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO,       \
+        .feature = NAND_FEATURE_CONT_READ|NAND_FEATURE_STATUS_STREAM|               \
+                   NAND_FEATURE_COPYBACK,                                           \
+        .max_hz = 104000000,                                                        \
+        .timing = {50, 60, 250, 700, 2000, 10000, 500},                             \
+    },                                                                              \
 }
 
+/* driver ops */
+rt_err_t _read_page(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint8_t *data, rt_uint32_t data_len,
+                    rt_uint8_t *spare, rt_uint32_t spare_len);
+rt_err_t _write_page(struct rt_mtd_nand_device *device, rt_off_t page, const rt_uint8_t *data, rt_uint32_t data_len,
+                     const rt_uint8_t *spare, rt_uint32_t spare_len);
+rt_err_t _erase_block(struct rt_mtd_nand_device *device, rt_uint32_t block);
+
+rt_err_t spi_nand_unprotect_session_begin(struct rt_mtd_nand_device *device);
+rt_uint8_t spi_nand_die_of_page(struct rt_mtd_nand_device *device, rt_off_t page);
+rt_err_t spi_nand_die_finish(struct rt_mtd_nand_device *device, rt_uint8_t die);
+rt_err_t spi_nand_program_start(struct rt_mtd_nand_device *device, rt_off_t page,
+                                const rt_uint8_t *data, rt_uint32_t data_len,
+                                const rt_uint8_t *spare, rt_uint32_t spare_len);
+rt_err_t spi_nand_erase_start(struct rt_mtd_nand_device *device, rt_uint32_t block);
+rt_err_t spi_nand_erase_blocks(struct rt_mtd_nand_device *device, rt_uint32_t block, rt_uint32_t block_count);
+rt_bool_t spi_nand_block_is_blank(struct rt_mtd_nand_device *device, rt_uint32_t block);
+rt_err_t spi_nand_erase_all(struct rt_mtd_nand_device *device, nand_erase_progress_t progress, void *parameter);
+int spi_erase_all_nand(struct rt_mtd_nand_device *device);
+rt_err_t spi_nand_unprotect_session_end(struct rt_mtd_nand_device *device);
+rt_err_t spi_nand_read_pages(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t page_count,
+                             rt_uint8_t *data, rt_uint32_t data_len, rt_uint8_t *spare, rt_uint32_t spare_len);
+rt_err_t spi_nand_copyback(struct rt_mtd_nand_device *device, rt_off_t src_page, rt_off_t dst_page,
+                           const rt_uint8_t *spare, rt_uint32_t spare_len);
+rt_err_t spi_nand_write_pages(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t page_count,
+                              const rt_uint8_t *data, rt_uint32_t data_len,
+                              const rt_uint8_t *spare, rt_uint32_t spare_len);
+rt_err_t spi_nand_read_stream(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint8_t *buf,
+                              rt_uint32_t page_count);
+
+#ifdef NAND_USING_ASYNC
+rt_err_t nand_async_init(struct rt_mtd_nand_device *device);
+void nand_async_deinit(struct rt_mtd_nand_device *device);
+rt_err_t spi_nand_async_submit(struct rt_mtd_nand_device *device, struct nand_async_req *req);
+#endif /* NAND_USING_ASYNC */
+
+#ifdef NAND_USING_QSPI
+rt_err_t nand_qspi_fast_read_enable(nand_flash_t flash, rt_uint8_t data_line_width);
+#endif /* NAND_USING_QSPI */
+
+rt_bool_t spi_nand_check_bad_marker(struct rt_mtd_nand_device *device, rt_uint32_t block);
+rt_err_t spi_nand_write_bad_marker(struct rt_mtd_nand_device *device, rt_uint32_t block);
+
+rt_bool_t spi_nand_device_check(struct rt_mtd_nand_device *device);
+
+#ifdef NAND_USING_STRIPE
+rt_err_t rt_spi_nand_stripe_register(const char *stripe_dev_name, const char *member_dev_name[], rt_size_t member_num);
+rt_err_t spi_nand_stripe_read_pages(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t page_count,
+                                    rt_uint8_t *data, rt_uint32_t data_len,
+                                    rt_uint8_t *spare, rt_uint32_t spare_len);
+rt_err_t spi_nand_stripe_write_pages(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t page_count,
+                                     const rt_uint8_t *data, rt_uint32_t data_len,
+                                     const rt_uint8_t *spare, rt_uint32_t spare_len);
+#endif /* NAND_USING_STRIPE */
+
+#ifdef NAND_USING_BBT
+rt_err_t nand_bbt_init(struct rt_mtd_nand_device *device);
+void nand_bbt_deinit(struct rt_mtd_nand_device *device);
+rt_err_t nand_bbt_check_block(struct rt_mtd_nand_device *device, rt_uint32_t block);
+rt_err_t nand_bbt_mark_block(struct rt_mtd_nand_device *device, rt_uint32_t block);
+#endif /* NAND_USING_BBT */
+
+#ifdef NAND_USING_SW_ECC
+struct nand_ecc *nand_ecc_create(rt_uint8_t strength);
+void nand_ecc_delete(struct nand_ecc *ecc);
+void nand_ecc_encode(struct nand_ecc *ecc, const rt_uint8_t *data, rt_uint8_t *parity);
+int nand_ecc_correct(struct nand_ecc *ecc, rt_uint8_t *data, const rt_uint8_t *parity);
+rt_err_t nand_ecc_init(struct rt_mtd_nand_device *device);
+void nand_ecc_page_encode(struct rt_mtd_nand_device *device, const rt_uint8_t *data, rt_uint32_t data_len,
+                          rt_uint8_t *oob);
+rt_err_t nand_ecc_page_correct(struct rt_mtd_nand_device *device, rt_uint8_t *data, rt_uint32_t data_len,
+                               const rt_uint8_t *oob);
+#endif /* NAND_USING_SW_ECC */
+
+#ifdef NAND_USING_ERASE_POOL
+rt_err_t nand_erase_pool_init(struct rt_mtd_nand_device *device);
+void nand_erase_pool_deinit(struct rt_mtd_nand_device *device);
+rt_err_t spi_nand_block_release(struct rt_mtd_nand_device *device, rt_uint32_t block);
+rt_err_t spi_nand_block_alloc(struct rt_mtd_nand_device *device, rt_uint32_t *block);
+rt_uint32_t spi_nand_pool_ready(struct rt_mtd_nand_device *device);
+#endif /* NAND_USING_ERASE_POOL */
+
+#ifdef NAND_USING_REFRESH
+rt_err_t nand_refresh_init(struct rt_mtd_nand_device *device);
+void nand_refresh_deinit(struct rt_mtd_nand_device *device);
+void nand_refresh_account(struct rt_mtd_nand_device *device, rt_uint32_t block, rt_uint8_t bitflips);
+void nand_refresh_erased(struct rt_mtd_nand_device *device, rt_uint32_t block);
+void spi_nand_refresh_config(struct rt_mtd_nand_device *device, rt_uint32_t read_limit, rt_uint8_t bitflip_limit);
+void spi_nand_refresh_set_handler(struct rt_mtd_nand_device *device, nand_refresh_handler_t handler, void *parameter);
+rt_err_t spi_nand_block_stat(struct rt_mtd_nand_device *device, rt_uint32_t block, rt_uint32_t *reads,
+                             rt_uint8_t *bitflips);
+#endif /* NAND_USING_REFRESH */
+
+#ifdef NAND_USING_SIM
+rt_spi_nand_flash_device_t rt_spi_nand_sim_probe(const char *spi_nand_dev_name, const char *chip_name,
+                                                 const char *file_name);
+rt_err_t spi_nand_sim_config(struct rt_mtd_nand_device *device, const nand_flash_timing *timing, rt_uint32_t bus_hz);
+const struct nand_sim *spi_nand_sim_get(struct rt_mtd_nand_device *device);
+rt_err_t spi_nand_sim_flip(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t bit);
+#endif /* NAND_USING_SIM */
+
+#ifdef NAND_USING_STAT
+rt_err_t nand_stat_init(struct rt_mtd_nand_device *device);
+void nand_stat_deinit(struct rt_mtd_nand_device *device);
+void nand_stat_begin(struct rt_mtd_nand_device *device, rt_uint8_t op, rt_uint32_t start);
+void nand_stat_end(struct rt_mtd_nand_device *device);
+void nand_stat_phase(struct rt_mtd_nand_device *device, rt_uint8_t phase, rt_uint32_t start);
+void nand_stat_busy_begin(struct rt_mtd_nand_device *device);
+void nand_stat_busy_end(struct rt_mtd_nand_device *device);
+void nand_stat_poll(struct rt_mtd_nand_device *device);
+const struct nand_stat *spi_nand_stat_get(struct rt_mtd_nand_device *device);
+rt_uint32_t spi_nand_stat_percentile(const struct nand_stat_hist *hist, rt_uint8_t percent);
+void spi_nand_stat_reset(struct rt_mtd_nand_device *device);
+#endif /* NAND_USING_STAT */
+
+#ifdef NAND_USING_PAGE_CACHE
+rt_err_t nand_cache_init(struct rt_mtd_nand_device *device);
+void nand_cache_deinit(struct rt_mtd_nand_device *device);
+void nand_cache_invalidate(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t page_count);
+rt_err_t nand_cache_read_page(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint8_t *data,
+                              rt_uint32_t data_len, rt_uint8_t *spare, rt_uint32_t spare_len);
+rt_err_t nand_cache_write_page(struct rt_mtd_nand_device *device, rt_off_t page, const rt_uint8_t *data,
+                               rt_uint32_t data_len, const rt_uint8_t *spare, rt_uint32_t spare_len);
+rt_err_t nand_cache_erase_block(struct rt_mtd_nand_device *device, rt_uint32_t block);
+void spi_nand_cache_stat(struct rt_mtd_nand_device *device, rt_uint32_t *hit, rt_uint32_t *miss);
+#endif /* NAND_USING_PAGE_CACHE */
+
+#ifdef PKG_USING_SPI_NANDFLASH_BENCH
+rt_err_t nand_bench_run(struct rt_mtd_nand_device *device, const char *test, rt_uint32_t block,
+                        rt_uint32_t block_count, rt_uint32_t ops, rt_uint32_t seed, rt_bool_t csv);
+#endif /* PKG_USING_SPI_NANDFLASH_BENCH */
+
 #endif /* DRV_NAND_FLASH_H_ */
 
 
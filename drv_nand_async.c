@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-12-02     yangjie      the first version
+ */
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include <rthw.h>
+#include "drv_mtd_nand.h"
+
+#define DBG_TAG     "drv_nand_async"
+#define DBG_LVL     DBG_LOG
+#include <rtdbg.h>
+
+/*
+ * Each nand device has a request queue served by one driver thread. The
+ * requests are run in submit order, a run of queued writes and erases
+ * shares one unprotected session. On a multi-die chip a single page write
+ * or an erase is only started, the thread goes on with the next request
+ * while the die is busy, and completes it when the die is needed again or
+ * the run ends. So the completions of requests on different dies may come
+ * out of the submit order.
+ */
+
+static struct nand_async_req *nand_async_pop(struct nand_async *async)
+{
+    rt_base_t level;
+    struct nand_async_req *req = RT_NULL;
+
+    level = rt_hw_interrupt_disable();
+    if (!rt_list_isempty(&async->queue))
+    {
+        req = rt_list_first_entry(&async->queue, struct nand_async_req, list);
+        rt_list_remove(&req->list);
+    }
+    rt_hw_interrupt_enable(level);
+
+    return req;
+}
+
+static rt_bool_t nand_async_next_is_program(struct nand_async *async)
+{
+    rt_base_t level;
+    rt_bool_t program = RT_FALSE;
+    struct nand_async_req *req = RT_NULL;
+
+    level = rt_hw_interrupt_disable();
+    if (!rt_list_isempty(&async->queue))
+    {
+        req = rt_list_first_entry(&async->queue, struct nand_async_req, list);
+        program = (req->op == NAND_ASYNC_WRITE || req->op == NAND_ASYNC_ERASE);
+    }
+    rt_hw_interrupt_enable(level);
+
+    return program;
+}
+
+static rt_err_t nand_async_run(struct rt_mtd_nand_device *device, struct nand_async_req *req)
+{
+    switch (req->op)
+    {
+    case NAND_ASYNC_READ:
+        if (req->page_count == 1)
+        {
+            return device->ops->read_page(device, req->page, req->data, req->data_len,
+                                          req->spare, req->spare_len);
+        }
+        return spi_nand_read_pages(device, req->page, req->page_count, req->data, req->data_len,
+                                   req->spare, req->spare_len);
+
+    case NAND_ASYNC_WRITE:
+        if (req->page_count == 1)
+        {
+            return device->ops->write_page(device, req->page, req->data, req->data_len,
+                                           req->spare, req->spare_len);
+        }
+        return spi_nand_write_pages(device, req->page, req->page_count, req->data, req->data_len,
+                                    req->spare, req->spare_len);
+
+    case NAND_ASYNC_ERASE:
+        return device->ops->erase_block(device, req->page);
+
+    default:
+        return -RT_EINVAL;
+    }
+}
+
+static void nand_async_complete(struct nand_async_req *req, rt_err_t result)
+{
+    req->result = result;
+    if (req->done)
+    {
+        req->done(req);
+    }
+    if (req->sem)
+    {
+        rt_sem_release(req->sem);
+    }
+}
+
+/* a single page write or an erase can be left running on its die */
+static rt_bool_t nand_async_can_defer(struct rt_mtd_nand_device *device, struct nand_async_req *req)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    if (nand_dev->chip_info.die_num <= 1)
+    {
+        return RT_FALSE;
+    }
+
+    return (req->op == NAND_ASYNC_ERASE) || (req->op == NAND_ASYNC_WRITE && req->page_count == 1);
+}
+
+/* complete the request running on the die */
+static void nand_async_finish(struct rt_mtd_nand_device *device, struct nand_async_req **pending, rt_uint8_t die)
+{
+    if (pending[die] != RT_NULL)
+    {
+        nand_async_complete(pending[die], spi_nand_die_finish(device, die));
+        pending[die] = RT_NULL;
+    }
+}
+
+static void nand_async_finish_all(struct rt_mtd_nand_device *device, struct nand_async_req **pending)
+{
+    rt_uint8_t die = 0;
+
+    for (die = 0; die < NAND_DIE_MAX; die++)
+    {
+        nand_async_finish(device, pending, die);
+    }
+}
+
+static void nand_async_start(struct rt_mtd_nand_device *device, struct nand_async_req **pending,
+                             struct nand_async_req *req)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint8_t die = 0;
+
+    if (req->op == NAND_ASYNC_ERASE)
+    {
+        die = spi_nand_die_of_page(device, req->page * device->pages_per_block);
+        nand_async_finish(device, pending, die);
+        result = spi_nand_erase_start(device, req->page);
+    }
+    else
+    {
+        die = spi_nand_die_of_page(device, req->page);
+        nand_async_finish(device, pending, die);
+        result = spi_nand_program_start(device, req->page, req->data, req->data_len, req->spare, req->spare_len);
+    }
+
+    if (result != RT_EOK)
+    {
+        nand_async_complete(req, result);
+        return;
+    }
+    pending[die] = req;
+}
+
+static void nand_async_thread_entry(void *parameter)
+{
+    struct rt_mtd_nand_device *device = (struct rt_mtd_nand_device *)parameter;
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    struct nand_async *async = rtt_dev->async;
+    struct nand_async_req *req = RT_NULL;
+    struct nand_async_req *pending[NAND_DIE_MAX] = { RT_NULL };
+    rt_bool_t session = RT_FALSE;
+    rt_bool_t defer = RT_FALSE;
+
+    while (1)
+    {
+        rt_sem_take(&async->sem, RT_WAITING_FOREVER);
+
+        req = nand_async_pop(async);
+        if (req == RT_NULL)
+        {
+            continue;
+        }
+
+        defer = nand_async_can_defer(device, req);
+
+        /* keep the array unlocked while writes and erases are queued back to back */
+        if (!session && (req->op == NAND_ASYNC_WRITE || req->op == NAND_ASYNC_ERASE)
+                && (defer || nand_async_next_is_program(async)))
+        {
+            spi_nand_unprotect_session_begin(device);
+            session = RT_TRUE;
+        }
+
+        if (defer)
+        {
+            nand_async_start(device, pending, req);
+        }
+        else
+        {
+            nand_async_finish_all(device, pending);
+            nand_async_complete(req, nand_async_run(device, req));
+        }
+
+        if (session && !nand_async_next_is_program(async))
+        {
+            nand_async_finish_all(device, pending);
+            spi_nand_unprotect_session_end(device);
+            session = RT_FALSE;
+        }
+    }
+}
+
+rt_err_t nand_async_init(struct rt_mtd_nand_device *device)
+{
+    struct nand_async *async = RT_NULL;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    async = (struct nand_async *)rt_malloc(sizeof(struct nand_async));
+    if (async == RT_NULL)
+    {
+        return -RT_ENOMEM;
+    }
+
+    rt_list_init(&async->queue);
+    rt_sem_init(&async->sem, nand_dev->name, 0, RT_IPC_FLAG_FIFO);
+    async->thread = rt_thread_create(nand_dev->name, nand_async_thread_entry, device,
+                                     RT_NAND_ASYNC_THREAD_STACK_SIZE, RT_NAND_ASYNC_THREAD_PRIORITY, 10);
+    if (async->thread == RT_NULL)
+    {
+        rt_sem_detach(&async->sem);
+        rt_free(async);
+        return -RT_ENOMEM;
+    }
+
+    rtt_dev->async = async;
+    rt_thread_startup(async->thread);
+
+    return RT_EOK;
+}
+
+/* nand_async_deinit: stop the driver thread, the device is not registered and the queue is empty */
+void nand_async_deinit(struct rt_mtd_nand_device *device)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    struct nand_async *async = rtt_dev->async;
+
+    if (async == RT_NULL)
+    {
+        return;
+    }
+
+    rt_thread_delete(async->thread);
+    rt_sem_detach(&async->sem);
+    rt_free(async);
+    rtt_dev->async = RT_NULL;
+}
+
+/*
+ * spi_nand_async_submit: queue a request to the driver thread and return at
+ * once. req->done and req->sem report the completion, req->result holds the
+ * operation result. The request and its buffers must stay valid until then.
+ */
+rt_err_t spi_nand_async_submit(struct rt_mtd_nand_device *device, struct nand_async_req *req)
+{
+    rt_base_t level;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    struct nand_async *async = rtt_dev->async;
+
+    RT_ASSERT(req != RT_NULL);
+
+    if (async == RT_NULL)
+    {
+        return -RT_ENOSYS;
+    }
+    if (req->op != NAND_ASYNC_ERASE && req->page_count == 0)
+    {
+        return -RT_EINVAL;
+    }
+
+    req->result = -RT_EBUSY;
+
+    level = rt_hw_interrupt_disable();
+    rt_list_insert_before(&async->queue, &req->list);
+    rt_hw_interrupt_enable(level);
+
+    rt_sem_release(&async->sem);
+
+    return RT_EOK;
+}
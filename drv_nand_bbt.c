@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-12-02     yangjie      the first version
+ */
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include "drv_mtd_nand.h"
+
+#define DBG_TAG     "drv_nand_bbt"
+#define DBG_LVL     DBG_LOG
+#include <rtdbg.h>
+
+/*
+ * Bad block table, 2 bits per block in RAM. The table is kept in the first
+ * page of two of the last RT_NAND_BBT_BLOCKS blocks of the device (main and
+ * mirror), the copy with the highest version wins at boot. The block markers
+ * are only scanned when no valid copy is found.
+ */
+
+#define NAND_BBT_GET(device)                                                                    \
+    (((nand_flash_t)(rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device)->user_data))->bbt)
+
+#define NAND_BBT_BITMAP_SIZE(block_num)     (((block_num) + 3) / 4)
+
+static rt_uint32_t nand_bbt_crc32(const rt_uint8_t *buf, rt_size_t len)
+{
+    rt_uint32_t crc = 0xffffffff;
+    int i;
+
+    while (len--)
+    {
+        crc ^= *buf++;
+        for (i = 0; i < 8; i++)
+        {
+            crc = (crc >> 1) ^ (0xedb88320 & (-(crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
+
+static rt_uint8_t nand_bbt_get(struct nand_bbt *bbt, rt_uint32_t block)
+{
+    return (bbt->bitmap[block >> 2] >> ((block & 0x3) << 1)) & 0x3;
+}
+
+static void nand_bbt_set(struct nand_bbt *bbt, rt_uint32_t block, rt_uint8_t state)
+{
+    rt_uint8_t shift = (block & 0x3) << 1;
+
+    bbt->bitmap[block >> 2] = (bbt->bitmap[block >> 2] & ~(0x3 << shift)) | (state << shift);
+}
+
+/* read one table copy, return RT_EOK if it is valid */
+static rt_err_t nand_bbt_read_copy(struct rt_mtd_nand_device *device, struct nand_bbt *bbt,
+                                   rt_uint32_t block, rt_uint8_t *page_buf)
+{
+    struct nand_bbt_header *header = (struct nand_bbt_header *)page_buf;
+    rt_size_t bitmap_size = NAND_BBT_BITMAP_SIZE(bbt->block_num);
+    rt_err_t result;
+
+    result = _read_page(device, block * device->pages_per_block, page_buf,
+                        sizeof(struct nand_bbt_header) + bitmap_size, RT_NULL, 0);
+    if (result != RT_EOK && result != -RT_MTD_EECC_CORRECT)
+    {
+        return result;
+    }
+
+    if (header->magic != NAND_BBT_MAGIC || header->block_num != bbt->block_num
+            || header->crc != nand_bbt_crc32(page_buf + sizeof(struct nand_bbt_header), bitmap_size))
+    {
+        return -RT_ERROR;
+    }
+
+    return RT_EOK;
+}
+
+static rt_err_t nand_bbt_write_copy(struct rt_mtd_nand_device *device, struct nand_bbt *bbt,
+                                    rt_uint32_t block, rt_uint8_t *page_buf)
+{
+    struct nand_bbt_header *header = (struct nand_bbt_header *)page_buf;
+    rt_size_t bitmap_size = NAND_BBT_BITMAP_SIZE(bbt->block_num);
+    rt_err_t result;
+
+    rt_memset(page_buf, 0xff, device->page_size);
+    header->magic = NAND_BBT_MAGIC;
+    header->version = bbt->version;
+    header->block_num = bbt->block_num;
+    header->crc = nand_bbt_crc32(bbt->bitmap, bitmap_size);
+    rt_memcpy(page_buf + sizeof(struct nand_bbt_header), bbt->bitmap, bitmap_size);
+
+    result = _erase_block(device, block);
+    if (result != RT_EOK)
+    {
+        return result;
+    }
+
+    return _write_page(device, block * device->pages_per_block, page_buf, device->page_size, RT_NULL, 0);
+}
+
+/*
+ * nand_bbt_update: write the table with a new version to both copies, a
+ * table block that fails is marked worn and the next reserved block is used.
+ */
+static rt_err_t nand_bbt_update(struct rt_mtd_nand_device *device, struct nand_bbt *bbt)
+{
+    rt_uint8_t *page_buf = RT_NULL;
+    rt_uint32_t first = bbt->block_num - RT_NAND_BBT_BLOCKS;
+    rt_uint32_t block = 0;
+    rt_uint32_t written = 0;
+    int i;
+
+    page_buf = (rt_uint8_t *)rt_malloc(device->page_size);
+    if (page_buf == RT_NULL)
+    {
+        return -RT_ENOMEM;
+    }
+
+    bbt->version++;
+
+    for (i = 0; i < NAND_BBT_COPIES; i++)
+    {
+        /* keep the copy in its block, or take a free reserved block */
+        if (bbt->copy_block[i] < 0 || nand_bbt_get(bbt, bbt->copy_block[i]) != NAND_BBT_BLOCK_RESERVED)
+        {
+            bbt->copy_block[i] = -1;
+            for (block = first; block < bbt->block_num; block++)
+            {
+                if (nand_bbt_get(bbt, block) == NAND_BBT_BLOCK_RESERVED
+                        && (rt_int32_t)block != bbt->copy_block[NAND_BBT_COPIES - 1 - i])
+                {
+                    bbt->copy_block[i] = block;
+                    break;
+                }
+            }
+            if (bbt->copy_block[i] < 0)
+            {
+                continue;
+            }
+        }
+
+        if (nand_bbt_write_copy(device, bbt, bbt->copy_block[i], page_buf) != RT_EOK)
+        {
+            LOG_W("bad block table block %d write failed.", bbt->copy_block[i]);
+            nand_bbt_set(bbt, bbt->copy_block[i], NAND_BBT_BLOCK_WORN);
+            bbt->copy_block[i] = -1;
+            /* retry this copy in the next reserved block */
+            i--;
+            continue;
+        }
+        written++;
+    }
+
+    rt_free(page_buf);
+
+    if (written == 0)
+    {
+        LOG_E("no bad block table copy written.");
+        return -RT_ERROR;
+    }
+
+    return RT_EOK;
+}
+
+/* build the table from the bad block markers */
+static void nand_bbt_scan(struct rt_mtd_nand_device *device, struct nand_bbt *bbt)
+{
+    rt_uint32_t block = 0;
+    rt_uint32_t bad = 0;
+
+    LOG_I("scan the bad block markers of %d blocks.", bbt->block_num);
+
+    rt_memset(bbt->bitmap, 0, NAND_BBT_BITMAP_SIZE(bbt->block_num));
+    for (block = 0; block < bbt->block_num; block++)
+    {
+        if (spi_nand_check_bad_marker(device, block))
+        {
+            nand_bbt_set(bbt, block, NAND_BBT_BLOCK_FACTORY_BAD);
+            bad++;
+        }
+        else if (block >= bbt->block_num - RT_NAND_BBT_BLOCKS)
+        {
+            nand_bbt_set(bbt, block, NAND_BBT_BLOCK_RESERVED);
+        }
+    }
+
+    LOG_I("found %d bad blocks.", bad);
+}
+
+rt_err_t nand_bbt_init(struct rt_mtd_nand_device *device)
+{
+    rt_err_t result = RT_EOK;
+    struct nand_bbt *bbt = RT_NULL;
+    rt_uint8_t *page_buf = RT_NULL;
+    rt_uint32_t block = 0;
+    rt_uint32_t version = 0;
+    rt_bool_t found = RT_FALSE;
+    rt_size_t bitmap_size;
+    struct nand_bbt_header *header;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    bbt = (struct nand_bbt *)rt_malloc(sizeof(struct nand_bbt));
+    if (bbt == RT_NULL)
+    {
+        return -RT_ENOMEM;
+    }
+    bbt->version = 0;
+    bbt->block_num = device->block_end - device->block_start;
+    bbt->copy_block[0] = -1;
+    bbt->copy_block[1] = -1;
+    bitmap_size = NAND_BBT_BITMAP_SIZE(bbt->block_num);
+
+    RT_ASSERT(bbt->block_num > RT_NAND_BBT_BLOCKS);
+    RT_ASSERT(sizeof(struct nand_bbt_header) + bitmap_size <= device->page_size);
+
+    bbt->bitmap = (rt_uint8_t *)rt_malloc(bitmap_size);
+    page_buf = (rt_uint8_t *)rt_malloc(device->page_size);
+    if (bbt->bitmap == RT_NULL || page_buf == RT_NULL)
+    {
+        result = -RT_ENOMEM;
+        goto __exit;
+    }
+    header = (struct nand_bbt_header *)page_buf;
+
+    nand_dev->spi.lock(spi);
+
+    /* find the latest valid copy in the reserved blocks */
+    for (block = bbt->block_num - RT_NAND_BBT_BLOCKS; block < bbt->block_num; block++)
+    {
+        if (nand_bbt_read_copy(device, bbt, block, page_buf) != RT_EOK)
+        {
+            continue;
+        }
+        if (!found || (rt_int32_t)(header->version - version) > 0)
+        {
+            version = header->version;
+            rt_memcpy(bbt->bitmap, page_buf + sizeof(struct nand_bbt_header), bitmap_size);
+            bbt->copy_block[1] = bbt->copy_block[0];
+            bbt->copy_block[0] = block;
+            found = RT_TRUE;
+        }
+        else if (header->version == version)
+        {
+            bbt->copy_block[1] = block;
+        }
+    }
+
+    if (found)
+    {
+        bbt->version = version;
+        /* an older mirror is dropped and rewritten */
+        if (bbt->copy_block[1] >= 0)
+        {
+            nand_bbt_read_copy(device, bbt, bbt->copy_block[1], page_buf);
+            if (header->version != version)
+            {
+                bbt->copy_block[1] = -1;
+            }
+        }
+        if (bbt->copy_block[1] < 0)
+        {
+            result = nand_bbt_update(device, bbt);
+        }
+        LOG_I("bad block table version %d loaded from block %d.", bbt->version, bbt->copy_block[0]);
+    }
+    else
+    {
+        nand_bbt_scan(device, bbt);
+        result = nand_bbt_update(device, bbt);
+    }
+
+    nand_dev->spi.unlock(spi);
+
+__exit:
+    rt_free(page_buf);
+    if (result != RT_EOK)
+    {
+        rt_free(bbt->bitmap);
+        rt_free(bbt);
+        return result;
+    }
+
+    nand_dev->bbt = bbt;
+
+    return RT_EOK;
+}
+
+/* nand_bbt_deinit: free the table in RAM, the copies in flash are kept */
+void nand_bbt_deinit(struct rt_mtd_nand_device *device)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    if (nand_dev->bbt == RT_NULL)
+    {
+        return;
+    }
+
+    rt_free(nand_dev->bbt->bitmap);
+    rt_free(nand_dev->bbt);
+    nand_dev->bbt = RT_NULL;
+}
+
+/* nand_bbt_check_block: RT_EOK if the block is good */
+rt_err_t nand_bbt_check_block(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    struct nand_bbt *bbt = NAND_BBT_GET(device);
+
+    if (block >= bbt->block_num)
+    {
+        return -RT_ERROR;
+    }
+
+    return nand_bbt_get(bbt, block) == NAND_BBT_BLOCK_GOOD ? RT_EOK : -RT_ERROR;
+}
+
+/* nand_bbt_mark_block: mark the block worn and write the table */
+rt_err_t nand_bbt_mark_block(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    rt_err_t result = RT_EOK;
+    struct nand_bbt *bbt = NAND_BBT_GET(device);
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    if (block >= bbt->block_num)
+    {
+        return -RT_ERROR;
+    }
+
+    nand_dev->spi.lock(spi);
+    if (nand_bbt_get(bbt, block) == NAND_BBT_BLOCK_GOOD)
+    {
+        nand_bbt_set(bbt, block, NAND_BBT_BLOCK_WORN);
+        result = nand_bbt_update(device, bbt);
+    }
+    nand_dev->spi.unlock(spi);
+
+    return result;
+}
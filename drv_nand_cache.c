@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-12-02     yangjie      the first version
+ */
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include "drv_mtd_nand.h"
+
+#define DBG_TAG     "drv_nand_cache"
+#define DBG_LVL     DBG_LOG
+#include <rtdbg.h>
+
+/*
+ * LRU cache of page data and spare in front of _read_page. Writes go to the
+ * chip first and then drop the cached page, erases drop the whole block.
+ */
+
+#define NAND_CACHE_GET(device)                                                                  \
+    (((nand_flash_t)(rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device)->user_data))->cache)
+
+rt_err_t nand_cache_init(struct rt_mtd_nand_device *device)
+{
+    rt_size_t i = 0;
+    struct nand_page_cache *cache = RT_NULL;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    cache = (struct nand_page_cache *)rt_malloc(sizeof(struct nand_page_cache));
+    if (cache == RT_NULL)
+    {
+        return -RT_ENOMEM;
+    }
+    rt_memset(cache, 0, sizeof(struct nand_page_cache));
+
+    for (i = 0; i < RT_NAND_PAGE_CACHE_NUM; i++)
+    {
+        cache->entry[i].data = (rt_uint8_t *)rt_malloc(device->page_size + device->oob_size);
+        if (cache->entry[i].data == RT_NULL)
+        {
+            goto error;
+        }
+    }
+
+    nand_dev->cache = cache;
+    LOG_I("Nand flash page cache %d pages.", RT_NAND_PAGE_CACHE_NUM);
+
+    return RT_EOK;
+
+error:
+    for (i = 0; i < RT_NAND_PAGE_CACHE_NUM; i++)
+    {
+        rt_free(cache->entry[i].data);
+    }
+    rt_free(cache);
+
+    return -RT_ENOMEM;
+}
+
+/* nand_cache_deinit: free the page cache, the device is not registered */
+void nand_cache_deinit(struct rt_mtd_nand_device *device)
+{
+    rt_size_t i = 0;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    struct nand_page_cache *cache = nand_dev->cache;
+
+    if (cache == RT_NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < RT_NAND_PAGE_CACHE_NUM; i++)
+    {
+        rt_free(cache->entry[i].data);
+    }
+    rt_free(cache);
+    nand_dev->cache = RT_NULL;
+}
+
+static struct nand_page_cache_entry *nand_cache_find(struct nand_page_cache *cache, rt_off_t page)
+{
+    rt_size_t i = 0;
+
+    for (i = 0; i < RT_NAND_PAGE_CACHE_NUM; i++)
+    {
+        if (cache->entry[i].flag && cache->entry[i].page == page)
+        {
+            return &cache->entry[i];
+        }
+    }
+
+    return RT_NULL;
+}
+
+/* get a free entry, or the least recently used one */
+static struct nand_page_cache_entry *nand_cache_victim(struct nand_page_cache *cache)
+{
+    rt_size_t i = 0;
+    struct nand_page_cache_entry *victim = &cache->entry[0];
+
+    for (i = 0; i < RT_NAND_PAGE_CACHE_NUM; i++)
+    {
+        if (cache->entry[i].flag == 0)
+        {
+            return &cache->entry[i];
+        }
+        if ((rt_int32_t)(cache->entry[i].age - victim->age) < 0)
+        {
+            victim = &cache->entry[i];
+        }
+    }
+
+    victim->flag = 0;
+    return victim;
+}
+
+void nand_cache_invalidate(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t page_count)
+{
+    rt_size_t i = 0;
+    struct nand_page_cache *cache = NAND_CACHE_GET(device);
+
+    if (cache == RT_NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < RT_NAND_PAGE_CACHE_NUM; i++)
+    {
+        if (cache->entry[i].page >= page && cache->entry[i].page < page + page_count)
+        {
+            cache->entry[i].flag = 0;
+        }
+    }
+}
+
+rt_err_t nand_cache_read_page(struct rt_mtd_nand_device *device,
+                              rt_off_t page,
+                              rt_uint8_t *data,
+                              rt_uint32_t data_len,
+                              rt_uint8_t *spare,
+                              rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint8_t need = 0;
+    struct nand_page_cache_entry *entry = RT_NULL;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    struct nand_page_cache *cache = nand_dev->cache;
+    const nand_spi *spi = &nand_dev->spi;
+
+    if (cache == RT_NULL)
+    {
+        return _read_page(device, page, data, data_len, spare, spare_len);
+    }
+
+    if (data != RT_NULL && data_len != 0)
+    {
+        need |= NAND_CACHE_DATA_VALID;
+    }
+    if (spare != RT_NULL && spare_len != 0)
+    {
+        need |= NAND_CACHE_SPARE_VALID;
+    }
+    if (need == 0)
+    {
+        return RT_EOK;
+    }
+
+    nand_dev->spi.lock(spi);
+
+    entry = nand_cache_find(cache, page);
+    if (entry != RT_NULL && (entry->flag & need) == need)
+    {
+        cache->hit++;
+    }
+    else
+    {
+        cache->miss++;
+        if (entry == RT_NULL)
+        {
+            entry = nand_cache_victim(cache);
+            entry->page = page;
+        }
+
+        /* fill the whole missing part, the next access may ask for more */
+        need &= ~entry->flag;
+        result = _read_page(device, page,
+                            (need & NAND_CACHE_DATA_VALID) ? entry->data : RT_NULL, device->page_size,
+                            (need & NAND_CACHE_SPARE_VALID) ? entry->data + device->page_size : RT_NULL,
+                            device->oob_size);
+        if (result == -RT_MTD_EECC)
+        {
+            /* hand the raw data to the caller, but never serve it from the cache */
+            entry->flag = 0;
+        }
+        else if (result != RT_EOK && result != -RT_MTD_EECC_CORRECT)
+        {
+            entry->flag = 0;
+            goto __exit;
+        }
+        else
+        {
+            /* a corrected page holds good data */
+            entry->flag |= need;
+        }
+    }
+
+    entry->age = ++cache->stamp;
+
+    if (data != RT_NULL && data_len != 0)
+    {
+        rt_memcpy(data, entry->data, data_len);
+    }
+    if (spare != RT_NULL && spare_len != 0)
+    {
+        rt_memcpy(spare, entry->data + device->page_size, spare_len);
+    }
+
+__exit:
+    nand_dev->spi.unlock(spi);
+
+    return result;
+}
+
+rt_err_t nand_cache_write_page(struct rt_mtd_nand_device *device,
+                               rt_off_t page,
+                               const rt_uint8_t *data,
+                               rt_uint32_t data_len,
+                               const rt_uint8_t *spare,
+                               rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    nand_dev->spi.lock(spi);
+    result = _write_page(device, page, data, data_len, spare, spare_len);
+    nand_cache_invalidate(device, page, 1);
+    nand_dev->spi.unlock(spi);
+
+    return result;
+}
+
+rt_err_t nand_cache_erase_block(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    rt_err_t result = RT_EOK;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    const nand_spi *spi = &nand_dev->spi;
+
+    nand_dev->spi.lock(spi);
+    result = _erase_block(device, block);
+    nand_cache_invalidate(device, block * device->pages_per_block, device->pages_per_block);
+    nand_dev->spi.unlock(spi);
+
+    return result;
+}
+
+/*
+ * spi_nand_cache_stat: get the page cache hit and miss counters.
+ */
+void spi_nand_cache_stat(struct rt_mtd_nand_device *device, rt_uint32_t *hit, rt_uint32_t *miss)
+{
+    struct nand_page_cache *cache = NAND_CACHE_GET(device);
+
+    if (hit)
+    {
+        *hit = cache ? cache->hit : 0;
+    }
+    if (miss)
+    {
+        *miss = cache ? cache->miss : 0;
+    }
+}
@@ -0,0 +1,936 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-12-02     yangjie      the first version
+ */
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include "drv_mtd_nand.h"
+
+#define DBG_TAG     "drv_nand_ecc"
+#define DBG_LVL     DBG_LOG
+#include <rtdbg.h>
+
+/*
+ * Software ECC for the chips running with the on-die ECC off. The page main
+ * area is protected in 512 byte sectors, the parity of all the sectors is
+ * kept at the end of the spare and device->oob_free is cut to the bytes in
+ * front of it. Strength 1 is a Hamming code (3 bytes per sector), 4 and 8
+ * are binary BCH codes over GF(2^13) (7 and 13 bytes per sector).
+ * The last sector of a short write is encoded as programmed, with the bytes
+ * after the data left 0xff. A sector with at most strength zero bits in its
+ * data and parity is erased, the bitflips are cleared back to 0xff.
+ */
+
+/* the host build works on 64 bit words */
+#if defined(__x86_64__) || defined(__aarch64__) || (defined(__riscv) && (__riscv_xlen == 64))
+typedef rt_uint64_t nand_ecc_word_t;
+#define NAND_ECC_WORD_SHIFT         3
+#else
+typedef rt_uint32_t nand_ecc_word_t;
+#define NAND_ECC_WORD_SHIFT         2
+#endif
+
+/* GF(2^13), x^13 + x^4 + x^3 + x + 1 */
+#define NAND_BCH_M                  13
+#define NAND_BCH_PRIM_POLY          0x201b
+
+struct nand_bch
+{
+    rt_uint32_t n;                  /* 2^m - 1 */
+    rt_uint32_t t;                  /* correctable bits */
+    rt_uint32_t ecc_bits;           /* generator polynomial degree */
+    rt_uint32_t ecc_words;          /* remainder register words */
+    rt_uint16_t *a_pow;             /* alpha^i */
+    rt_uint16_t *a_log;             /* i of alpha^i */
+    rt_uint32_t *mod_tab;           /* [4][256][ecc_words], (v * x^(ecc_bits + 8k)) mod g */
+    rt_uint32_t *reg;               /* remainder register, x^(ecc_bits-1) in the MSB of reg[0] */
+    rt_uint16_t *syn;               /* 2t syndromes */
+    rt_uint16_t *elp;               /* error locator polynomial, 2t + 1 terms */
+    rt_uint16_t *elp_b;
+    rt_uint16_t *elp_tmp;
+    rt_uint32_t *err_pos;           /* t error positions */
+};
+
+static rt_uint8_t nand_byte_parity[256];
+static rt_uint8_t nand_byte_bit_xor[256];
+static rt_uint8_t nand_byte_zeros[256];
+
+static void nand_ecc_tables_init(void)
+{
+    rt_uint32_t i = 0, b = 0;
+
+    for (i = 0; i < 256; i++)
+    {
+        nand_byte_parity[i] = 0;
+        nand_byte_bit_xor[i] = 0;
+        nand_byte_zeros[i] = 0;
+        for (b = 0; b < 8; b++)
+        {
+            if (i & (1 << b))
+            {
+                nand_byte_parity[i] ^= 1;
+                nand_byte_bit_xor[i] ^= b;
+            }
+            else
+            {
+                nand_byte_zeros[i]++;
+            }
+        }
+    }
+}
+
+/*
+ * Hamming code, the bit address is byte index * 8 + bit. X is the xor of
+ * the addresses of all the set bits, P their parity. The 24 parity bits
+ * are X and X ^ (P ? 0xfff : 0), a flipped data bit changes all 12 pairs,
+ * a flipped parity bit only one.
+ */
+static rt_uint32_t nand_hamming_calc(const rt_uint8_t *data)
+{
+    rt_uint32_t i = 0, j = 0;
+    rt_uint32_t row = 0, x = 0;
+    rt_uint8_t fold = 0;
+    union
+    {
+        nand_ecc_word_t w;
+        rt_uint8_t b[sizeof(nand_ecc_word_t)];
+    } acc;
+
+    if (((rt_ubase_t)data & (sizeof(nand_ecc_word_t) - 1)) == 0)
+    {
+        const nand_ecc_word_t *word = (const nand_ecc_word_t *)data;
+        nand_ecc_word_t v;
+
+        acc.w = 0;
+        for (i = 0; i < NAND_ECC_SECTOR_SIZE / sizeof(nand_ecc_word_t); i++)
+        {
+            v = word[i];
+            acc.w ^= v;
+            /* fold the word parity into the low byte */
+            for (j = sizeof(nand_ecc_word_t) * 4; j >= 8; j >>= 1)
+            {
+                v ^= v >> j;
+            }
+            if (nand_byte_parity[v & 0xff])
+            {
+                row ^= i;
+            }
+        }
+
+        /* the byte lane part of the byte index, and the bit part */
+        x = row << (3 + NAND_ECC_WORD_SHIFT);
+        for (j = 0; j < sizeof(nand_ecc_word_t); j++)
+        {
+            if (nand_byte_parity[acc.b[j]])
+            {
+                x ^= j << 3;
+            }
+            fold ^= acc.b[j];
+        }
+    }
+    else
+    {
+        for (i = 0; i < NAND_ECC_SECTOR_SIZE; i++)
+        {
+            if (nand_byte_parity[data[i]])
+            {
+                row ^= i;
+            }
+            fold ^= data[i];
+        }
+        x = row << 3;
+    }
+
+    x ^= nand_byte_bit_xor[fold];
+
+    return x | (nand_byte_parity[fold] << 12);
+}
+
+static void nand_hamming_encode(const rt_uint8_t *data, rt_uint8_t *parity)
+{
+    rt_uint32_t calc = nand_hamming_calc(data);
+    rt_uint32_t x = calc & 0xfff;
+    rt_uint32_t xp = x ^ ((calc & 0x1000) ? 0xfff : 0);
+
+    parity[0] = x & 0xff;
+    parity[1] = ((x >> 8) & 0x0f) | ((xp & 0x0f) << 4);
+    parity[2] = (xp >> 4) & 0xff;
+}
+
+static int nand_hamming_correct(rt_uint8_t *data, const rt_uint8_t *parity)
+{
+    rt_uint8_t calc[3];
+    rt_uint32_t d1, d0, bits = 0, v;
+
+    nand_hamming_encode(data, calc);
+
+    d1 = (calc[0] ^ parity[0]) | (((calc[1] ^ parity[1]) & 0x0f) << 8);
+    d0 = (((calc[1] ^ parity[1]) >> 4) & 0x0f) | ((calc[2] ^ parity[2]) << 4);
+
+    if ((d1 | d0) == 0)
+    {
+        return 0;
+    }
+
+    /* one data bit, d1 is its address */
+    if ((d1 ^ d0) == 0xfff)
+    {
+        data[d1 >> 3] ^= 1 << (d1 & 0x7);
+        return 1;
+    }
+
+    /* one parity bit */
+    for (v = d1 | (d0 << 12); v; v &= v - 1)
+    {
+        bits++;
+    }
+
+    return bits == 1 ? 1 : -1;
+}
+
+static rt_uint16_t nand_gf_mul(struct nand_bch *bch, rt_uint16_t a, rt_uint16_t b)
+{
+    if (a == 0 || b == 0)
+    {
+        return 0;
+    }
+
+    return bch->a_pow[(bch->a_log[a] + bch->a_log[b]) % bch->n];
+}
+
+static rt_uint16_t nand_gf_div(struct nand_bch *bch, rt_uint16_t a, rt_uint16_t b)
+{
+    if (a == 0)
+    {
+        return 0;
+    }
+
+    return bch->a_pow[(bch->a_log[a] + bch->n - bch->a_log[b]) % bch->n];
+}
+
+static void nand_bch_shift(rt_uint32_t *reg, rt_uint32_t words, rt_uint32_t bits)
+{
+    rt_uint32_t i = 0;
+
+    for (i = 0; i < words; i++)
+    {
+        reg[i] = (reg[i] << bits) | ((i + 1 < words) ? (reg[i + 1] >> (32 - bits)) : 0);
+    }
+}
+
+/*
+ * nand_bch_remainder: bch->reg = (data * x^ecc_bits) mod g, 32 data bits per
+ * step, the top word of the register and the data word index four tables.
+ */
+static void nand_bch_remainder(struct nand_bch *bch, const rt_uint8_t *data, rt_uint32_t len)
+{
+    rt_uint32_t i = 0, w = 0;
+    rt_uint32_t u = 0;
+    rt_uint32_t words = bch->ecc_words;
+    rt_uint32_t *reg = bch->reg;
+    const rt_uint32_t *t0, *t1, *t2, *t3;
+
+    rt_memset(reg, 0, words * sizeof(rt_uint32_t));
+
+    for (i = 0; i < len; i += 4)
+    {
+        u = reg[0] ^ (((rt_uint32_t)data[i] << 24) | ((rt_uint32_t)data[i + 1] << 16)
+                      | ((rt_uint32_t)data[i + 2] << 8) | data[i + 3]);
+
+        t0 = bch->mod_tab + (0 * 256 + (u & 0xff)) * words;
+        t1 = bch->mod_tab + (1 * 256 + ((u >> 8) & 0xff)) * words;
+        t2 = bch->mod_tab + (2 * 256 + ((u >> 16) & 0xff)) * words;
+        t3 = bch->mod_tab + (3 * 256 + (u >> 24)) * words;
+
+        for (w = 0; w < words; w++)
+        {
+            reg[w] = ((w + 1 < words) ? reg[w + 1] : 0) ^ t0[w] ^ t1[w] ^ t2[w] ^ t3[w];
+        }
+    }
+}
+
+static void nand_bch_encode(struct nand_bch *bch, const rt_uint8_t *data, rt_uint8_t *parity)
+{
+    rt_uint32_t i = 0;
+
+    nand_bch_remainder(bch, data, NAND_ECC_SECTOR_SIZE);
+
+    for (i = 0; i < (bch->ecc_bits + 7) / 8; i++)
+    {
+        parity[i] = (bch->reg[i >> 2] >> (24 - 8 * (i & 0x3))) & 0xff;
+    }
+}
+
+/* Berlekamp-Massey, return the error locator degree */
+static rt_uint32_t nand_bch_elp(struct nand_bch *bch)
+{
+    rt_uint32_t r = 0, i = 0;
+    rt_uint32_t len = 0, m = 1;
+    rt_uint32_t terms = 2 * bch->t + 1;
+    rt_uint16_t d = 0, b = 1, coef = 0;
+
+    rt_memset(bch->elp, 0, terms * sizeof(rt_uint16_t));
+    rt_memset(bch->elp_b, 0, terms * sizeof(rt_uint16_t));
+    bch->elp[0] = 1;
+    bch->elp_b[0] = 1;
+
+    for (r = 0; r < 2 * bch->t; r++)
+    {
+        d = bch->syn[r];
+        for (i = 1; i <= len; i++)
+        {
+            d ^= nand_gf_mul(bch, bch->elp[i], bch->syn[r - i]);
+        }
+        if (d == 0)
+        {
+            m++;
+            continue;
+        }
+
+        coef = nand_gf_div(bch, d, b);
+        rt_memcpy(bch->elp_tmp, bch->elp, terms * sizeof(rt_uint16_t));
+        for (i = 0; i + m < terms; i++)
+        {
+            bch->elp[i + m] ^= nand_gf_mul(bch, coef, bch->elp_b[i]);
+        }
+
+        if (2 * len <= r)
+        {
+            len = r + 1 - len;
+            rt_memcpy(bch->elp_b, bch->elp_tmp, terms * sizeof(rt_uint16_t));
+            b = d;
+            m = 1;
+        }
+        else
+        {
+            m++;
+        }
+    }
+
+    return len;
+}
+
+static int nand_bch_correct(struct nand_bch *bch, rt_uint8_t *data, const rt_uint8_t *parity)
+{
+    rt_uint32_t i = 0, j = 0, k = 0;
+    rt_uint32_t bytes = (bch->ecc_bits + 7) / 8;
+    rt_uint32_t bits = NAND_ECC_SECTOR_SIZE * 8 + bch->ecc_bits;
+    rt_uint32_t len = 0, found = 0, pos = 0;
+    rt_uint32_t zero = 0;
+    rt_uint16_t sum = 0;
+    rt_uint8_t p = 0;
+
+    nand_bch_remainder(bch, data, NAND_ECC_SECTOR_SIZE);
+
+    /* the remainder of the read codeword, the pad bits of the last byte are dropped */
+    for (i = 0; i < bytes; i++)
+    {
+        p = parity[i];
+        if (i == bytes - 1)
+        {
+            p &= (0xff << (bytes * 8 - bch->ecc_bits)) & 0xff;
+        }
+        bch->reg[i >> 2] ^= (rt_uint32_t)p << (24 - 8 * (i & 0x3));
+    }
+
+    for (i = 0; i < bch->ecc_words; i++)
+    {
+        zero |= bch->reg[i];
+    }
+    if (zero == 0)
+    {
+        return 0;
+    }
+
+    /* S(j) = R(alpha^j), the even ones are squares */
+    rt_memset(bch->syn, 0, 2 * bch->t * sizeof(rt_uint16_t));
+    for (i = 0; i < bch->ecc_bits; i++)
+    {
+        if (bch->reg[i >> 5] & (0x80000000UL >> (i & 0x1f)))
+        {
+            k = bch->ecc_bits - 1 - i;
+            for (j = 1; j < 2 * bch->t; j += 2)
+            {
+                bch->syn[j - 1] ^= bch->a_pow[(j * k) % bch->n];
+            }
+        }
+    }
+    for (j = 2; j <= 2 * bch->t; j += 2)
+    {
+        bch->syn[j - 1] = nand_gf_mul(bch, bch->syn[j / 2 - 1], bch->syn[j / 2 - 1]);
+    }
+
+    len = nand_bch_elp(bch);
+    if (len == 0 || len > bch->t)
+    {
+        return -1;
+    }
+
+    /*
+     * Chien search, an error at x^k makes alpha^-k a root. elp_tmp[i] is the
+     * log of the term i at alpha^-k, it goes down by i at each step.
+     */
+    for (i = 1; i <= len; i++)
+    {
+        bch->elp_tmp[i] = bch->elp[i] ? bch->a_log[bch->elp[i]] : 0xffff;
+    }
+    for (k = 0; k < bits && found < len; k++)
+    {
+        sum = bch->elp[0];
+        for (i = 1; i <= len; i++)
+        {
+            if (bch->elp_tmp[i] != 0xffff)
+            {
+                sum ^= bch->a_pow[bch->elp_tmp[i]];
+                bch->elp_tmp[i] = (bch->elp_tmp[i] >= i) ? bch->elp_tmp[i] - i : bch->elp_tmp[i] + bch->n - i;
+            }
+        }
+        if (sum == 0)
+        {
+            bch->err_pos[found++] = k;
+        }
+    }
+    if (found != len)
+    {
+        return -1;
+    }
+
+    /* the errors in the parity need no fix */
+    for (i = 0; i < found; i++)
+    {
+        if (bch->err_pos[i] >= bch->ecc_bits)
+        {
+            pos = NAND_ECC_SECTOR_SIZE * 8 - 1 - (bch->err_pos[i] - bch->ecc_bits);
+            data[pos >> 3] ^= 0x80 >> (pos & 0x7);
+        }
+    }
+
+    return found;
+}
+
+static void nand_bch_delete(struct nand_bch *bch)
+{
+    rt_free(bch->a_pow);
+    rt_free(bch->a_log);
+    rt_free(bch->mod_tab);
+    rt_free(bch->reg);
+    rt_free(bch->syn);
+    rt_free(bch->elp);
+    rt_free(bch->elp_b);
+    rt_free(bch->elp_tmp);
+    rt_free(bch->err_pos);
+    rt_free(bch);
+}
+
+static struct nand_bch *nand_bch_create(rt_uint32_t t)
+{
+    struct nand_bch *bch = RT_NULL;
+    rt_uint16_t *gen = RT_NULL;
+    rt_uint8_t *roots = RT_NULL;
+    rt_uint32_t *gen_reg = RT_NULL;
+    rt_uint32_t i = 0, k = 0, r = 0, v = 0, w = 0;
+    rt_uint32_t deg = 0, words = 0, fb = 0, top = 0;
+    rt_uint32_t *reg;
+
+    bch = (struct nand_bch *)rt_calloc(1, sizeof(struct nand_bch));
+    if (bch == RT_NULL)
+    {
+        return RT_NULL;
+    }
+    bch->n = (1 << NAND_BCH_M) - 1;
+    bch->t = t;
+
+    bch->a_pow = (rt_uint16_t *)rt_malloc((bch->n + 1) * sizeof(rt_uint16_t));
+    bch->a_log = (rt_uint16_t *)rt_malloc((bch->n + 1) * sizeof(rt_uint16_t));
+    gen = (rt_uint16_t *)rt_calloc(NAND_BCH_M * t + 1, sizeof(rt_uint16_t));
+    roots = (rt_uint8_t *)rt_calloc((bch->n + 7) / 8, 1);
+    if (bch->a_pow == RT_NULL || bch->a_log == RT_NULL || gen == RT_NULL || roots == RT_NULL)
+    {
+        goto __error;
+    }
+
+    for (i = 0, v = 1; i < bch->n; i++)
+    {
+        bch->a_pow[i] = v;
+        bch->a_log[v] = i;
+        v <<= 1;
+        if (v & (1 << NAND_BCH_M))
+        {
+            v ^= NAND_BCH_PRIM_POLY;
+        }
+    }
+    bch->a_pow[bch->n] = 1;
+    bch->a_log[0] = 0;
+
+    /* g(x) is the product of (x + alpha^r) over the conjugates of alpha^1, alpha^3 .. alpha^(2t-1) */
+    gen[0] = 1;
+    for (i = 1; i < 2 * t; i += 2)
+    {
+        r = i;
+        do
+        {
+            if (!(roots[r >> 3] & (1 << (r & 0x7))))
+            {
+                roots[r >> 3] |= 1 << (r & 0x7);
+                for (k = deg + 1; k > 0; k--)
+                {
+                    gen[k] = gen[k - 1] ^ nand_gf_mul(bch, gen[k], bch->a_pow[r]);
+                }
+                gen[0] = nand_gf_mul(bch, gen[0], bch->a_pow[r]);
+                deg++;
+            }
+            r = (r * 2) % bch->n;
+        }
+        while (r != i);
+    }
+    RT_ASSERT(deg >= 32);
+
+    bch->ecc_bits = deg;
+    bch->ecc_words = words = (deg + 31) / 32;
+
+    bch->mod_tab = (rt_uint32_t *)rt_calloc(4 * 256 * words, sizeof(rt_uint32_t));
+    bch->reg = (rt_uint32_t *)rt_malloc(words * sizeof(rt_uint32_t));
+    bch->syn = (rt_uint16_t *)rt_malloc(2 * t * sizeof(rt_uint16_t));
+    bch->elp = (rt_uint16_t *)rt_malloc((2 * t + 1) * sizeof(rt_uint16_t));
+    bch->elp_b = (rt_uint16_t *)rt_malloc((2 * t + 1) * sizeof(rt_uint16_t));
+    bch->elp_tmp = (rt_uint16_t *)rt_malloc((2 * t + 1) * sizeof(rt_uint16_t));
+    bch->err_pos = (rt_uint32_t *)rt_malloc(t * sizeof(rt_uint32_t));
+    gen_reg = (rt_uint32_t *)rt_calloc(words, sizeof(rt_uint32_t));
+    if (bch->mod_tab == RT_NULL || bch->reg == RT_NULL || bch->syn == RT_NULL || bch->elp == RT_NULL
+            || bch->elp_b == RT_NULL || bch->elp_tmp == RT_NULL || bch->err_pos == RT_NULL || gen_reg == RT_NULL)
+    {
+        goto __error;
+    }
+
+    /* g(x) without x^deg, in the register layout */
+    for (k = 0; k < deg; k++)
+    {
+        if (gen[k])
+        {
+            i = deg - 1 - k;
+            gen_reg[i >> 5] |= 0x80000000UL >> (i & 0x1f);
+        }
+    }
+
+    /* table 0 by the bit serial LFSR, table k is table k-1 times x^8 */
+    for (v = 0; v < 256; v++)
+    {
+        reg = bch->mod_tab + v * words;
+        for (i = 0; i < 8; i++)
+        {
+            fb = (reg[0] >> 31) ^ ((v >> (7 - i)) & 0x1);
+            nand_bch_shift(reg, words, 1);
+            if (fb)
+            {
+                for (w = 0; w < words; w++)
+                {
+                    reg[w] ^= gen_reg[w];
+                }
+            }
+        }
+    }
+    for (k = 1; k < 4; k++)
+    {
+        for (v = 0; v < 256; v++)
+        {
+            reg = bch->mod_tab + (k * 256 + v) * words;
+            rt_memcpy(reg, bch->mod_tab + ((k - 1) * 256 + v) * words, words * sizeof(rt_uint32_t));
+            top = reg[0] >> 24;
+            nand_bch_shift(reg, words, 8);
+            for (w = 0; w < words; w++)
+            {
+                reg[w] ^= bch->mod_tab[top * words + w];
+            }
+        }
+    }
+
+    rt_free(gen_reg);
+    rt_free(roots);
+    rt_free(gen);
+
+    return bch;
+
+__error:
+    rt_free(gen_reg);
+    rt_free(roots);
+    rt_free(gen);
+    nand_bch_delete(bch);
+
+    return RT_NULL;
+}
+
+/**
+ * nand_ecc_create: create an ECC engine.
+ *
+ * @param strength correctable bits per 512 byte sector, 1 (Hamming), 4 or 8 (BCH)
+ *
+ * @return the engine, RT_NULL on error
+ */
+struct nand_ecc *nand_ecc_create(rt_uint8_t strength)
+{
+    struct nand_ecc *ecc = RT_NULL;
+
+    if (strength != 1 && strength != 4 && strength != 8)
+    {
+        LOG_E("ECC strength %d is not supported.", strength);
+        return RT_NULL;
+    }
+
+    ecc = (struct nand_ecc *)rt_calloc(1, sizeof(struct nand_ecc));
+    if (ecc == RT_NULL)
+    {
+        return RT_NULL;
+    }
+    ecc->strength = strength;
+
+    nand_ecc_tables_init();
+
+    if (strength == 1)
+    {
+        ecc->bytes = 3;
+    }
+    else
+    {
+        ecc->bch = nand_bch_create(strength);
+        if (ecc->bch == RT_NULL)
+        {
+            rt_free(ecc);
+            return RT_NULL;
+        }
+        ecc->bytes = (ecc->bch->ecc_bits + 7) / 8;
+    }
+
+    return ecc;
+}
+
+void nand_ecc_delete(struct nand_ecc *ecc)
+{
+    if (ecc == RT_NULL)
+    {
+        return;
+    }
+
+    if (ecc->bch)
+    {
+        nand_bch_delete(ecc->bch);
+    }
+    rt_free(ecc->oob_buf);
+    rt_free(ecc->data_buf);
+    rt_free(ecc);
+}
+
+/* nand_ecc_encode: compute the ecc->bytes parity of one sector */
+void nand_ecc_encode(struct nand_ecc *ecc, const rt_uint8_t *data, rt_uint8_t *parity)
+{
+    if (ecc->bch)
+    {
+        nand_bch_encode(ecc->bch, data, parity);
+    }
+    else
+    {
+        nand_hamming_encode(data, parity);
+    }
+}
+
+/*
+ * nand_ecc_correct: check one sector and fix it in place, return the
+ * corrected bits, or -1 if it is uncorrectable.
+ */
+int nand_ecc_correct(struct nand_ecc *ecc, rt_uint8_t *data, const rt_uint8_t *parity)
+{
+    if (ecc->bch)
+    {
+        return nand_bch_correct(ecc->bch, data, parity);
+    }
+
+    return nand_hamming_correct(data, parity);
+}
+
+/*
+ * nand_ecc_init: run the device with the software ECC, the parity layout
+ * must leave the bad block marker bytes in the spare.
+ */
+rt_err_t nand_ecc_init(struct rt_mtd_nand_device *device)
+{
+    struct nand_ecc *ecc = RT_NULL;
+    rt_uint32_t parity_size;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    ecc = nand_ecc_create(RT_NAND_SW_ECC_STRENGTH);
+    if (ecc == RT_NULL)
+    {
+        return -RT_ENOMEM;
+    }
+
+    parity_size = (device->page_size / NAND_ECC_SECTOR_SIZE) * ecc->bytes;
+    if (parity_size + 2 > device->oob_size)
+    {
+        LOG_E("ECC parity %d bytes doesn't fit the %d bytes spare.", parity_size, device->oob_size);
+        nand_ecc_delete(ecc);
+        return -RT_ERROR;
+    }
+
+    ecc->oob_buf = (rt_uint8_t *)rt_malloc(device->oob_size);
+    ecc->data_buf = (rt_uint8_t *)rt_malloc(device->page_size);
+    if (ecc->oob_buf == RT_NULL || ecc->data_buf == RT_NULL)
+    {
+        nand_ecc_delete(ecc);
+        return -RT_ENOMEM;
+    }
+
+    device->oob_free = device->oob_size - parity_size;
+    nand_dev->ecc = ecc;
+
+    LOG_I("Nand flash software ECC %d bit per %d bytes, %d parity bytes per page.", ecc->strength,
+          NAND_ECC_SECTOR_SIZE, parity_size);
+
+    return RT_EOK;
+}
+
+/*
+ * nand_ecc_page_encode: write the parity of the sectors in data to the end
+ * of oob, oob holds device->oob_size bytes. The last sector is padded with
+ * 0xff, the bytes the chip leaves unprogrammed.
+ */
+void nand_ecc_page_encode(struct rt_mtd_nand_device *device, const rt_uint8_t *data, rt_uint32_t data_len,
+                          rt_uint8_t *oob)
+{
+    rt_uint32_t i = 0, len = 0;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    struct nand_ecc *ecc = nand_dev->ecc;
+
+    for (i = 0; i * NAND_ECC_SECTOR_SIZE < data_len; i++)
+    {
+        len = data_len - i * NAND_ECC_SECTOR_SIZE;
+        if (len < NAND_ECC_SECTOR_SIZE)
+        {
+            rt_memcpy(ecc->data_buf, data + i * NAND_ECC_SECTOR_SIZE, len);
+            rt_memset(ecc->data_buf + len, 0xff, NAND_ECC_SECTOR_SIZE - len);
+            nand_ecc_encode(ecc, ecc->data_buf, oob + device->oob_free + i * ecc->bytes);
+            break;
+        }
+        nand_ecc_encode(ecc, data + i * NAND_ECC_SECTOR_SIZE, oob + device->oob_free + i * ecc->bytes);
+    }
+}
+
+/*
+ * nand_ecc_check_erased: a sector with at most strength zero bits in its
+ * data and parity is erased, set it to 0xff and return the bitflips, or -1
+ * if it is not erased.
+ */
+static int nand_ecc_check_erased(struct nand_ecc *ecc, rt_uint8_t *data, const rt_uint8_t *parity)
+{
+    rt_uint32_t i = 0, zeros = 0;
+
+    for (i = 0; i < ecc->bytes && zeros <= ecc->strength; i++)
+    {
+        zeros += nand_byte_zeros[parity[i]];
+    }
+    for (i = 0; i < NAND_ECC_SECTOR_SIZE && zeros <= ecc->strength; i++)
+    {
+        zeros += nand_byte_zeros[data[i]];
+    }
+    if (zeros > ecc->strength)
+    {
+        return -1;
+    }
+
+    if (zeros > 0)
+    {
+        rt_memset(data, 0xff, NAND_ECC_SECTOR_SIZE);
+    }
+
+    return zeros;
+}
+
+/*
+ * nand_ecc_page_correct: check and fix the whole sectors in data against the
+ * parity in oob, an erased sector with bitflips comes out all 0xff. Return
+ * RT_EOK, -RT_MTD_EECC_CORRECT or -RT_MTD_EECC.
+ */
+rt_err_t nand_ecc_page_correct(struct rt_mtd_nand_device *device, rt_uint8_t *data, rt_uint32_t data_len,
+                               const rt_uint8_t *oob)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint32_t i = 0;
+    const rt_uint8_t *parity;
+    int bits;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    struct nand_ecc *ecc = nand_dev->ecc;
+
+    for (i = 0; (i + 1) * NAND_ECC_SECTOR_SIZE <= data_len; i++)
+    {
+        parity = oob + device->oob_free + i * ecc->bytes;
+
+        /* an erased sector has no valid parity, it is checked before decoding */
+        bits = nand_ecc_check_erased(ecc, data + i * NAND_ECC_SECTOR_SIZE, parity);
+        if (bits < 0)
+        {
+            bits = nand_ecc_correct(ecc, data + i * NAND_ECC_SECTOR_SIZE, parity);
+        }
+        if (bits < 0)
+        {
+            result = -RT_MTD_EECC;
+            nand_dev->bitflips = NAND_BITFLIPS_UNCORRECTABLE;
+        }
+        else if (bits > 0)
+        {
+            if (result == RT_EOK)
+            {
+                result = -RT_MTD_EECC_CORRECT;
+            }
+            if (bits > nand_dev->bitflips)
+            {
+                nand_dev->bitflips = bits;
+            }
+        }
+    }
+
+    return result;
+}
+
+#ifdef RT_USING_FINSH
+#include <finsh.h>
+#include <stdlib.h>
+
+/* CPU clock for the bytes per cycle figure, 0 to only print bytes per second */
+#ifndef RT_NAND_ECC_BENCH_CPU_HZ
+#define RT_NAND_ECC_BENCH_CPU_HZ      0
+#endif
+
+#define NAND_ECC_BENCH_PAGE_SIZE      2048
+
+static void nand_ecc_bench_report(const char *name, rt_uint32_t loops, rt_tick_t ticks)
+{
+    rt_uint64_t bytes = (rt_uint64_t)loops * NAND_ECC_BENCH_PAGE_SIZE;
+    rt_uint64_t cycles;
+
+    if (ticks == 0)
+    {
+        ticks = 1;
+    }
+
+    rt_kprintf("%-8s %6d pages %6d ticks %8d KB/s", name, loops, ticks,
+               (rt_uint32_t)(bytes * RT_TICK_PER_SECOND / ticks / 1024));
+
+    if (RT_NAND_ECC_BENCH_CPU_HZ != 0)
+    {
+        cycles = (rt_uint64_t)ticks * (RT_NAND_ECC_BENCH_CPU_HZ / RT_TICK_PER_SECOND);
+        rt_kprintf(" %4d.%03d bytes/cycle %6d cycles/page", (rt_uint32_t)(bytes / cycles),
+                   (rt_uint32_t)(bytes * 1000 / cycles % 1000), (rt_uint32_t)(cycles / loops));
+    }
+    rt_kprintf("\n");
+}
+
+/*
+ * nand_ecc_bench: time the encode, the check of clean pages and the
+ * correction of strength bit errors per sector, over 2048 byte pages.
+ */
+static int nand_ecc_bench(int argc, char **argv)
+{
+    struct nand_ecc *ecc = RT_NULL;
+    rt_uint8_t *page = RT_NULL, *ref = RT_NULL, *parity = RT_NULL;
+    rt_uint32_t sectors = NAND_ECC_BENCH_PAGE_SIZE / NAND_ECC_SECTOR_SIZE;
+    rt_uint32_t strength = RT_NAND_SW_ECC_STRENGTH;
+    rt_uint32_t loops = 256;
+    rt_uint32_t i = 0, l = 0, s = 0, b = 0, pos = 0;
+    rt_uint32_t failed = 0;
+    rt_tick_t start;
+
+    if (argc > 1)
+    {
+        strength = atoi(argv[1]);
+    }
+    if (argc > 2)
+    {
+        loops = atoi(argv[2]);
+    }
+
+    ecc = nand_ecc_create(strength);
+    page = (rt_uint8_t *)rt_malloc(NAND_ECC_BENCH_PAGE_SIZE);
+    ref = (rt_uint8_t *)rt_malloc(NAND_ECC_BENCH_PAGE_SIZE);
+    parity = (rt_uint8_t *)rt_malloc(sectors * 13);
+    if (ecc == RT_NULL || page == RT_NULL || ref == RT_NULL || parity == RT_NULL || loops == 0)
+    {
+        rt_kprintf("usage: nand_ecc_bench [1|4|8] [loops], or no memory.\n");
+        goto __exit;
+    }
+
+    for (i = 0; i < NAND_ECC_BENCH_PAGE_SIZE; i++)
+    {
+        ref[i] = page[i] = rand() & 0xff;
+    }
+
+    rt_kprintf("ECC strength %d, %d parity bytes per %d bytes.\n", ecc->strength, ecc->bytes, NAND_ECC_SECTOR_SIZE);
+
+    start = rt_tick_get();
+    for (l = 0; l < loops; l++)
+    {
+        for (s = 0; s < sectors; s++)
+        {
+            nand_ecc_encode(ecc, page + s * NAND_ECC_SECTOR_SIZE, parity + s * ecc->bytes);
+        }
+    }
+    nand_ecc_bench_report("encode", loops, rt_tick_get() - start);
+
+    start = rt_tick_get();
+    for (l = 0; l < loops; l++)
+    {
+        for (s = 0; s < sectors; s++)
+        {
+            if (nand_ecc_correct(ecc, page + s * NAND_ECC_SECTOR_SIZE, parity + s * ecc->bytes) != 0)
+            {
+                failed++;
+            }
+        }
+    }
+    nand_ecc_bench_report("check", loops, rt_tick_get() - start);
+
+    /* the flipped bits are fixed back by the decoder */
+    start = rt_tick_get();
+    for (l = 0; l < loops; l++)
+    {
+        for (s = 0; s < sectors; s++)
+        {
+            for (b = 0; b < ecc->strength; b++)
+            {
+                pos = (l * 7919 + s * 104729 + b * 613) % (NAND_ECC_SECTOR_SIZE * 8 / ecc->strength)
+                      + b * (NAND_ECC_SECTOR_SIZE * 8 / ecc->strength);
+                page[s * NAND_ECC_SECTOR_SIZE + (pos >> 3)] ^= 1 << (pos & 0x7);
+            }
+            if (nand_ecc_correct(ecc, page + s * NAND_ECC_SECTOR_SIZE, parity + s * ecc->bytes)
+                    != (int)ecc->strength)
+            {
+                failed++;
+            }
+        }
+    }
+    nand_ecc_bench_report("correct", loops, rt_tick_get() - start);
+
+    if (failed || rt_memcmp(page, ref, NAND_ECC_BENCH_PAGE_SIZE) != 0)
+    {
+        rt_kprintf("ECC self check failed, %d sectors.\n", failed);
+    }
+
+__exit:
+    rt_free(parity);
+    rt_free(ref);
+    rt_free(page);
+    nand_ecc_delete(ecc);
+
+    return 0;
+}
+MSH_CMD_EXPORT(nand_ecc_bench, software ECC throughput: nand_ecc_bench [1|4|8] [loops]);
+#endif /* RT_USING_FINSH */
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-12-02     yangjie      the first version
+ */
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include "drv_mtd_nand.h"
+
+#define DBG_TAG     "drv_nand_pool"
+#define DBG_LVL     DBG_LOG
+#include <rtdbg.h>
+
+/*
+ * Pre-erase pool. The upper layer gives back the blocks it doesn't use any
+ * more by spi_nand_block_release, a low priority thread erases them while
+ * the bus is idle and keeps up to RT_NAND_ERASE_POOL_SIZE erased blocks.
+ * spi_nand_block_alloc takes an erased block, so a write to a fresh block
+ * doesn't wait tBERS. Only when the pool is empty a free block is erased in
+ * the caller thread.
+ */
+
+#define NAND_POOL_GET(device)                                                                   \
+    (((nand_flash_t)(rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device)->user_data))->pool)
+
+/* take the next free block to erase, the pool should be locked */
+static rt_bool_t nand_pool_take_dirty(struct nand_erase_pool *pool, rt_uint32_t block_num, rt_uint32_t *block)
+{
+    rt_uint32_t i = 0;
+    rt_uint32_t b = 0;
+
+    if (pool->dirty_num == 0)
+    {
+        return RT_FALSE;
+    }
+
+    for (i = 0; i < block_num; i++)
+    {
+        b = (pool->dirty_cursor + i) % block_num;
+        if (pool->dirty_map[b >> 3] & (1 << (b & 0x7)))
+        {
+            pool->dirty_map[b >> 3] &= ~(1 << (b & 0x7));
+            pool->dirty_num--;
+            pool->dirty_cursor = b + 1;
+            *block = b;
+            return RT_TRUE;
+        }
+    }
+
+    return RT_FALSE;
+}
+
+static void nand_pool_put_dirty(struct nand_erase_pool *pool, rt_uint32_t block)
+{
+    if (!(pool->dirty_map[block >> 3] & (1 << (block & 0x7))))
+    {
+        pool->dirty_map[block >> 3] |= 1 << (block & 0x7);
+        pool->dirty_num++;
+    }
+}
+
+/* take the oldest erased block, the pool should be locked */
+static rt_bool_t nand_pool_take_ready(struct nand_erase_pool *pool, rt_uint32_t *block)
+{
+    if (pool->ready_num == 0)
+    {
+        return RT_FALSE;
+    }
+
+    *block = pool->ready[pool->ready_head];
+    pool->ready_head = (pool->ready_head + 1) % RT_NAND_ERASE_POOL_SIZE;
+    pool->ready_num--;
+
+    return RT_TRUE;
+}
+
+static void nand_pool_put_ready(struct nand_erase_pool *pool, rt_uint32_t block)
+{
+    RT_ASSERT(pool->ready_num < RT_NAND_ERASE_POOL_SIZE);
+
+    pool->ready[(pool->ready_head + pool->ready_num) % RT_NAND_ERASE_POOL_SIZE] = block;
+    pool->ready_num++;
+}
+
+/*
+ * nand_pool_erase: erase a free block unless it is still blank, a bad block
+ * is dropped and a block failing the erase is marked bad.
+ */
+static rt_err_t nand_pool_erase(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    if (device->ops->check_block(device, block) != RT_EOK)
+    {
+        return -RT_ERROR;
+    }
+
+    if (spi_nand_block_is_blank(device, block))
+    {
+        return RT_EOK;
+    }
+
+    if (device->ops->erase_block(device, block) != RT_EOK)
+    {
+        LOG_W("erase block %d failed, mark it bad.", block);
+        device->ops->mark_badblock(device, block);
+        return -RT_ERROR;
+    }
+
+    return RT_EOK;
+}
+
+static void nand_pool_thread_entry(void *parameter)
+{
+    struct rt_mtd_nand_device *device = (struct rt_mtd_nand_device *)parameter;
+    struct nand_erase_pool *pool = NAND_POOL_GET(device);
+    rt_uint32_t block_num = device->block_end - device->block_start;
+    rt_uint32_t block = 0;
+    rt_bool_t found;
+
+    while (1)
+    {
+        rt_sem_take(&pool->sem, RT_WAITING_FOREVER);
+
+        while (1)
+        {
+            rt_mutex_take(&pool->lock, RT_WAITING_FOREVER);
+            found = (pool->ready_num < RT_NAND_ERASE_POOL_SIZE) && nand_pool_take_dirty(pool, block_num, &block);
+            rt_mutex_release(&pool->lock);
+
+            if (!found)
+            {
+                break;
+            }
+
+            if (nand_pool_erase(device, block) != RT_EOK)
+            {
+                continue;
+            }
+
+            rt_mutex_take(&pool->lock, RT_WAITING_FOREVER);
+            /* the pool may be filled by spi_nand_block_release meanwhile */
+            if (pool->ready_num < RT_NAND_ERASE_POOL_SIZE)
+            {
+                nand_pool_put_ready(pool, block);
+            }
+            else
+            {
+                nand_pool_put_dirty(pool, block);
+            }
+            rt_mutex_release(&pool->lock);
+        }
+    }
+}
+
+rt_err_t nand_erase_pool_init(struct rt_mtd_nand_device *device)
+{
+    struct nand_erase_pool *pool = RT_NULL;
+    rt_uint32_t map_size = (device->block_end - device->block_start + 7) / 8;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    pool = (struct nand_erase_pool *)rt_malloc(sizeof(struct nand_erase_pool));
+    if (pool == RT_NULL)
+    {
+        return -RT_ENOMEM;
+    }
+    rt_memset(pool, 0, sizeof(struct nand_erase_pool));
+
+    pool->dirty_map = (rt_uint8_t *)rt_malloc(map_size);
+    if (pool->dirty_map == RT_NULL)
+    {
+        rt_free(pool);
+        return -RT_ENOMEM;
+    }
+    rt_memset(pool->dirty_map, 0, map_size);
+
+    rt_mutex_init(&pool->lock, "npool", RT_IPC_FLAG_FIFO);
+    rt_sem_init(&pool->sem, "npool", 0, RT_IPC_FLAG_FIFO);
+    pool->thread = rt_thread_create("npool", nand_pool_thread_entry, device,
+                                    RT_NAND_ERASE_POOL_THREAD_STACK_SIZE, RT_NAND_ERASE_POOL_THREAD_PRIORITY, 10);
+    if (pool->thread == RT_NULL)
+    {
+        rt_sem_detach(&pool->sem);
+        rt_mutex_detach(&pool->lock);
+        rt_free(pool->dirty_map);
+        rt_free(pool);
+        return -RT_ENOMEM;
+    }
+
+    nand_dev->pool = pool;
+    rt_thread_startup(pool->thread);
+
+    return RT_EOK;
+}
+
+/* nand_erase_pool_deinit: stop the erase thread, the device is not registered */
+void nand_erase_pool_deinit(struct rt_mtd_nand_device *device)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    struct nand_erase_pool *pool = nand_dev->pool;
+
+    if (pool == RT_NULL)
+    {
+        return;
+    }
+
+    rt_thread_delete(pool->thread);
+    rt_sem_detach(&pool->sem);
+    rt_mutex_detach(&pool->lock);
+    rt_free(pool->dirty_map);
+    rt_free(pool);
+    nand_dev->pool = RT_NULL;
+}
+
+/**
+ * spi_nand_block_release: give back a block the upper layer doesn't use any
+ * more, it is erased in the background. The block must not be written
+ * until it is allocated again.
+ *
+ * @param device the nand device
+ * @param block the free block
+ *
+ * @return RT_EOK on success
+ */
+rt_err_t spi_nand_block_release(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    struct nand_erase_pool *pool = NAND_POOL_GET(device);
+
+    if (pool == RT_NULL)
+    {
+        return -RT_ENOSYS;
+    }
+    if (block >= device->block_end - device->block_start)
+    {
+        return -RT_EINVAL;
+    }
+
+    rt_mutex_take(&pool->lock, RT_WAITING_FOREVER);
+    nand_pool_put_dirty(pool, block);
+    rt_mutex_release(&pool->lock);
+
+    rt_sem_release(&pool->sem);
+
+    return RT_EOK;
+}
+
+/**
+ * spi_nand_block_alloc: take an erased block from the pool. If the pool is
+ * empty a released block is erased in the caller thread.
+ *
+ * @param device the nand device
+ * @param block the erased block
+ *
+ * @return RT_EOK on success, -RT_EEMPTY if no free block is left
+ */
+rt_err_t spi_nand_block_alloc(struct rt_mtd_nand_device *device, rt_uint32_t *block)
+{
+    struct nand_erase_pool *pool = NAND_POOL_GET(device);
+    rt_uint32_t block_num = device->block_end - device->block_start;
+    rt_bool_t found;
+
+    RT_ASSERT(block != RT_NULL);
+
+    if (pool == RT_NULL)
+    {
+        return -RT_ENOSYS;
+    }
+
+    rt_mutex_take(&pool->lock, RT_WAITING_FOREVER);
+    found = nand_pool_take_ready(pool, block);
+    rt_mutex_release(&pool->lock);
+
+    /* the pool is drained faster than it is filled, pay the erase here */
+    while (!found)
+    {
+        rt_mutex_take(&pool->lock, RT_WAITING_FOREVER);
+        found = nand_pool_take_dirty(pool, block_num, block);
+        rt_mutex_release(&pool->lock);
+
+        if (!found)
+        {
+            return -RT_EEMPTY;
+        }
+        if (nand_pool_erase(device, *block) != RT_EOK)
+        {
+            found = RT_FALSE;
+        }
+    }
+
+    /* refill the pool */
+    rt_sem_release(&pool->sem);
+
+    return RT_EOK;
+}
+
+/* spi_nand_pool_ready: the erased blocks ready in the pool */
+rt_uint32_t spi_nand_pool_ready(struct rt_mtd_nand_device *device)
+{
+    struct nand_erase_pool *pool = NAND_POOL_GET(device);
+
+    return pool ? pool->ready_num : 0;
+}
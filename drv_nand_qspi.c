@@ -9,6 +9,7 @@
  */
 
 #include <rtdevice.h>
+#include <rthw.h>
 #include <spi_flash.h>
 #include "drv_mtd_nand.h"
 
@@ -18,6 +19,7 @@
 
 #ifndef RT_NAND_DEFAULT_SPI_CFG
 
+/* board max SPI clock, lowered to the chip max clock at probe */
 #ifndef RT_NAND_SPI_MAX_HZ
     #define RT_NAND_SPI_MAX_HZ 50000000
 #endif
@@ -30,6 +32,16 @@
 }
 #endif /* RT_NAND_DEFAULT_SPI_CFG */
 
+/* min busy status poll interval, in microseconds */
+#ifndef RT_NAND_BUSY_POLL_US
+    #define RT_NAND_BUSY_POLL_US 10
+#endif
+
+/* busy status timeout, in milliseconds, should be longer than the chip max tBERS */
+#ifndef RT_NAND_BUSY_TIMEOUT_MS
+    #define RT_NAND_BUSY_TIMEOUT_MS 100
+#endif
+
 
 
 #ifdef NAND_USING_QSPI
@@ -43,18 +55,80 @@
 }
 
 
-//TODO : qspi_wr modify
+/*
+ * Read from Cache command format. The column address is always 2 bytes, the
+ * dummy cycles are counted in clocks after the column address.
+ */
 static void qspi_set_cmd_format(nand_flash *flash, rt_uint8_t ins, rt_uint8_t ins_lines, rt_uint8_t addr_lines,
                                 rt_uint8_t dummy_cycles, rt_uint8_t data_lines)
 {
-
+    flash->qspi_cmd_format.instruction = ins;
+    flash->qspi_cmd_format.instruction_lines = ins_lines;
+    flash->qspi_cmd_format.address_size = 16;
+    flash->qspi_cmd_format.address_lines = addr_lines;
+    flash->qspi_cmd_format.alternate_bytes_lines = 0;
+    flash->qspi_cmd_format.dummy_cycles = dummy_cycles;
+    flash->qspi_cmd_format.data_lines = data_lines;
 }
 
-//TODO : qspi_wr modify
-static rt_err_t nand_qspi_fast_read_enable(nand_flash *flash, rt_uint8_t data_line_width)
+/*
+ * Select the fastest Read from Cache command supported by both the chip and
+ * the QSPI bus data line width, called by rt_hw_nand_init once the chip is
+ * identified, before the device is registered.
+ */
+rt_err_t nand_qspi_fast_read_enable(nand_flash *flash, rt_uint8_t data_line_width)
 {
+    rt_uint8_t read_mode = NORMAL_SPI_READ;
     rt_err_t result = RT_EOK;
 
+    RT_ASSERT(flash);
+    RT_ASSERT(data_line_width == 1 || data_line_width == 2 || data_line_width == 4);
+
+    /* get read_mode from the chip descriptor, the default is NORMAL_SPI_READ */
+    if (flash->chip_info.read_mode != 0)
+    {
+        read_mode = flash->chip_info.read_mode;
+    }
+
+    /* determine qspi supports which read mode and set qspi_cmd_format struct */
+    switch (data_line_width)
+    {
+    case 1:
+        qspi_set_cmd_format(flash, NAND_READ_FROM_CACHE, 1, 1, 8, 1);
+        break;
+    case 2:
+        if (read_mode & DUAL_IO)
+        {
+            qspi_set_cmd_format(flash, NAND_DUAL_IO_READ, 1, 2, 4, 2);
+        }
+        else if (read_mode & DUAL_OUTPUT)
+        {
+            qspi_set_cmd_format(flash, NAND_DUAL_READ, 1, 1, 8, 2);
+        }
+        else
+        {
+            qspi_set_cmd_format(flash, NAND_READ_FROM_CACHE, 1, 1, 8, 1);
+        }
+        break;
+    case 4:
+        if (read_mode & QUAD_IO)
+        {
+            qspi_set_cmd_format(flash, NAND_QUAD_IO_READ, 1, 4, 4, 4);
+        }
+        else if (read_mode & QUAD_OUTPUT)
+        {
+            qspi_set_cmd_format(flash, NAND_QUAD_READ, 1, 1, 8, 4);
+        }
+        else
+        {
+            qspi_set_cmd_format(flash, NAND_READ_FROM_CACHE, 1, 1, 8, 1);
+        }
+        break;
+    }
+
+    LOG_I("Nand flash read from cache cmd 0x%02x, %d data lines.", flash->qspi_cmd_format.instruction,
+          flash->qspi_cmd_format.data_lines);
+
     return result;
 }
 #endif /* NAND_USING_QSPI */
@@ -125,8 +199,53 @@ static rt_err_t spi_write_read(const nand_spi *spi,
     return result;
 }
 
+static rt_err_t spi_xfer(const nand_spi *spi, const nand_spi_xfer *xfer, rt_size_t count)
+{
+    rt_size_t i = 0;
+    struct rt_spi_message message[NAND_SPI_XFER_MAX];
+    nand_flash_t nand_dev = (nand_flash_t)(spi->user_data);
+    struct spi_nand_flash_mtd *rtt_dev = (struct spi_nand_flash_mtd *)(nand_dev->user_data);
+
+    RT_ASSERT(spi);
+    RT_ASSERT(nand_dev);
+    RT_ASSERT(rtt_dev);
+    RT_ASSERT(xfer);
+    RT_ASSERT(count > 0 && count <= NAND_SPI_XFER_MAX);
+
+#ifdef NAND_USING_QSPI
+    /* the QSPI controller drives chip select per command, it can't chain segments */
+    if (rtt_dev->rt_spi_device->bus->mode & RT_SPI_BUS_MODE_QSPI)
+    {
+        return -RT_ENOSYS;
+    }
+#endif
+
+    /* one message chain for the whole command sequence, one bus take */
+    for (i = 0; i < count; i++)
+    {
+        message[i].send_buf = xfer[i].send_buf;
+        message[i].recv_buf = xfer[i].recv_buf;
+        message[i].length = xfer[i].length;
+        message[i].cs_take = (i == 0 || xfer[i - 1].cs_change);
+        message[i].cs_release = (i == count - 1 || xfer[i].cs_change);
+        message[i].next = (i == count - 1) ? RT_NULL : &message[i + 1];
+    }
+
+    /* the failed message is returned, RT_NULL means all done */
+    if (rt_spi_transfer_message(rtt_dev->rt_spi_device, &message[0]) != RT_NULL)
+    {
+        return -RT_ETIMEOUT;
+    }
+
+    return RT_EOK;
+}
+
 #ifdef NAND_USING_QSPI
-//TODO : qspi_wr modify
+/*
+ * qspi_read_write: send one QSPI command with the instruction, address and dummy
+ * phases described by qspi_cmd_format, then write (program load) or read (read
+ * from cache) the data phase on qspi_cmd_format->data_lines lines.
+ */
 static rt_err_t qspi_read_write(const nand_spi *spi,
                                 rt_uint32_t addr,
                                 nand_qspi_cmd_format *qspi_cmd_format,
@@ -136,16 +255,60 @@ static rt_err_t qspi_read_write(const nand_spi *spi,
                                 rt_size_t read_size)
 {
     rt_err_t result = RT_EOK;
+    struct rt_qspi_message message;
+    nand_flash_t nand_dev = (nand_flash_t)(spi->user_data);
+    struct spi_nand_flash_mtd *rtt_dev = (struct spi_nand_flash_mtd *)(nand_dev->user_data);
+    struct rt_qspi_device *qspi_dev = (struct rt_qspi_device *)(rtt_dev->rt_spi_device);
 
-    return result;
+    RT_ASSERT(spi);
+    RT_ASSERT(nand_dev);
+    RT_ASSERT(rtt_dev);
+    RT_ASSERT(qspi_cmd_format);
+    /* the data phase is one direction only */
+    RT_ASSERT(!(write_size && read_size));
+    if (write_size)
+    {
+        RT_ASSERT(write_buf);
+    }
+    if (read_size)
+    {
+        RT_ASSERT(read_buf);
+    }
+
+    /* set message struct */
+    message.instruction.content = qspi_cmd_format->instruction;
+    message.instruction.qspi_lines = qspi_cmd_format->instruction_lines;
+
+    message.address.content = addr;
+    message.address.size = qspi_cmd_format->address_size;
+    message.address.qspi_lines = qspi_cmd_format->address_lines;
+
+    message.alternate_bytes.content = 0;
+    message.alternate_bytes.size = 0;
+    message.alternate_bytes.qspi_lines = 0;
+
+    message.dummy_cycles = qspi_cmd_format->dummy_cycles;
+
+    message.parent.send_buf = write_buf;
+    message.parent.recv_buf = read_buf;
+    message.parent.length = write_size ? write_size : read_size;
+    message.parent.next = RT_NULL;
+    message.parent.cs_take = 1;
+    message.parent.cs_release = 1;
+    message.qspi_data_lines = qspi_cmd_format->data_lines;
+
+    if (rt_qspi_transfer_message(qspi_dev, &message) != message.parent.length)
+    {
+        result = -RT_ETIMEOUT;
+    }
 
+    return result;
 }
 #endif
 
-
 static void spi_lock(const nand_spi *spi)
 {
-    nand_spi *nand_dev = (nand_spi *)(spi->user_data);
+    nand_flash *nand_dev = (nand_flash *)(spi->user_data);
     struct spi_nand_flash_mtd *rtt_dev = (struct spi_nand_flash_mtd *)(nand_dev->user_data);
 
     RT_ASSERT(spi);
@@ -167,12 +330,6 @@ static void spi_unlock(const nand_spi *spi)
     rt_mutex_release(&(rtt_dev->lock));
 }
 
-static void retry_delay_100us(void)
-{
-    /* 100 microsecond delay */
-    rt_thread_delay((RT_TICK_PER_SECOND * 1 + 9999) / 10000);
-}
-
 rt_err_t _spi_nand_bus_init(nand_flash_t flash)
 {
     rt_err_t result = RT_EOK;
@@ -181,20 +338,21 @@ rt_err_t _spi_nand_bus_init(nand_flash_t flash)
 
     /* port SPI device interface */
     flash->spi.wr = spi_write_read;
+    flash->spi.xfer = spi_xfer;
 #ifdef NAND_USING_QSPI
     flash->spi.qspi_wr = qspi_read_write;
 #endif
     flash->spi.lock = spi_lock;
     flash->spi.unlock = spi_unlock;
     flash->spi.user_data = flash;
-    if (RT_TICK_PER_SECOND < 1000)
-    {
-        rt_kprintf("[SNFUD] Warning: The OS tick(%d) is less than 1000. So the flash write will take more time.\n", RT_TICK_PER_SECOND);
-    }
-    /* 100 microsecond delay */
-    flash->retry.delay = retry_delay_100us;
-    /* 60 seconds timeout */
-    flash->retry.times = 60 * 10000;
+#ifdef NAND_USING_QSPI
+    /* use normal read until the chip is identified */
+    qspi_set_cmd_format(flash, NAND_READ_FROM_CACHE, 1, 1, 8, 1);
+#endif
+    /* RT_NAND_BUSY_POLL_US microsecond min poll interval */
+    flash->retry.interval = RT_NAND_BUSY_POLL_US;
+    /* RT_NAND_BUSY_TIMEOUT_MS milliseconds timeout */
+    flash->retry.timeout = rt_tick_from_millisecond(RT_NAND_BUSY_TIMEOUT_MS);
 
     return result;
 }
@@ -221,7 +379,7 @@ rt_spi_nand_flash_device_t rt_spi_nand_probe_ex(const char *spi_nand_dev_name, c
 
     if (rtt_dev)
     {
-        rt_memset(rtt_dev, 0, sizeof(struct spi_flash_device));
+        rt_memset(rtt_dev, 0, sizeof(struct spi_nand_flash_mtd));
         /* initialize lock */
         rt_mutex_init(&(rtt_dev->lock), spi_nand_dev_name, RT_IPC_FLAG_FIFO);
     }
@@ -273,7 +431,6 @@ rt_spi_nand_flash_device_t rt_spi_nand_probe_ex(const char *spi_nand_dev_name, c
             }
 
 #ifdef NAND_USING_QSPI
-            //TODO : qspi config
             /* reconfigure the QSPI bus for medium size */
             if (rtt_dev->rt_spi_device->bus->mode & RT_SPI_BUS_MODE_QSPI)
             {
@@ -283,8 +440,6 @@ rt_spi_nand_flash_device_t rt_spi_nand_probe_ex(const char *spi_nand_dev_name, c
                 {
                     qspi_dev->enter_qspi_mode(qspi_dev);
                 }
-                /* set data lines width */
-                nand_qspi_fast_read_enable(nand_dev, qspi_dev->config.qspi_dl_width);
             }
 #endif /* NAND_USING_QSPI */
         }
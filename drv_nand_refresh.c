@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-12-02     yangjie      the first version
+ */
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include "drv_mtd_nand.h"
+
+#define DBG_TAG     "drv_nand_refresh"
+#define DBG_LVL     DBG_LOG
+#include <rtdbg.h>
+
+/*
+ * Read disturb and bitflip driven refresh. Every page read charges one read
+ * and the corrected bits reported by the ECC to its block. A block read
+ * more than read_limit times since its erase, or with a sector at
+ * bitflip_limit corrected bits, is queued to a low priority thread which
+ * refreshes it before it turns uncorrectable.
+ * The refresh is done by the handler of the upper layer, which knows where
+ * the data can go. The driver has no logical mapping to move a block by
+ * itself, without a handler the blocks stay queued until one is set.
+ */
+
+#define NAND_REFRESH_GET(device)                                                                \
+    (((nand_flash_t)(rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device)->user_data))->refresh)
+
+#define NAND_REFRESH_LOCK(device)                                                               \
+    rt_mutex_take(&rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device)->lock, RT_WAITING_FOREVER)
+#define NAND_REFRESH_UNLOCK(device)                                                             \
+    rt_mutex_release(&rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device)->lock)
+
+/* take the next pending block, the device should be locked */
+static rt_bool_t nand_refresh_take(struct nand_refresh *refresh, rt_uint32_t block_num, rt_uint32_t *block)
+{
+    rt_uint32_t b = 0;
+
+    if (refresh->pending_num == 0)
+    {
+        return RT_FALSE;
+    }
+
+    for (b = 0; b < block_num; b++)
+    {
+        if (refresh->pending[b >> 3] & (1 << (b & 0x7)))
+        {
+            refresh->pending[b >> 3] &= ~(1 << (b & 0x7));
+            refresh->pending_num--;
+            *block = b;
+            return RT_TRUE;
+        }
+    }
+
+    return RT_FALSE;
+}
+
+static void nand_refresh_thread_entry(void *parameter)
+{
+    struct rt_mtd_nand_device *device = (struct rt_mtd_nand_device *)parameter;
+    struct nand_refresh *refresh = NAND_REFRESH_GET(device);
+    rt_uint32_t block_num = device->block_end - device->block_start;
+    rt_uint32_t block = 0;
+    rt_err_t result = RT_EOK;
+    nand_refresh_handler_t handler = RT_NULL;
+    void *handler_parameter = RT_NULL;
+    rt_bool_t found;
+
+    while (1)
+    {
+        rt_sem_take(&refresh->sem, RT_WAITING_FOREVER);
+
+        while (1)
+        {
+            /* without a handler the blocks stay queued, spi_nand_refresh_set_handler wakes the thread */
+            NAND_REFRESH_LOCK(device);
+            handler = refresh->handler;
+            handler_parameter = refresh->parameter;
+            found = handler != RT_NULL && nand_refresh_take(refresh, block_num, &block);
+            NAND_REFRESH_UNLOCK(device);
+
+            if (!found)
+            {
+                break;
+            }
+
+            LOG_I("refresh block %d, %d reads, %d bitflips.", block, refresh->reads[block], refresh->bitflips[block]);
+
+            result = handler(device, block, handler_parameter);
+
+            if (result == RT_EOK)
+            {
+                refresh->refreshed++;
+            }
+            else
+            {
+                refresh->failed++;
+                LOG_W("refresh block %d failed(%d).", block, result);
+
+                /* the reads of the refresh queued it again, retry when it crosses a limit again */
+                NAND_REFRESH_LOCK(device);
+                nand_refresh_erased(device, block);
+                NAND_REFRESH_UNLOCK(device);
+            }
+        }
+    }
+}
+
+rt_err_t nand_refresh_init(struct rt_mtd_nand_device *device)
+{
+    struct nand_refresh *refresh = RT_NULL;
+    rt_uint32_t block_num = device->block_end - device->block_start;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    refresh = (struct nand_refresh *)rt_malloc(sizeof(struct nand_refresh));
+    if (refresh == RT_NULL)
+    {
+        return -RT_ENOMEM;
+    }
+    rt_memset(refresh, 0, sizeof(struct nand_refresh));
+
+    refresh->reads = (rt_uint32_t *)rt_malloc(block_num * sizeof(rt_uint32_t));
+    refresh->bitflips = (rt_uint8_t *)rt_malloc(block_num);
+    refresh->pending = (rt_uint8_t *)rt_malloc((block_num + 7) / 8);
+    if (refresh->reads == RT_NULL || refresh->bitflips == RT_NULL || refresh->pending == RT_NULL)
+    {
+        goto __error;
+    }
+    rt_memset(refresh->reads, 0, block_num * sizeof(rt_uint32_t));
+    rt_memset(refresh->bitflips, 0, block_num);
+    rt_memset(refresh->pending, 0, (block_num + 7) / 8);
+
+    refresh->read_limit = RT_NAND_REFRESH_READS;
+    refresh->bitflip_limit = RT_NAND_REFRESH_BITFLIPS;
+
+    rt_sem_init(&refresh->sem, "nrefresh", 0, RT_IPC_FLAG_FIFO);
+    refresh->thread = rt_thread_create("nrefresh", nand_refresh_thread_entry, device,
+                                       RT_NAND_REFRESH_THREAD_STACK_SIZE, RT_NAND_REFRESH_THREAD_PRIORITY, 10);
+    if (refresh->thread == RT_NULL)
+    {
+        rt_sem_detach(&refresh->sem);
+        goto __error;
+    }
+
+    nand_dev->refresh = refresh;
+    rt_thread_startup(refresh->thread);
+
+    return RT_EOK;
+
+__error:
+    rt_free(refresh->reads);
+    rt_free(refresh->bitflips);
+    rt_free(refresh->pending);
+    rt_free(refresh);
+
+    return -RT_ENOMEM;
+}
+
+/* nand_refresh_deinit: stop the refresh thread, the device is not registered */
+void nand_refresh_deinit(struct rt_mtd_nand_device *device)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    struct nand_refresh *refresh = nand_dev->refresh;
+
+    if (refresh == RT_NULL)
+    {
+        return;
+    }
+
+    rt_thread_delete(refresh->thread);
+    rt_sem_detach(&refresh->sem);
+    rt_free(refresh->reads);
+    rt_free(refresh->bitflips);
+    rt_free(refresh->pending);
+    rt_free(refresh);
+    nand_dev->refresh = RT_NULL;
+}
+
+/*
+ * nand_refresh_account: charge one read with bitflips corrected bits to the
+ * block, called by the read path with the device locked.
+ */
+void nand_refresh_account(struct rt_mtd_nand_device *device, rt_uint32_t block, rt_uint8_t bitflips)
+{
+    struct nand_refresh *refresh = NAND_REFRESH_GET(device);
+
+    if (refresh == RT_NULL || block >= device->block_end - device->block_start)
+    {
+        return;
+    }
+
+    if (refresh->reads[block] != 0xffffffff)
+    {
+        refresh->reads[block]++;
+    }
+    if (bitflips > refresh->bitflips[block])
+    {
+        refresh->bitflips[block] = bitflips;
+    }
+
+    if ((refresh->reads[block] >= refresh->read_limit || refresh->bitflips[block] >= refresh->bitflip_limit)
+            && !(refresh->pending[block >> 3] & (1 << (block & 0x7))))
+    {
+        refresh->pending[block >> 3] |= 1 << (block & 0x7);
+        refresh->pending_num++;
+        rt_sem_release(&refresh->sem);
+    }
+}
+
+/* nand_refresh_erased: the block is erased, clear its counters */
+void nand_refresh_erased(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    struct nand_refresh *refresh = NAND_REFRESH_GET(device);
+
+    if (refresh == RT_NULL || block >= device->block_end - device->block_start)
+    {
+        return;
+    }
+
+    refresh->reads[block] = 0;
+    refresh->bitflips[block] = 0;
+    if (refresh->pending[block >> 3] & (1 << (block & 0x7)))
+    {
+        refresh->pending[block >> 3] &= ~(1 << (block & 0x7));
+        refresh->pending_num--;
+    }
+}
+
+/**
+ * spi_nand_refresh_config: set the refresh thresholds, 0 keeps the current one.
+ *
+ * @param device the nand device
+ * @param read_limit reads of a block since its erase that trigger a refresh
+ * @param bitflip_limit corrected bits in one sector that trigger a refresh
+ */
+void spi_nand_refresh_config(struct rt_mtd_nand_device *device, rt_uint32_t read_limit, rt_uint8_t bitflip_limit)
+{
+    struct nand_refresh *refresh = NAND_REFRESH_GET(device);
+
+    if (refresh == RT_NULL)
+    {
+        return;
+    }
+
+    NAND_REFRESH_LOCK(device);
+    if (read_limit != 0)
+    {
+        refresh->read_limit = read_limit;
+    }
+    if (bitflip_limit != 0)
+    {
+        refresh->bitflip_limit = bitflip_limit;
+    }
+    NAND_REFRESH_UNLOCK(device);
+}
+
+/**
+ * spi_nand_refresh_set_handler: let the upper layer relocate the blocks to
+ * refresh. The handler runs in the refresh thread, the block counters are
+ * cleared when it is erased. The blocks queued so far are refreshed once the
+ * handler is set.
+ *
+ * @param device the nand device
+ * @param handler the refresh handler, RT_NULL to only queue the blocks
+ * @param parameter the handler parameter
+ */
+void spi_nand_refresh_set_handler(struct rt_mtd_nand_device *device, nand_refresh_handler_t handler, void *parameter)
+{
+    struct nand_refresh *refresh = NAND_REFRESH_GET(device);
+
+    if (refresh == RT_NULL)
+    {
+        return;
+    }
+
+    NAND_REFRESH_LOCK(device);
+    refresh->handler = handler;
+    refresh->parameter = parameter;
+    if (handler != RT_NULL && refresh->pending_num != 0)
+    {
+        rt_sem_release(&refresh->sem);
+    }
+    NAND_REFRESH_UNLOCK(device);
+}
+
+/**
+ * spi_nand_block_stat: the reads and the worst corrected bits per sector of
+ * the block since its last erase.
+ *
+ * @return RT_EOK on success
+ */
+rt_err_t spi_nand_block_stat(struct rt_mtd_nand_device *device, rt_uint32_t block, rt_uint32_t *reads,
+                             rt_uint8_t *bitflips)
+{
+    struct nand_refresh *refresh = NAND_REFRESH_GET(device);
+
+    if (refresh == RT_NULL)
+    {
+        return -RT_ENOSYS;
+    }
+    if (block >= device->block_end - device->block_start)
+    {
+        return -RT_EINVAL;
+    }
+
+    if (reads != RT_NULL)
+    {
+        *reads = refresh->reads[block];
+    }
+    if (bitflips != RT_NULL)
+    {
+        *bitflips = refresh->bitflips[block];
+    }
+
+    return RT_EOK;
+}
@@ -0,0 +1,1169 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-12-02     yangjie      the first version
+ */
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include <rthw.h>
+#include <stdio.h>
+#include "drv_mtd_nand.h"
+
+#define DBG_TAG     "drv_nand_sim"
+#define DBG_LVL     DBG_LOG
+#include <rtdbg.h>
+
+/*
+ * Simulated SPI NAND chip. It implements the nand_spi interface, so the
+ * whole driver runs without a board, on the RT-Thread simulator BSP for
+ * example. The chip is any entry of SPI_NAND_FLASH_CHIP_INFO, the commands
+ * are decoded as the driver sends them:
+ *   - the cache register, and the data register of the cache read
+ *   - the protection, configuration and status registers of each die
+ *   - the block protection, the BP field protects a doubling range of
+ *     blocks at the top, or at the bottom with TB set
+ *   - the write enable latch and the P-FAIL/E-FAIL status bits of each die
+ *   - the NOP limit of partial page programs
+ *   - program clears bits, erase sets the block to 0xff
+ *   - injected bitflips, the on-chip ECC corrects RT_NAND_SIM_ECC_BITS of
+ *     a page and reports the ECC status
+ *   - the array is busy tR/tPROG/tBERS, the bus transfer takes the time of
+ *     the bytes at bus_hz
+ * The array is kept in RAM, or in a file which keeps it between runs.
+ */
+
+/* 64-bit microsecond clock of the simulation, the host monotonic clock by default */
+#ifndef RT_NAND_SIM_TIME_US
+#include <time.h>
+
+static rt_uint64_t nand_sim_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (rt_uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#define RT_NAND_SIM_TIME_US()         nand_sim_time_us()
+#endif
+
+#define NAND_SIM_GET(spi)             (((nand_flash_t)((spi)->user_data))->sim)
+
+/* the longest command header, op address and dummy */
+#define NAND_SIM_CMD_MAX              (8)
+
+static const nand_flash_chip_info nand_sim_chip_table[] = SPI_NAND_FLASH_CHIP_INFO;
+
+static void nand_sim_page_load(struct nand_sim *sim, rt_uint32_t page, rt_uint8_t *buf)
+{
+    if (sim->array != RT_NULL)
+    {
+        rt_memcpy(buf, sim->array + (rt_size_t)page * sim->page_bytes, sim->page_bytes);
+        return;
+    }
+
+    fseek((FILE *)sim->file, (long)page * sim->page_bytes, SEEK_SET);
+    if (fread(buf, 1, sim->page_bytes, (FILE *)sim->file) != sim->page_bytes)
+    {
+        rt_memset(buf, 0xff, sim->page_bytes);
+    }
+}
+
+static void nand_sim_page_store(struct nand_sim *sim, rt_uint32_t page, const rt_uint8_t *buf)
+{
+    if (sim->array != RT_NULL)
+    {
+        rt_memcpy(sim->array + (rt_size_t)page * sim->page_bytes, buf, sim->page_bytes);
+        return;
+    }
+
+    fseek((FILE *)sim->file, (long)page * sim->page_bytes, SEEK_SET);
+    fwrite(buf, 1, sim->page_bytes, (FILE *)sim->file);
+}
+
+static rt_bool_t nand_sim_busy(struct nand_sim_die *die, rt_uint64_t now)
+{
+    return die->busy_until > now ? RT_TRUE : RT_FALSE;
+}
+
+/* the array page of the die page, the page address wraps at the die end */
+static rt_uint32_t nand_sim_page(struct nand_sim *sim, rt_uint32_t page)
+{
+    return sim->die_sel * sim->die_pages + page % sim->die_pages;
+}
+
+/* the ECC status field value N, shifted to the field position */
+static rt_uint8_t nand_sim_ecc_field(struct nand_sim *sim, rt_uint8_t value)
+{
+    rt_uint8_t mask = sim->chip.ecc_status & 0xff;
+
+    return (value * (mask & (~mask + 1))) & mask;
+}
+
+/*
+ * nand_sim_sense: load an array page of the die to buf with its injected
+ * bitflips, return the ECC status bits of the page. The on-chip ECC outputs
+ * the page corrected, or raw if it has too many bitflips.
+ */
+static rt_uint8_t nand_sim_sense(struct nand_sim *sim, struct nand_sim_die *die, rt_uint32_t page, rt_uint8_t *buf)
+{
+    rt_uint32_t array_page = nand_sim_page(sim, page);
+    rt_uint32_t flips = 0;
+    rt_uint8_t value = 0;
+    rt_uint8_t i = 0;
+
+    nand_sim_page_load(sim, array_page, buf);
+    sim->stat.reads++;
+
+    for (i = 0; i < sim->flip_num; i++)
+    {
+        flips += sim->flip_page[i] == array_page ? 1 : 0;
+    }
+    if (flips == 0)
+    {
+        return 0;
+    }
+
+    if (!(die->sr2 & (sim->chip.ecc_bit & 0xff)) || flips > RT_NAND_SIM_ECC_BITS)
+    {
+        for (i = 0; i < sim->flip_num; i++)
+        {
+            if (sim->flip_page[i] == array_page)
+            {
+                buf[sim->flip_bit[i] >> 3] ^= 1 << (sim->flip_bit[i] & 0x7);
+            }
+        }
+    }
+    if (!(die->sr2 & (sim->chip.ecc_bit & 0xff)))
+    {
+        return 0;
+    }
+
+    /* the first status value of each kind */
+    if (flips > RT_NAND_SIM_ECC_BITS)
+    {
+        while (value < 7 && !(sim->chip.ecc_fail & (1 << value)))
+        {
+            value++;
+        }
+        sim->stat.ecc_fails++;
+    }
+    else
+    {
+        value = 1;
+        while (value < 7 && (sim->chip.ecc_fail & (1 << value)))
+        {
+            value++;
+        }
+        sim->stat.ecc_corrects++;
+    }
+
+    return nand_sim_ecc_field(sim, value);
+}
+
+/* the status register value with the live busy and WEL bits */
+static rt_uint8_t nand_sim_status(struct nand_sim *sim, struct nand_sim_die *die)
+{
+    rt_uint8_t busy_mask = sim->chip.busy_bit & 0xff;
+    rt_uint8_t sr = die->sr3 & ~(busy_mask | NAND_SR3_WEL_BIT_MASK);
+
+    if (nand_sim_busy(die, RT_NAND_SIM_TIME_US()))
+    {
+        sr |= busy_mask;
+    }
+    if (die->wel)
+    {
+        sr |= NAND_SR3_WEL_BIT_MASK;
+    }
+
+    return sr;
+}
+
+static rt_uint8_t nand_sim_get_feature(struct nand_sim *sim, struct nand_sim_die *die, rt_uint8_t sr_addr)
+{
+    switch (sr_addr)
+    {
+    case NAND_SR1_ADDR:
+        return die->sr1;
+    case NAND_SR2_ADDR:
+        return die->sr2;
+    case NAND_SR3_ADDR:
+        return nand_sim_status(sim, die);
+    default:
+        return 0;
+    }
+}
+
+/* the block of the die is in the range protected by the BP field */
+static rt_bool_t nand_sim_protected(struct nand_sim *sim, struct nand_sim_die *die, rt_uint32_t block)
+{
+    rt_uint8_t bp_mask = sim->chip.bp_bit & 0xff;
+    rt_uint8_t bp = die->sr1 & bp_mask;
+    rt_uint32_t range = sim->chip.blocks_per_die;
+
+    if (bp == 0)
+    {
+        return RT_FALSE;
+    }
+
+    /* right align the field, each step under the max halves the range */
+    while (!(bp_mask & 0x1))
+    {
+        bp_mask >>= 1;
+        bp >>= 1;
+    }
+    while (bp < bp_mask && range > 1)
+    {
+        range >>= 1;
+        bp++;
+    }
+
+    if (!((sim->chip.bp_bit & 0xff) & NAND_SR1_TB_BIT_MASK) && (die->sr1 & NAND_SR1_TB_BIT_MASK))
+    {
+        return block < range ? RT_TRUE : RT_FALSE;
+    }
+
+    return block >= sim->chip.blocks_per_die - range ? RT_TRUE : RT_FALSE;
+}
+
+static void nand_sim_program(struct nand_sim *sim, struct nand_sim_die *die, rt_uint32_t page, rt_uint64_t now)
+{
+    rt_uint32_t array_page = nand_sim_page(sim, page);
+    rt_uint32_t i = 0;
+
+    die->sr3 &= ~sim->chip.prog_fail;
+    if (!die->wel || nand_sim_protected(sim, die, (page % sim->die_pages) / sim->chip.pages_per_block)
+            || sim->nop[array_page] >= RT_NAND_SIM_NOP)
+    {
+        die->sr3 |= sim->chip.prog_fail;
+        sim->stat.prog_fails++;
+    }
+    else
+    {
+        /* a program only clears bits */
+        nand_sim_page_load(sim, array_page, sim->page_buf);
+        for (i = 0; i < sim->page_bytes; i++)
+        {
+            sim->page_buf[i] &= die->cache[i];
+        }
+        nand_sim_page_store(sim, array_page, sim->page_buf);
+        sim->nop[array_page]++;
+    }
+
+    sim->stat.programs++;
+    die->wel = RT_FALSE;
+    die->busy_until = now + sim->timing.prog_us;
+}
+
+static void nand_sim_erase(struct nand_sim *sim, struct nand_sim_die *die, rt_uint32_t page, rt_uint64_t now)
+{
+    rt_uint32_t block = (page % sim->die_pages) / sim->chip.pages_per_block;
+    rt_uint32_t first = nand_sim_page(sim, block * sim->chip.pages_per_block);
+    rt_uint32_t i = 0;
+
+    die->sr3 &= ~sim->chip.erase_fail;
+    if (!die->wel || nand_sim_protected(sim, die, block))
+    {
+        die->sr3 |= sim->chip.erase_fail;
+        sim->stat.erase_fails++;
+    }
+    else
+    {
+        rt_memset(sim->page_buf, 0xff, sim->page_bytes);
+        for (i = 0; i < sim->chip.pages_per_block; i++)
+        {
+            nand_sim_page_store(sim, first + i, sim->page_buf);
+            sim->nop[first + i] = 0;
+        }
+
+        /* the injected bitflips of the block are gone */
+        for (i = 0; i < sim->flip_num; )
+        {
+            if (sim->flip_page[i] >= first && sim->flip_page[i] < first + sim->chip.pages_per_block)
+            {
+                sim->flip_num--;
+                sim->flip_page[i] = sim->flip_page[sim->flip_num];
+                sim->flip_bit[i] = sim->flip_bit[sim->flip_num];
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+
+    sim->stat.erases++;
+    die->wel = RT_FALSE;
+    die->busy_until = now + sim->timing.erase_us;
+}
+
+/* Read from Cache, the Continuous Read mode streams the main area of the next pages */
+static void nand_sim_read_cache(struct nand_sim *sim, struct nand_sim_die *die, const rt_uint8_t *tx,
+                                rt_uint8_t *rx, rt_size_t rx_len)
+{
+    rt_uint32_t column = 0, len = 0;
+
+    if ((sim->chip.feature & NAND_FEATURE_CONT_READ) && !(die->sr2 & NAND_SR2_BUF_BIT_MASK))
+    {
+        while (rx_len > 0)
+        {
+            if (column == sim->chip.page_size)
+            {
+                die->data_page = (die->data_page + 1) % sim->die_pages;
+                die->sr3 = (die->sr3 & ~(sim->chip.ecc_status & 0xff))
+                           | nand_sim_sense(sim, die, die->data_page, die->cache);
+                column = 0;
+            }
+            len = sim->chip.page_size - column;
+            len = len < rx_len ? len : rx_len;
+            rt_memcpy(rx, die->cache + column, len);
+            rx += len;
+            rx_len -= len;
+            column += len;
+        }
+        return;
+    }
+
+    column = ((tx[1] << 8) | tx[2]) & 0x0fff;
+    len = column < sim->page_bytes ? sim->page_bytes - column : 0;
+    len = len < rx_len ? len : rx_len;
+    rt_memcpy(rx, die->cache + column, len);
+    rt_memset(rx + len, 0xff, rx_len - len);
+}
+
+/*
+ * nand_sim_transfer: run one chip select cycle, tx holds the command and the
+ * data sent, rx receives rx_len bytes after it.
+ */
+static void nand_sim_transfer(struct nand_sim *sim, const rt_uint8_t *tx, rt_size_t tx_len,
+                              rt_uint8_t *rx, rt_size_t rx_len)
+{
+    struct nand_sim_die *die = &sim->die[sim->die_sel];
+    rt_uint64_t now = RT_NAND_SIM_TIME_US(), start = 0;
+    rt_uint32_t page = 0, column = 0;
+    rt_uint8_t op = tx[0];
+    rt_size_t i = 0;
+
+    if (tx_len >= 4)
+    {
+        page = (tx[1] << 16) | (tx[2] << 8) | tx[3];
+    }
+
+    /* a busy die still takes the status read, the reset and the die select */
+    if (nand_sim_busy(die, now) && op != NAND_GET_FEATURE && op != NAND_RESET && op != NAND_DIE_SELECT)
+    {
+        sim->stat.busy_drops++;
+        if (rx != RT_NULL)
+        {
+            rt_memset(rx, 0xff, rx_len);
+        }
+        return;
+    }
+
+    switch (op)
+    {
+    case NAND_READ_ID:
+        rt_memset(rx, 0, rx_len);
+        for (i = 1; i < rx_len && i < 4; i++)
+        {
+            rx[i] = i == 1 ? sim->chip.mf_id : (i == 2 ? sim->chip.type_id : sim->chip.capacity_id);
+        }
+        break;
+
+    case NAND_GET_FEATURE:
+        /* the status byte is shifted out until CS goes high */
+        for (i = 0; i < rx_len; i++)
+        {
+            rx[i] = nand_sim_get_feature(sim, die, tx[1]);
+        }
+        break;
+
+    case NAND_SET_FEATURE:
+        if (tx[1] == NAND_SR1_ADDR)
+        {
+            die->sr1 = tx[2];
+        }
+        else if (tx[1] == NAND_SR2_ADDR)
+        {
+            die->sr2 = tx[2];
+        }
+        break;
+
+    case NAND_WRITE_ENABLE:
+        die->wel = RT_TRUE;
+        break;
+
+    case NAND_WRITE_DISABLE:
+        die->wel = RT_FALSE;
+        break;
+
+    case NAND_DIE_SELECT:
+        if (tx[1] < sim->chip.die_num)
+        {
+            sim->die_sel = tx[1];
+        }
+        break;
+
+    case NAND_RESET:
+        die->sr3 = 0;
+        die->wel = RT_FALSE;
+        die->busy_until = now + sim->timing.reset_max_us;
+        break;
+
+    case NAND_READ_PAGE_TO_CACHE:
+        die->data_page = page % sim->die_pages;
+        die->data_ecc = nand_sim_sense(sim, die, die->data_page, die->data);
+        rt_memcpy(die->cache, die->data, sim->page_bytes);
+        die->sr3 = (die->sr3 & ~(sim->chip.ecc_status & 0xff)) | die->data_ecc;
+        die->busy_until = now + sim->timing.read_us;
+        die->data_ready = die->busy_until;
+        break;
+
+    case NAND_CACHE_READ_RANDOM:
+    case NAND_CACHE_READ_SEQ:
+    case NAND_CACHE_READ_END:
+        if (!(sim->chip.feature & NAND_FEATURE_CACHE_READ))
+        {
+            break;
+        }
+        /* the data register moves to the cache once its load is done */
+        start = die->data_ready > now ? die->data_ready : now;
+        rt_memcpy(die->cache, die->data, sim->page_bytes);
+        die->sr3 = (die->sr3 & ~(sim->chip.ecc_status & 0xff)) | die->data_ecc;
+        die->busy_until = start;
+        if (op != NAND_CACHE_READ_END)
+        {
+            die->data_page = (op == NAND_CACHE_READ_RANDOM ? page : die->data_page + 1) % sim->die_pages;
+            die->data_ecc = nand_sim_sense(sim, die, die->data_page, die->data);
+            die->data_ready = start + sim->timing.read_us;
+        }
+        break;
+
+    case NAND_READ_FROM_CACHE:
+    case NAND_DUAL_READ:
+    case NAND_DUAL_IO_READ:
+    case NAND_QUAD_READ:
+    case NAND_QUAD_IO_READ:
+        if (tx_len >= 3)
+        {
+            nand_sim_read_cache(sim, die, tx, rx, rx_len);
+        }
+        break;
+
+    case NAND_WRITE:
+    case NAND_QUAD_WRITE:
+    case NAND_RANDOM_WRITE:
+    case NAND_QUAD_RANDOM_WRITE:
+        if (tx_len < 3)
+        {
+            break;
+        }
+        if (op == NAND_WRITE || op == NAND_QUAD_WRITE)
+        {
+            rt_memset(die->cache, 0xff, sim->page_bytes);
+        }
+        column = ((tx[1] << 8) | tx[2]) & 0x0fff;
+        for (i = 3; i < tx_len && column < sim->page_bytes; i++, column++)
+        {
+            die->cache[column] = tx[i];
+        }
+        break;
+
+    case NAND_WRITE_EXECUTE:
+        nand_sim_program(sim, die, page, now);
+        break;
+
+    case NAND_BLOCK_ERASE:
+        nand_sim_erase(sim, die, page, now);
+        break;
+
+    default:
+        LOG_W("unknown command 0x%02x.", op);
+        break;
+    }
+}
+
+/* wait the bus time of the transaction */
+static void nand_sim_bus_time(struct nand_sim *sim, rt_size_t cmd_bytes, rt_size_t data_bytes, rt_uint8_t data_lines)
+{
+    rt_uint64_t ns = 0;
+
+    sim->stat.bus_bytes += cmd_bytes + data_bytes;
+    if (sim->bus_hz == 0)
+    {
+        return;
+    }
+
+    ns = ((rt_uint64_t)cmd_bytes * 8 + (rt_uint64_t)data_bytes * 8 / data_lines) * 1000000000 / sim->bus_hz;
+    ns += sim->bus_debt_ns;
+    sim->stat.bus_us += ns / 1000;
+    sim->bus_debt_ns = ns % 1000;
+    if (ns >= 1000)
+    {
+        rt_hw_us_delay((rt_uint32_t)(ns / 1000));
+    }
+}
+
+static rt_err_t nand_sim_wr(const nand_spi *spi, const rt_uint8_t *write_buf, rt_size_t write_size,
+                            rt_uint8_t *read_buf, rt_size_t read_size)
+{
+    struct nand_sim *sim = NAND_SIM_GET(spi);
+
+    if (write_size == 0)
+    {
+        return -RT_EINVAL;
+    }
+
+    nand_sim_transfer(sim, write_buf, write_size, read_buf, read_size);
+    nand_sim_bus_time(sim, write_size, read_size, 1);
+
+    return RT_EOK;
+}
+
+/* run the segments of one chip select cycle, up to the one with cs_change */
+static rt_err_t nand_sim_xfer_cmd(struct nand_sim *sim, const nand_spi_xfer *xfer, rt_size_t count)
+{
+    rt_size_t i = 0, tx_len = 0, rx_len = 0;
+
+    /* the send segments come before the receive segments */
+    for (i = 0; i < count; i++)
+    {
+        if (xfer[i].send_buf != RT_NULL)
+        {
+            if (rx_len != 0 || tx_len + xfer[i].length > sim->page_bytes + NAND_SIM_CMD_MAX)
+            {
+                return -RT_EINVAL;
+            }
+            rt_memcpy(sim->tx_buf + tx_len, xfer[i].send_buf, xfer[i].length);
+            tx_len += xfer[i].length;
+        }
+        else
+        {
+            rx_len += xfer[i].length;
+        }
+    }
+    if (tx_len == 0 || rx_len > sim->page_bytes + NAND_SIM_CMD_MAX)
+    {
+        return -RT_EINVAL;
+    }
+
+    nand_sim_transfer(sim, sim->tx_buf, tx_len, sim->rx_buf, rx_len);
+    nand_sim_bus_time(sim, tx_len, rx_len, 1);
+
+    for (i = 0, rx_len = 0; i < count; i++)
+    {
+        if (xfer[i].recv_buf != RT_NULL)
+        {
+            rt_memcpy(xfer[i].recv_buf, sim->rx_buf + rx_len, xfer[i].length);
+            rx_len += xfer[i].length;
+        }
+    }
+
+    return RT_EOK;
+}
+
+static rt_err_t nand_sim_xfer(const nand_spi *spi, const nand_spi_xfer *xfer, rt_size_t count)
+{
+    struct nand_sim *sim = NAND_SIM_GET(spi);
+    rt_err_t result = RT_EOK;
+    rt_size_t i = 0, first = 0;
+
+    /* a command sequence, one command per chip select cycle */
+    for (i = 0; i < count && result == RT_EOK; i++)
+    {
+        if (xfer[i].cs_change || i == count - 1)
+        {
+            result = nand_sim_xfer_cmd(sim, xfer + first, i + 1 - first);
+            first = i + 1;
+        }
+    }
+
+    return result;
+}
+
+#ifdef NAND_USING_QSPI
+static rt_err_t nand_sim_qspi_wr(const nand_spi *spi, rt_uint32_t addr, nand_qspi_cmd_format *qspi_cmd_format,
+                                 rt_uint8_t *write_buf, rt_size_t write_size, rt_uint8_t *read_buf, rt_size_t read_size)
+{
+    struct nand_sim *sim = NAND_SIM_GET(spi);
+    rt_size_t tx_len = 0;
+    rt_uint8_t i = 0;
+
+    if (write_size > sim->page_bytes)
+    {
+        return -RT_EINVAL;
+    }
+
+    /* the same bytes as the single line command */
+    sim->tx_buf[tx_len++] = qspi_cmd_format->instruction;
+    for (i = qspi_cmd_format->address_size / 8; i > 0; i--)
+    {
+        sim->tx_buf[tx_len++] = (addr >> ((i - 1) * 8)) & 0xff;
+    }
+    if (read_size != 0)
+    {
+        /* dummy byte, the Continuous Read has no column */
+        for (i = qspi_cmd_format->address_size ? 1 : 3; i > 0; i--)
+        {
+            sim->tx_buf[tx_len++] = DUMMY_CMD;
+        }
+    }
+    rt_memcpy(sim->tx_buf + tx_len, write_buf, write_size);
+
+    nand_sim_transfer(sim, sim->tx_buf, tx_len + write_size, read_buf, read_size);
+    nand_sim_bus_time(sim, tx_len, write_size + read_size, qspi_cmd_format->data_lines);
+
+    return RT_EOK;
+}
+#endif /* NAND_USING_QSPI */
+
+static void nand_sim_delete(struct nand_sim *sim)
+{
+    rt_uint8_t i = 0;
+
+    if (sim->file != RT_NULL)
+    {
+        fclose((FILE *)sim->file);
+    }
+    for (i = 0; i < NAND_DIE_MAX; i++)
+    {
+        rt_free(sim->die[i].cache);
+        rt_free(sim->die[i].data);
+    }
+    rt_free(sim->array);
+    rt_free(sim->nop);
+    rt_free(sim->tx_buf);
+    rt_free(sim->rx_buf);
+    rt_free(sim->page_buf);
+    rt_free(sim);
+}
+
+/* open the backing file, a new or short file is filled up with erased pages */
+static rt_err_t nand_sim_file_open(struct nand_sim *sim, const char *file_name, rt_uint32_t page_total)
+{
+    FILE *file = RT_NULL;
+    long size = 0;
+    rt_uint32_t page = 0;
+
+    file = fopen(file_name, "r+b");
+    if (file == RT_NULL)
+    {
+        file = fopen(file_name, "w+b");
+    }
+    if (file == RT_NULL)
+    {
+        LOG_E("open %s failed.", file_name);
+        return -RT_EIO;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    sim->file = file;
+
+    rt_memset(sim->page_buf, 0xff, sim->page_bytes);
+    for (page = size / sim->page_bytes; page < page_total; page++)
+    {
+        nand_sim_page_store(sim, page, sim->page_buf);
+    }
+    fflush(file);
+
+    return RT_EOK;
+}
+
+static struct nand_sim *nand_sim_create(const char *chip_name, const char *file_name)
+{
+    struct nand_sim *sim = RT_NULL;
+    const nand_flash_chip_info *chip = RT_NULL;
+    rt_uint32_t page_total = 0;
+    rt_uint8_t i = 0;
+
+    for (i = 0; i < sizeof(nand_sim_chip_table) / sizeof(nand_flash_chip_info); i++)
+    {
+        if (chip_name == RT_NULL || !rt_strcmp(chip_name, nand_sim_chip_table[i].name))
+        {
+            chip = &nand_sim_chip_table[i];
+            break;
+        }
+    }
+    if (chip == RT_NULL)
+    {
+        LOG_E("unknown chip %s.", chip_name);
+        return RT_NULL;
+    }
+
+    sim = (struct nand_sim *)rt_malloc(sizeof(struct nand_sim));
+    if (sim == RT_NULL)
+    {
+        return RT_NULL;
+    }
+    rt_memset(sim, 0, sizeof(struct nand_sim));
+
+    sim->chip = *chip;
+    sim->timing = chip->timing;
+    sim->bus_hz = RT_NAND_SIM_BUS_HZ;
+    sim->page_bytes = chip->page_size + chip->oob_size;
+    sim->die_pages = chip->blocks_per_die * chip->pages_per_block;
+    page_total = sim->die_pages * chip->die_num;
+
+    sim->nop = (rt_uint8_t *)rt_malloc(page_total);
+    sim->tx_buf = (rt_uint8_t *)rt_malloc(sim->page_bytes + NAND_SIM_CMD_MAX);
+    sim->rx_buf = (rt_uint8_t *)rt_malloc(sim->page_bytes + NAND_SIM_CMD_MAX);
+    sim->page_buf = (rt_uint8_t *)rt_malloc(sim->page_bytes);
+    if (sim->nop == RT_NULL || sim->tx_buf == RT_NULL || sim->rx_buf == RT_NULL || sim->page_buf == RT_NULL)
+    {
+        goto __error;
+    }
+    rt_memset(sim->nop, 0, page_total);
+
+    for (i = 0; i < chip->die_num; i++)
+    {
+        sim->die[i].cache = (rt_uint8_t *)rt_malloc(sim->page_bytes);
+        sim->die[i].data = (rt_uint8_t *)rt_malloc(sim->page_bytes);
+        if (sim->die[i].cache == RT_NULL || sim->die[i].data == RT_NULL)
+        {
+            goto __error;
+        }
+        /* power up: the array locked, on-chip ECC and buffer read mode on */
+        sim->die[i].sr1 = chip->bp_bit & 0xff;
+        sim->die[i].sr2 = (chip->ecc_bit & 0xff) | NAND_SR2_BUF_BIT_MASK;
+    }
+
+    if (file_name != RT_NULL)
+    {
+        if (nand_sim_file_open(sim, file_name, page_total) != RT_EOK)
+        {
+            goto __error;
+        }
+    }
+    else
+    {
+        sim->array = (rt_uint8_t *)rt_malloc((rt_size_t)page_total * sim->page_bytes);
+        if (sim->array == RT_NULL)
+        {
+            goto __error;
+        }
+        rt_memset(sim->array, 0xff, (rt_size_t)page_total * sim->page_bytes);
+    }
+
+    return sim;
+
+__error:
+    nand_sim_delete(sim);
+    return RT_NULL;
+}
+
+/**
+ * rt_spi_nand_sim_probe: register a nand device on a simulated chip.
+ *
+ * @param spi_nand_dev_name the nand device name, such as nand0
+ * @param chip_name the chip name in SPI_NAND_FLASH_CHIP_INFO, RT_NULL for the first one
+ * @param file_name the backing file, RT_NULL to keep the array in RAM
+ *
+ * @return the device, RT_NULL on failure
+ */
+rt_spi_nand_flash_device_t rt_spi_nand_sim_probe(const char *spi_nand_dev_name, const char *chip_name,
+                                                 const char *file_name)
+{
+    struct spi_nand_flash_mtd *rtt_dev = RT_NULL;
+    nand_flash *nand_dev = RT_NULL;
+    struct nand_sim *sim = RT_NULL;
+    char *spi_flash_dev_name_bak = RT_NULL;
+
+    extern rt_err_t _spi_nand_bus_init(nand_flash_t flash);
+    extern int rt_hw_nand_init(struct rt_mtd_nand_device *device);
+
+    RT_ASSERT(spi_nand_dev_name);
+
+    rtt_dev = (rt_spi_nand_flash_device_t) rt_malloc(sizeof(struct spi_nand_flash_mtd));
+    nand_dev = (nand_flash_t) rt_malloc(sizeof(nand_flash));
+    spi_flash_dev_name_bak = (char *) rt_malloc(rt_strlen(spi_nand_dev_name) + 1);
+    sim = nand_sim_create(chip_name, file_name);
+
+    if (rtt_dev == RT_NULL || nand_dev == RT_NULL || spi_flash_dev_name_bak == RT_NULL || sim == RT_NULL)
+    {
+        LOG_E("ERROR: Low memory.");
+        goto error;
+    }
+
+    rt_memset(rtt_dev, 0, sizeof(struct spi_nand_flash_mtd));
+    rt_mutex_init(&(rtt_dev->lock), spi_nand_dev_name, RT_IPC_FLAG_FIFO);
+    rt_memset(nand_dev, 0, sizeof(nand_flash));
+    rt_strncpy(spi_flash_dev_name_bak, spi_nand_dev_name, rt_strlen(spi_nand_dev_name));
+    spi_flash_dev_name_bak[rt_strlen(spi_nand_dev_name)] = '\0';
+
+    /* no SPI device, the chip is behind the simulated bus */
+    nand_dev->name = spi_flash_dev_name_bak;
+    nand_dev->spi.name = "sim";
+    rtt_dev->user_data = nand_dev;
+    nand_dev->user_data = rtt_dev;
+    nand_dev->spi.user_data = nand_dev;
+    _spi_nand_bus_init(nand_dev);
+    nand_dev->spi.wr = nand_sim_wr;
+    nand_dev->spi.xfer = nand_sim_xfer;
+#ifdef NAND_USING_QSPI
+    nand_dev->spi.qspi_wr = nand_sim_qspi_wr;
+#endif
+    nand_dev->sim = sim;
+
+    if (rt_hw_nand_init(&rtt_dev->mtd_nand_device) != RT_EOK)
+    {
+        LOG_E("ERROR: hardware nand init error.");
+        rt_mutex_detach(&(rtt_dev->lock));
+        goto error;
+    }
+
+    LOG_I("Probe simulated %s as %s%s%s.", sim->chip.name, spi_nand_dev_name,
+          file_name ? " on " : "", file_name ? file_name : "");
+    return rtt_dev;
+
+error:
+    if (sim != RT_NULL)
+    {
+        nand_sim_delete(sim);
+    }
+    rt_free(rtt_dev);
+    rt_free(nand_dev);
+    rt_free(spi_flash_dev_name_bak);
+
+    return RT_NULL;
+}
+
+/**
+ * spi_nand_sim_config: change the simulated timing.
+ *
+ * @param device the nand device
+ * @param timing tR, tPROG, tBERS and tRST, RT_NULL keeps the current one
+ * @param bus_hz the bus clock, 0 for no bus time
+ *
+ * @return RT_EOK on success, -RT_ENOSYS if the chip isn't simulated
+ */
+rt_err_t spi_nand_sim_config(struct rt_mtd_nand_device *device, const nand_flash_timing *timing, rt_uint32_t bus_hz)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    struct nand_sim *sim = nand_dev->sim;
+
+    if (sim == RT_NULL)
+    {
+        return -RT_ENOSYS;
+    }
+
+    nand_dev->spi.lock(&nand_dev->spi);
+    if (timing != RT_NULL)
+    {
+        sim->timing = *timing;
+    }
+    sim->bus_hz = bus_hz;
+    nand_dev->spi.unlock(&nand_dev->spi);
+
+    return RT_EOK;
+}
+
+/* spi_nand_sim_get: the simulated chip of the device, RT_NULL on a real bus */
+const struct nand_sim *spi_nand_sim_get(struct rt_mtd_nand_device *device)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+
+    return ((nand_flash_t)rtt_dev->user_data)->sim;
+}
+
+/**
+ * spi_nand_sim_flip: inject a bitflip, every read of the page senses the bit
+ * flipped until the block is erased.
+ *
+ * @param device the nand device
+ * @param page the page of the device
+ * @param bit the bit in the page and spare
+ *
+ * @return RT_EOK on success, -RT_EFULL if RT_NAND_SIM_FLIP_MAX are injected,
+ *         -RT_ENOSYS if the chip isn't simulated
+ */
+rt_err_t spi_nand_sim_flip(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t bit)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    struct nand_sim *sim = nand_dev->sim;
+    rt_err_t result = RT_EOK;
+    rt_uint32_t block = 0;
+
+    if (sim == RT_NULL)
+    {
+        return -RT_ENOSYS;
+    }
+
+    page += device->block_start * device->pages_per_block;
+    if (page >= device->block_end * device->pages_per_block || bit >= sim->page_bytes * 8)
+    {
+        return -RT_EINVAL;
+    }
+
+    /* the blocks are interleaved over the dies */
+    block = page / sim->chip.pages_per_block;
+    page = (block % sim->chip.die_num) * sim->die_pages
+           + (block / sim->chip.die_num) * sim->chip.pages_per_block + page % sim->chip.pages_per_block;
+
+    nand_dev->spi.lock(&nand_dev->spi);
+    if (sim->flip_num < RT_NAND_SIM_FLIP_MAX)
+    {
+        sim->flip_page[sim->flip_num] = page;
+        sim->flip_bit[sim->flip_num] = bit;
+        sim->flip_num++;
+    }
+    else
+    {
+        result = -RT_EFULL;
+    }
+    nand_dev->spi.unlock(&nand_dev->spi);
+
+    return result;
+}
+
+#ifdef RT_USING_FINSH
+#include <finsh.h>
+#include <stdlib.h>
+
+/* the injected bits of the ecc test, all in the first ECC sector */
+#define NAND_SIM_TEST_BIT(n)          ((n) * 67 + 3)
+
+/* read len bytes of a page through the ops, check the return and which bits differ from the pattern */
+static rt_err_t nand_sim_test_read(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t len,
+                                   const rt_uint8_t *pattern, rt_uint8_t *buf, rt_err_t expect, rt_uint32_t flips)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint32_t bit = 0, n = 0;
+    rt_uint8_t diff = 0;
+
+    rt_memset(buf, 0, len);
+    result = rt_mtd_nand_read(device, page, buf, len, RT_NULL, 0);
+    if (result != expect)
+    {
+        rt_kprintf("page %d read returns %d, expect %d.\n", page, result, expect);
+        return -RT_ERROR;
+    }
+
+    for (bit = 0; bit < len * 8; bit++)
+    {
+        diff = ((buf[bit >> 3] ^ pattern[bit >> 3]) >> (bit & 0x7)) & 0x1;
+        if (diff != (n < flips && bit == NAND_SIM_TEST_BIT(n) ? 1 : 0))
+        {
+            rt_kprintf("page %d bit %d is %s.\n", page, bit, diff ? "flipped" : "not flipped");
+            return -RT_ERROR;
+        }
+        n += diff;
+    }
+
+    return RT_EOK;
+}
+
+/*
+ * nand_sim_ecc_test: inject bitflips to two programmed pages of the block
+ * and read each twice through the ops. A corrected page is good data and
+ * served from the page cache, an uncorrectable page comes out raw and is
+ * read from the chip again. A short read of a third page is corrected too,
+ * and so are erased pages with a bitflip in the data or in the spare.
+ */
+static rt_err_t nand_sim_ecc_test(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    rt_err_t result = RT_EOK;
+    rt_uint8_t *pattern = RT_NULL, *buf = RT_NULL;
+    rt_off_t page = block * device->pages_per_block;
+    rt_uint32_t correctable = 0, many = 0, i = 0;
+    rt_err_t expect_few = RT_EOK, expect_many = RT_EOK, expect_hit = RT_EOK;
+#ifdef NAND_USING_PAGE_CACHE
+    rt_uint32_t hit = 0, miss = 0, hit_now = 0, miss_now = 0;
+#endif
+
+#if defined(NAND_USING_SW_ECC)
+    correctable = RT_NAND_SW_ECC_STRENGTH;
+#elif defined(NAND_USING_HW_ECC)
+    correctable = RT_NAND_SIM_ECC_BITS;
+#endif
+    many = correctable + 1;
+    if (many > RT_NAND_SIM_FLIP_MAX - 1)
+    {
+        return -RT_EINVAL;
+    }
+    if (correctable != 0)
+    {
+        expect_few = -RT_MTD_EECC_CORRECT;
+        expect_many = -RT_MTD_EECC;
+    }
+    /* the corrected page is cached, a cache hit has nothing to correct */
+#ifdef NAND_USING_PAGE_CACHE
+    expect_hit = RT_EOK;
+#else
+    expect_hit = expect_few;
+#endif
+
+    pattern = (rt_uint8_t *)rt_malloc(device->page_size);
+    buf = (rt_uint8_t *)rt_malloc(device->page_size);
+    if (pattern == RT_NULL || buf == RT_NULL)
+    {
+        result = -RT_ENOMEM;
+        goto __exit;
+    }
+    for (i = 0; i < device->page_size; i++)
+    {
+        pattern[i] = (rt_uint8_t)(i * 7 + block);
+    }
+
+    if (rt_mtd_nand_erase_block(device, block) != RT_EOK
+            || rt_mtd_nand_write(device, page, pattern, device->page_size, RT_NULL, 0) != RT_EOK
+            || rt_mtd_nand_write(device, page + 1, pattern, device->page_size, RT_NULL, 0) != RT_EOK
+            || rt_mtd_nand_write(device, page + 2, pattern, device->page_size, RT_NULL, 0) != RT_EOK)
+    {
+        rt_kprintf("block %d erase or program failed.\n", block);
+        result = -RT_EIO;
+        goto __exit;
+    }
+
+    spi_nand_sim_flip(device, page, NAND_SIM_TEST_BIT(0));
+    spi_nand_sim_flip(device, page + 2, NAND_SIM_TEST_BIT(0));
+    for (i = 0; i < many; i++)
+    {
+        spi_nand_sim_flip(device, page + 1, NAND_SIM_TEST_BIT(i));
+    }
+
+#ifdef NAND_USING_PAGE_CACHE
+    spi_nand_cache_stat(device, &hit, &miss);
+#endif
+    result = nand_sim_test_read(device, page, device->page_size, pattern, buf, expect_few, correctable ? 0 : 1);
+    if (result == RT_EOK)
+    {
+        result = nand_sim_test_read(device, page, device->page_size, pattern, buf, expect_hit, correctable ? 0 : 1);
+    }
+    if (result == RT_EOK)
+    {
+        result = nand_sim_test_read(device, page + 1, device->page_size, pattern, buf, expect_many, many);
+    }
+    if (result == RT_EOK)
+    {
+        result = nand_sim_test_read(device, page + 1, device->page_size, pattern, buf, expect_many, many);
+    }
+#ifdef NAND_USING_PAGE_CACHE
+    spi_nand_cache_stat(device, &hit_now, &miss_now);
+    /* the uncorrectable page is read twice from the chip */
+    i = correctable ? 1 : 2;
+    if (result == RT_EOK && (hit_now - hit != i || miss_now - miss != 4 - i))
+    {
+        rt_kprintf("page cache hit %d miss %d, expect %d and %d.\n", hit_now - hit, miss_now - miss, i, 4 - i);
+        result = -RT_ERROR;
+    }
+#endif
+    if (result == RT_EOK)
+    {
+        result = nand_sim_test_read(device, page + 2, 16, pattern, buf, expect_few, correctable ? 0 : 1);
+    }
+
+    /* erased pages, the last spare bit is in the software ECC parity */
+    rt_memset(pattern, 0xff, device->page_size);
+    spi_nand_sim_flip(device, page + 3, NAND_SIM_TEST_BIT(0));
+    spi_nand_sim_flip(device, page + 4, (device->page_size + device->oob_size) * 8 - 1);
+    if (result == RT_EOK)
+    {
+        result = nand_sim_test_read(device, page + 3, device->page_size, pattern, buf, expect_few,
+                                    correctable ? 0 : 1);
+    }
+    if (result == RT_EOK)
+    {
+        result = nand_sim_test_read(device, page + 4, device->page_size, pattern, buf, expect_few, 0);
+    }
+
+    /* the erase clears the injected bitflips */
+    rt_mtd_nand_erase_block(device, block);
+
+__exit:
+    rt_free(pattern);
+    rt_free(buf);
+
+    rt_kprintf("ecc test on block %d %s.\n", block, result == RT_EOK ? "passed" : "failed");
+
+    return result;
+}
+
+static int nand_sim(int argc, char **argv)
+{
+    rt_device_t dev = RT_NULL;
+    const struct nand_sim *sim = RT_NULL;
+    nand_flash_timing timing;
+
+    if (argc >= 3 && !rt_strcmp(argv[1], "probe"))
+    {
+        return rt_spi_nand_sim_probe(argv[2], argc > 3 ? argv[3] : RT_NULL,
+                                     argc > 4 ? argv[4] : RT_NULL) ? RT_EOK : -RT_ERROR;
+    }
+
+    if (argc < 3 || (rt_strcmp(argv[1], "stat") && rt_strcmp(argv[1], "timing")
+                     && rt_strcmp(argv[1], "flip") && rt_strcmp(argv[1], "ecc")))
+    {
+        rt_kprintf("Usage: nand_sim probe <nand device> [chip] [file]\n");
+        rt_kprintf("       nand_sim stat <nand device>\n");
+        rt_kprintf("       nand_sim timing <nand device> <tR> <tPROG> <tBERS> [bus_hz]\n");
+        rt_kprintf("       nand_sim flip <nand device> <page> <bit>\n");
+        rt_kprintf("       nand_sim ecc <nand device> <block>\n");
+        return -RT_EINVAL;
+    }
+
+    dev = rt_device_find(argv[2]);
+    if (dev == RT_NULL || dev->type != RT_Device_Class_MTD)
+    {
+        rt_kprintf("nand device %s not found.\n", argv[2]);
+        return -RT_ERROR;
+    }
+    sim = spi_nand_sim_get((struct rt_mtd_nand_device *)dev);
+    if (sim == RT_NULL)
+    {
+        rt_kprintf("%s is not simulated.\n", argv[2]);
+        return -RT_ERROR;
+    }
+
+    if (!rt_strcmp(argv[1], "timing"))
+    {
+        if (argc < 6)
+        {
+            return -RT_EINVAL;
+        }
+        timing = sim->timing;
+        timing.read_us = atoi(argv[3]);
+        timing.prog_us = atoi(argv[4]);
+        timing.erase_us = atoi(argv[5]);
+        return spi_nand_sim_config((struct rt_mtd_nand_device *)dev, &timing,
+                                   argc > 6 ? atoi(argv[6]) : sim->bus_hz);
+    }
+
+    if (!rt_strcmp(argv[1], "flip"))
+    {
+        if (argc < 5)
+        {
+            return -RT_EINVAL;
+        }
+        return spi_nand_sim_flip((struct rt_mtd_nand_device *)dev, atoi(argv[3]), atoi(argv[4]));
+    }
+
+    if (!rt_strcmp(argv[1], "ecc"))
+    {
+        if (argc < 4)
+        {
+            return -RT_EINVAL;
+        }
+        return nand_sim_ecc_test((struct rt_mtd_nand_device *)dev, atoi(argv[3]));
+    }
+
+    rt_kprintf("chip %s, tR %d us, tPROG %d us, tBERS %d us, bus %d Hz\n", sim->chip.name,
+               sim->timing.read_us, sim->timing.prog_us, sim->timing.erase_us, sim->bus_hz);
+    rt_kprintf("reads %d, programs %d, erases %d\n", sim->stat.reads, sim->stat.programs, sim->stat.erases);
+    rt_kprintf("program fails %d, erase fails %d, busy drops %d\n",
+               sim->stat.prog_fails, sim->stat.erase_fails, sim->stat.busy_drops);
+    rt_kprintf("ECC corrects %d, ECC fails %d, bitflips injected %d\n",
+               sim->stat.ecc_corrects, sim->stat.ecc_fails, sim->flip_num);
+    rt_kprintf("bus %d KB, %d ms\n", (rt_uint32_t)(sim->stat.bus_bytes / 1024), (rt_uint32_t)(sim->stat.bus_us / 1000));
+
+    return RT_EOK;
+}
+MSH_CMD_EXPORT(nand_sim, simulated nand chip: nand_sim probe|stat|timing|flip|ecc);
+#endif /* RT_USING_FINSH */
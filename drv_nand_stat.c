@@ -0,0 +1,502 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-12-02     yangjie      the first version
+ */
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include "drv_mtd_nand.h"
+
+#define DBG_TAG     "drv_nand_stat"
+#define DBG_LVL     DBG_LOG
+#include <rtdbg.h>
+
+/*
+ * Latency and SPI traffic statistics. The read, write and erase operations
+ * are split into the lock wait, the commands, the page data transfer, the
+ * busy polls and the delays between them, each phase has a log2 latency
+ * histogram per operation. The SPI device interface is wrapped to count the
+ * transactions and bytes per command opcode, whatever the transport is.
+ */
+
+#define NAND_STAT_GET(device)                                                                   \
+    (((nand_flash_t)(rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device)->user_data))->stat)
+
+static void nand_stat_hist_add(struct nand_stat_hist *hist, rt_uint32_t us)
+{
+    rt_uint32_t bucket = 0;
+
+    while (bucket < RT_NAND_STAT_BUCKETS - 1 && (us >> bucket) != 0)
+    {
+        bucket++;
+    }
+
+    hist->count++;
+    hist->sum_us += us;
+    if (us > hist->max_us)
+    {
+        hist->max_us = us;
+    }
+    hist->bucket[bucket]++;
+}
+
+/* the page data commands, the others are counted as command overhead */
+static rt_bool_t nand_stat_is_xfer(rt_uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case NAND_READ_FROM_CACHE:
+    case NAND_DUAL_READ:
+    case NAND_DUAL_IO_READ:
+    case NAND_QUAD_READ:
+    case NAND_QUAD_IO_READ:
+    case NAND_WRITE:
+    case NAND_RANDOM_WRITE:
+    case NAND_QUAD_WRITE:
+    case NAND_QUAD_RANDOM_WRITE:
+        return RT_TRUE;
+    default:
+        return RT_FALSE;
+    }
+}
+
+/* count one SPI transaction which took us */
+static void nand_stat_spi(struct nand_stat *stat, rt_uint8_t opcode, rt_size_t bytes, rt_uint32_t us)
+{
+    rt_uint32_t i = 0;
+
+    for (i = 0; i < stat->opcode_num && stat->opcode[i].opcode != opcode; i++);
+    if (i == stat->opcode_num)
+    {
+        if (stat->opcode_num == RT_NAND_STAT_OPCODES)
+        {
+            stat->opcode_lost++;
+            i = RT_NAND_STAT_OPCODES;
+        }
+        else
+        {
+            stat->opcode[i].opcode = opcode;
+            stat->opcode_num++;
+        }
+    }
+    if (i < RT_NAND_STAT_OPCODES)
+    {
+        stat->opcode[i].count++;
+        stat->opcode[i].bytes += bytes;
+    }
+
+    /* the status polls are in the busy time */
+    if (stat->depth != 0 && !stat->in_busy)
+    {
+        stat->phase_us[nand_stat_is_xfer(opcode) ? NAND_STAT_XFER : NAND_STAT_CMD] += us;
+    }
+}
+
+static rt_err_t nand_stat_wr(const nand_spi *spi, const rt_uint8_t *write_buf, rt_size_t write_size,
+                             rt_uint8_t *read_buf, rt_size_t read_size)
+{
+    nand_flash_t nand_dev = (nand_flash_t)(spi->user_data);
+    NAND_STAT_TIME(start);
+    rt_err_t result = RT_EOK;
+
+    result = nand_dev->stat_bus.wr(spi, write_buf, write_size, read_buf, read_size);
+    /* a receive only transaction continues the last command */
+    nand_stat_spi(nand_dev->stat, write_size ? write_buf[0] : 0, write_size + read_size,
+                  RT_NAND_STAT_TIME_US() - start);
+
+    return result;
+}
+
+static rt_err_t nand_stat_xfer(const nand_spi *spi, const nand_spi_xfer *xfer, rt_size_t count)
+{
+    nand_flash_t nand_dev = (nand_flash_t)(spi->user_data);
+    NAND_STAT_TIME(start);
+    rt_err_t result = RT_EOK;
+    rt_uint32_t us = 0;
+    rt_size_t i = 0, first = 0, bytes = 0, max_bytes = 0, max_first = 0;
+
+    result = nand_dev->stat_bus.xfer(spi, xfer, count);
+    if (result == -RT_ENOSYS)
+    {
+        return result;
+    }
+    us = RT_NAND_STAT_TIME_US() - start;
+
+    /* a command sequence counts each command, the time goes to the longest one */
+    for (i = 0; i < count; i++)
+    {
+        bytes += xfer[i].length;
+        if (xfer[i].cs_change || i == count - 1)
+        {
+            if (bytes > max_bytes)
+            {
+                max_bytes = bytes;
+                max_first = first;
+            }
+            bytes = 0;
+            first = i + 1;
+        }
+    }
+    for (i = 0, first = 0; i < count; i++)
+    {
+        bytes += xfer[i].length;
+        if (xfer[i].cs_change || i == count - 1)
+        {
+            nand_stat_spi(nand_dev->stat, xfer[first].send_buf ? xfer[first].send_buf[0] : 0, bytes,
+                          first == max_first ? us : 0);
+            bytes = 0;
+            first = i + 1;
+        }
+    }
+
+    return result;
+}
+
+#ifdef NAND_USING_QSPI
+static rt_err_t nand_stat_qspi_wr(const nand_spi *spi, rt_uint32_t addr, nand_qspi_cmd_format *qspi_cmd_format,
+                                  rt_uint8_t *write_buf, rt_size_t write_size, rt_uint8_t *read_buf, rt_size_t read_size)
+{
+    nand_flash_t nand_dev = (nand_flash_t)(spi->user_data);
+    NAND_STAT_TIME(start);
+    rt_err_t result = RT_EOK;
+
+    result = nand_dev->stat_bus.qspi_wr(spi, addr, qspi_cmd_format, write_buf, write_size, read_buf, read_size);
+    nand_stat_spi(nand_dev->stat, qspi_cmd_format->instruction,
+                  1 + qspi_cmd_format->address_size / 8 + write_size + read_size, RT_NAND_STAT_TIME_US() - start);
+
+    return result;
+}
+#endif /* NAND_USING_QSPI */
+
+rt_err_t nand_stat_init(struct rt_mtd_nand_device *device)
+{
+    struct nand_stat *stat = RT_NULL;
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    stat = (struct nand_stat *)rt_malloc(sizeof(struct nand_stat));
+    if (stat == RT_NULL)
+    {
+        return -RT_ENOMEM;
+    }
+    rt_memset(stat, 0, sizeof(struct nand_stat));
+
+    nand_dev->spi.lock(&nand_dev->spi);
+    /* wrap the SPI device interface */
+    nand_dev->stat_bus = nand_dev->spi;
+    nand_dev->spi.wr = nand_stat_wr;
+    nand_dev->spi.xfer = nand_stat_xfer;
+#ifdef NAND_USING_QSPI
+    nand_dev->spi.qspi_wr = nand_stat_qspi_wr;
+#endif
+    nand_dev->stat = stat;
+    nand_dev->spi.unlock(&nand_dev->spi);
+
+    return RT_EOK;
+}
+
+/* nand_stat_deinit: unwrap the SPI device interface and free the statistics */
+void nand_stat_deinit(struct rt_mtd_nand_device *device)
+{
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+    struct nand_stat *stat = nand_dev->stat;
+
+    if (stat == RT_NULL)
+    {
+        return;
+    }
+
+    nand_dev->spi.lock(&nand_dev->spi);
+    nand_dev->spi = nand_dev->stat_bus;
+    nand_dev->stat = RT_NULL;
+    nand_dev->spi.unlock(&nand_dev->spi);
+    rt_free(stat);
+}
+
+/*
+ * nand_stat_begin: the operation op got the device lock, it waited for it
+ * since start.
+ */
+void nand_stat_begin(struct rt_mtd_nand_device *device, rt_uint8_t op, rt_uint32_t start)
+{
+    struct nand_stat *stat = NAND_STAT_GET(device);
+
+    if (stat == RT_NULL || stat->depth++ != 0)
+    {
+        return;
+    }
+
+    rt_memset(stat->phase_us, 0, sizeof(stat->phase_us));
+    stat->op = op;
+    stat->start = start;
+    stat->phase_us[NAND_STAT_LOCK] = RT_NAND_STAT_TIME_US() - start;
+}
+
+/* nand_stat_end: the operation is done, still with the device locked */
+void nand_stat_end(struct rt_mtd_nand_device *device)
+{
+    struct nand_stat *stat = NAND_STAT_GET(device);
+    rt_uint8_t phase = 0;
+
+    if (stat == RT_NULL || stat->depth == 0 || --stat->depth != 0)
+    {
+        return;
+    }
+
+    stat->phase_us[NAND_STAT_TOTAL] = RT_NAND_STAT_TIME_US() - stat->start;
+    for (phase = 0; phase < NAND_STAT_PHASE_NUM; phase++)
+    {
+        nand_stat_hist_add(&stat->hist[stat->op][phase], stat->phase_us[phase]);
+    }
+}
+
+/* nand_stat_phase: add the time since start to the phase */
+void nand_stat_phase(struct rt_mtd_nand_device *device, rt_uint8_t phase, rt_uint32_t start)
+{
+    struct nand_stat *stat = NAND_STAT_GET(device);
+
+    if (stat == RT_NULL || stat->depth == 0)
+    {
+        return;
+    }
+
+    stat->phase_us[phase] += RT_NAND_STAT_TIME_US() - start;
+}
+
+void nand_stat_busy_begin(struct rt_mtd_nand_device *device)
+{
+    struct nand_stat *stat = NAND_STAT_GET(device);
+
+    if (stat == RT_NULL || stat->depth == 0)
+    {
+        return;
+    }
+
+    stat->in_busy = RT_TRUE;
+    stat->busy_start = RT_NAND_STAT_TIME_US();
+    stat->busy_delay = stat->phase_us[NAND_STAT_DELAY];
+}
+
+/* nand_stat_busy_end: the busy wait is done, its delays are not busy time */
+void nand_stat_busy_end(struct rt_mtd_nand_device *device)
+{
+    struct nand_stat *stat = NAND_STAT_GET(device);
+
+    if (stat == RT_NULL || !stat->in_busy)
+    {
+        return;
+    }
+
+    stat->in_busy = RT_FALSE;
+    stat->phase_us[NAND_STAT_BUSY] += RT_NAND_STAT_TIME_US() - stat->busy_start
+                                      - (stat->phase_us[NAND_STAT_DELAY] - stat->busy_delay);
+}
+
+void nand_stat_poll(struct rt_mtd_nand_device *device)
+{
+    struct nand_stat *stat = NAND_STAT_GET(device);
+
+    if (stat == RT_NULL || stat->depth == 0)
+    {
+        return;
+    }
+
+    stat->busy_polls[stat->op]++;
+}
+
+/**
+ * spi_nand_stat_get: get the statistics of the device, the counters keep
+ * changing while the device is in use.
+ *
+ * @param device the nand device
+ *
+ * @return the statistics, RT_NULL if not started
+ */
+const struct nand_stat *spi_nand_stat_get(struct rt_mtd_nand_device *device)
+{
+    return NAND_STAT_GET(device);
+}
+
+/**
+ * spi_nand_stat_percentile: the latency under which percent of the samples
+ * are, the upper bound of the histogram bucket.
+ *
+ * @param hist the latency histogram
+ * @param percent 1 to 100
+ *
+ * @return the latency in microseconds
+ */
+rt_uint32_t spi_nand_stat_percentile(const struct nand_stat_hist *hist, rt_uint8_t percent)
+{
+    rt_uint64_t target = ((rt_uint64_t)hist->count * percent + 99) / 100;
+    rt_uint64_t sum = 0;
+    rt_uint32_t bucket = 0;
+
+    if (hist->count == 0)
+    {
+        return 0;
+    }
+
+    for (bucket = 0; bucket < RT_NAND_STAT_BUCKETS; bucket++)
+    {
+        sum += hist->bucket[bucket];
+        if (sum >= target)
+        {
+            break;
+        }
+    }
+
+    /* the last bucket is open, its samples are at most max_us */
+    if (bucket >= RT_NAND_STAT_BUCKETS - 1 || (1UL << bucket) > hist->max_us)
+    {
+        return hist->max_us;
+    }
+
+    return (1UL << bucket) - 1;
+}
+
+/* spi_nand_stat_reset: clear the statistics */
+void spi_nand_stat_reset(struct rt_mtd_nand_device *device)
+{
+    struct nand_stat *stat = NAND_STAT_GET(device);
+
+    struct spi_nand_flash_mtd *rtt_dev =  rt_container_of(device, struct spi_nand_flash_mtd, mtd_nand_device);
+    nand_flash_t nand_dev = (nand_flash_t)rtt_dev->user_data;
+
+    if (stat == RT_NULL)
+    {
+        return;
+    }
+
+    nand_dev->spi.lock(&nand_dev->spi);
+    rt_memset(stat->hist, 0, sizeof(stat->hist));
+    rt_memset(stat->busy_polls, 0, sizeof(stat->busy_polls));
+    rt_memset(stat->opcode, 0, sizeof(stat->opcode));
+    stat->opcode_num = 0;
+    stat->opcode_lost = 0;
+    nand_dev->spi.unlock(&nand_dev->spi);
+}
+
+#ifdef RT_USING_FINSH
+#include <finsh.h>
+
+static const char *const nand_stat_op_name[NAND_STAT_OP_NUM] = { "read", "write", "erase" };
+static const char *const nand_stat_phase_name[NAND_STAT_PHASE_NUM] = { "total", "lock", "cmd", "xfer", "busy", "delay" };
+
+static void nand_stat_dump(const struct nand_stat *stat)
+{
+    const struct nand_stat_hist *hist;
+    rt_uint8_t op = 0, phase = 0;
+    rt_uint32_t i = 0;
+
+    rt_kprintf("%-6s %-6s %10s %10s %10s %10s %10s\n", "op", "phase", "count", "avg(us)", "p50(us)", "p99(us)", "max(us)");
+    for (op = 0; op < NAND_STAT_OP_NUM; op++)
+    {
+        for (phase = 0; phase < NAND_STAT_PHASE_NUM; phase++)
+        {
+            hist = &stat->hist[op][phase];
+            if (hist->count == 0)
+            {
+                continue;
+            }
+            rt_kprintf("%-6s %-6s %10d %10d %10d %10d %10d\n", nand_stat_op_name[op], nand_stat_phase_name[phase],
+                       hist->count, (rt_uint32_t)(hist->sum_us / hist->count),
+                       spi_nand_stat_percentile(hist, 50), spi_nand_stat_percentile(hist, 99), hist->max_us);
+        }
+    }
+
+    rt_kprintf("busy polls: read %d, write %d, erase %d\n",
+               stat->busy_polls[NAND_STAT_READ], stat->busy_polls[NAND_STAT_WRITE], stat->busy_polls[NAND_STAT_ERASE]);
+
+    rt_kprintf("%-6s %10s %12s\n", "opcode", "count", "bytes");
+    for (i = 0; i < stat->opcode_num; i++)
+    {
+        rt_kprintf("0x%02x   %10d %12d\n", stat->opcode[i].opcode, stat->opcode[i].count,
+                   (rt_uint32_t)stat->opcode[i].bytes);
+    }
+    if (stat->opcode_lost)
+    {
+        rt_kprintf("other  %10d\n", stat->opcode_lost);
+    }
+}
+
+static void nand_stat_hist_dump(const struct nand_stat *stat, rt_uint8_t op, rt_uint8_t phase)
+{
+    const struct nand_stat_hist *hist = &stat->hist[op][phase];
+    rt_uint32_t bucket = 0;
+
+    rt_kprintf("%s %s latency histogram, %d samples\n", nand_stat_op_name[op], nand_stat_phase_name[phase],
+               hist->count);
+    for (bucket = 0; bucket < RT_NAND_STAT_BUCKETS; bucket++)
+    {
+        if (hist->bucket[bucket] == 0)
+        {
+            continue;
+        }
+        rt_kprintf("  < %8d us %10d\n", (rt_uint32_t)(1UL << bucket), hist->bucket[bucket]);
+    }
+}
+
+static int nand_stat(int argc, char **argv)
+{
+    rt_device_t dev = RT_NULL;
+    const struct nand_stat *stat = RT_NULL;
+    rt_uint8_t op = 0, phase = 0;
+
+    if (argc < 2)
+    {
+        rt_kprintf("Usage: nand_stat <nand device> [reset | <read|write|erase> <phase>]\n");
+        rt_kprintf("  phase: total, lock, cmd, xfer, busy or delay\n");
+        return -RT_EINVAL;
+    }
+
+    dev = rt_device_find(argv[1]);
+    if (dev == RT_NULL || dev->type != RT_Device_Class_MTD)
+    {
+        rt_kprintf("nand device %s not found.\n", argv[1]);
+        return -RT_ERROR;
+    }
+
+    stat = spi_nand_stat_get((struct rt_mtd_nand_device *)dev);
+    if (stat == RT_NULL)
+    {
+        rt_kprintf("%s statistics not started.\n", argv[1]);
+        return -RT_ERROR;
+    }
+
+    if (argc == 2)
+    {
+        nand_stat_dump(stat);
+        return RT_EOK;
+    }
+
+    if (!rt_strcmp(argv[2], "reset"))
+    {
+        spi_nand_stat_reset((struct rt_mtd_nand_device *)dev);
+        return RT_EOK;
+    }
+
+    for (op = 0; op < NAND_STAT_OP_NUM && rt_strcmp(argv[2], nand_stat_op_name[op]); op++);
+    if (argc > 3)
+    {
+        for (phase = 0; phase < NAND_STAT_PHASE_NUM && rt_strcmp(argv[3], nand_stat_phase_name[phase]); phase++);
+    }
+    if (op == NAND_STAT_OP_NUM || phase == NAND_STAT_PHASE_NUM)
+    {
+        rt_kprintf("unknown operation or phase.\n");
+        return -RT_EINVAL;
+    }
+
+    nand_stat_hist_dump(stat, op, phase);
+
+    return RT_EOK;
+}
+MSH_CMD_EXPORT(nand_stat, nand latency and SPI traffic statistics);
+#endif /* RT_USING_FINSH */
@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-12-02     yangjie      the first version
+ */
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include "drv_mtd_nand.h"
+
+#define DBG_TAG     "drv_nand_stripe"
+#define DBG_LVL     DBG_LOG
+#include <rtdbg.h>
+
+#ifndef NAND_USING_ASYNC
+#error "NAND_USING_STRIPE needs NAND_USING_ASYNC, the member chips run in their driver threads"
+#endif
+
+/*
+ * RAID-0 over several probed nand devices. A logical page is the same page
+ * of every member, member N holds the slice N of its data and spare, so
+ * every page access and every erase is spread over all the buses. The
+ * member requests run in parallel in the member driver threads.
+ */
+
+#define NAND_STRIPE_GET(device)     ((struct nand_stripe *)(device))
+
+/* the length of the slice of a len bytes buffer in a size bytes member page */
+static rt_uint32_t nand_stripe_slice(rt_uint32_t len, rt_uint32_t size, rt_uint32_t member)
+{
+    if (len <= member * size)
+    {
+        return 0;
+    }
+
+    return len - member * size < size ? len - member * size : size;
+}
+
+/*
+ * nand_stripe_split: fill the member requests of a logical page, a member
+ * with no data and no spare to access gets none, return the request count.
+ */
+static rt_uint32_t nand_stripe_split(struct nand_stripe *stripe, rt_uint8_t op, rt_off_t page,
+                                     rt_uint8_t *data, rt_uint32_t data_len, rt_uint8_t *spare, rt_uint32_t spare_len,
+                                     struct nand_async_req *req, rt_uint32_t *member)
+{
+    rt_uint32_t page_size = stripe->member[0]->page_size;
+    rt_uint32_t oob_size = stripe->member[0]->oob_size;
+    rt_uint32_t i, count = 0;
+
+    for (i = 0; i < stripe->member_num; i++)
+    {
+        rt_memset(&req[count], 0, sizeof(struct nand_async_req));
+        req[count].data_len = data ? nand_stripe_slice(data_len, page_size, i) : 0;
+        req[count].spare_len = spare ? nand_stripe_slice(spare_len, oob_size, i) : 0;
+        if (req[count].data_len == 0 && req[count].spare_len == 0)
+        {
+            continue;
+        }
+
+        req[count].op = op;
+        req[count].page = page;
+        req[count].page_count = 1;
+        req[count].data = req[count].data_len ? data + i * page_size : RT_NULL;
+        req[count].spare = req[count].spare_len ? spare + i * oob_size : RT_NULL;
+        member[count] = i;
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * nand_stripe_run: submit the requests to the member driver threads and wait
+ * all of them, return the first error, or the worst ECC result of a read.
+ */
+static rt_err_t nand_stripe_run(struct nand_stripe *stripe, struct nand_async_req *req,
+                                rt_uint32_t *member, rt_uint32_t count)
+{
+    rt_err_t result = RT_EOK;
+    struct rt_semaphore sem;
+    rt_uint32_t i;
+
+    rt_sem_init(&sem, "nstripe", 0, RT_IPC_FLAG_FIFO);
+
+    for (i = 0; i < count; i++)
+    {
+        req[i].sem = &sem;
+        if (spi_nand_async_submit(stripe->member[member[i]], &req[i]) != RT_EOK)
+        {
+            req[i].result = -RT_ERROR;
+            rt_sem_release(&sem);
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        rt_sem_take(&sem, RT_WAITING_FOREVER);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (req[i].result == RT_EOK || result == req[i].result)
+        {
+            continue;
+        }
+        /* an error beats -RT_MTD_EECC, which beats -RT_MTD_EECC_CORRECT */
+        if (result == RT_EOK || result == -RT_MTD_EECC_CORRECT
+                || (result == -RT_MTD_EECC && req[i].result != -RT_MTD_EECC_CORRECT))
+        {
+            result = req[i].result;
+        }
+    }
+
+    rt_sem_detach(&sem);
+
+    return result;
+}
+
+static rt_err_t nand_stripe_pages(struct rt_mtd_nand_device *device, rt_uint8_t op, rt_off_t page,
+                                  rt_uint32_t page_count, rt_uint8_t *data, rt_uint32_t data_len,
+                                  rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    rt_err_t result = RT_EOK;
+    struct nand_stripe *stripe = NAND_STRIPE_GET(device);
+    struct nand_async_req *req = RT_NULL;
+    rt_uint32_t *member = RT_NULL;
+    rt_uint32_t i, count = 0;
+
+    RT_ASSERT(data_len <= device->page_size);
+    RT_ASSERT(spare_len <= device->oob_size);
+
+    if (page + page_count > device->block_end * device->pages_per_block)
+    {
+        LOG_E("the page %d count %d is out of bound.", page, page_count);
+        return -RT_ERROR;
+    }
+
+    req = (struct nand_async_req *)rt_calloc(page_count * stripe->member_num, sizeof(struct nand_async_req));
+    member = (rt_uint32_t *)rt_calloc(page_count * stripe->member_num, sizeof(rt_uint32_t));
+    if (req == RT_NULL || member == RT_NULL)
+    {
+        result = -RT_ENOMEM;
+        goto __exit;
+    }
+
+    for (i = 0; i < page_count; i++)
+    {
+        count += nand_stripe_split(stripe, op, page + i, data ? data + i * data_len : RT_NULL, data_len,
+                                   spare ? spare + i * spare_len : RT_NULL, spare_len, req + count, member + count);
+    }
+
+    result = nand_stripe_run(stripe, req, member, count);
+
+__exit:
+    rt_free(member);
+    rt_free(req);
+
+    return result;
+}
+
+/*
+ * spi_nand_stripe_read_pages: read page_count consecutive logical pages, all
+ * the member slices are queued at once.
+ */
+rt_err_t spi_nand_stripe_read_pages(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t page_count,
+                                    rt_uint8_t *data, rt_uint32_t data_len,
+                                    rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    return nand_stripe_pages(device, NAND_ASYNC_READ, page, page_count, data, data_len, spare, spare_len);
+}
+
+/*
+ * spi_nand_stripe_write_pages: write page_count consecutive logical pages,
+ * all the member slices are queued at once.
+ */
+rt_err_t spi_nand_stripe_write_pages(struct rt_mtd_nand_device *device, rt_off_t page, rt_uint32_t page_count,
+                                     const rt_uint8_t *data, rt_uint32_t data_len,
+                                     const rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    return nand_stripe_pages(device, NAND_ASYNC_WRITE, page, page_count, (rt_uint8_t *)data, data_len,
+                             (rt_uint8_t *)spare, spare_len);
+}
+
+static rt_err_t nand_stripe_read_id(struct rt_mtd_nand_device *device)
+{
+    return RT_EOK;
+}
+
+static rt_err_t nand_stripe_read_page(struct rt_mtd_nand_device *device,
+                                      rt_off_t page,
+                                      rt_uint8_t *data, rt_uint32_t data_len,
+                                      rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    struct nand_stripe *stripe = NAND_STRIPE_GET(device);
+    struct nand_async_req req[RT_NAND_STRIPE_MAX];
+    rt_uint32_t member[RT_NAND_STRIPE_MAX];
+    rt_uint32_t count;
+
+    RT_ASSERT(data_len <= device->page_size);
+    RT_ASSERT(spare_len <= device->oob_size);
+
+    count = nand_stripe_split(stripe, NAND_ASYNC_READ, page, data, data_len, spare, spare_len, req, member);
+
+    return nand_stripe_run(stripe, req, member, count);
+}
+
+static rt_err_t nand_stripe_write_page(struct rt_mtd_nand_device *device,
+                                       rt_off_t page,
+                                       const rt_uint8_t *data, rt_uint32_t data_len,
+                                       const rt_uint8_t *spare, rt_uint32_t spare_len)
+{
+    struct nand_stripe *stripe = NAND_STRIPE_GET(device);
+    struct nand_async_req req[RT_NAND_STRIPE_MAX];
+    rt_uint32_t member[RT_NAND_STRIPE_MAX];
+    rt_uint32_t count;
+
+    RT_ASSERT(data_len <= device->page_size);
+    RT_ASSERT(spare_len <= device->oob_size);
+
+    count = nand_stripe_split(stripe, NAND_ASYNC_WRITE, page, (rt_uint8_t *)data, data_len,
+                              (rt_uint8_t *)spare, spare_len, req, member);
+
+    return nand_stripe_run(stripe, req, member, count);
+}
+
+/* the logical page is the same page of every member, each member moves its slice */
+static rt_err_t nand_stripe_move_page(struct rt_mtd_nand_device *device, rt_off_t src_page, rt_off_t dst_page)
+{
+    rt_err_t result = RT_EOK;
+    struct nand_stripe *stripe = NAND_STRIPE_GET(device);
+    rt_uint32_t i;
+
+    for (i = 0; i < stripe->member_num && result == RT_EOK; i++)
+    {
+        result = rt_mtd_nand_move_page(stripe->member[i], src_page, dst_page);
+    }
+
+    return result;
+}
+
+static rt_err_t nand_stripe_erase_block(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    struct nand_stripe *stripe = NAND_STRIPE_GET(device);
+    struct nand_async_req req[RT_NAND_STRIPE_MAX];
+    rt_uint32_t member[RT_NAND_STRIPE_MAX];
+    rt_uint32_t i;
+
+    rt_memset(req, 0, sizeof(req));
+    for (i = 0; i < stripe->member_num; i++)
+    {
+        req[i].op = NAND_ASYNC_ERASE;
+        req[i].page = block;
+        member[i] = i;
+    }
+
+    return nand_stripe_run(stripe, req, member, stripe->member_num);
+}
+
+/* a logical block is bad if the block is bad on any member */
+static rt_err_t nand_stripe_check_block(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    struct nand_stripe *stripe = NAND_STRIPE_GET(device);
+    rt_uint32_t i;
+
+    for (i = 0; i < stripe->member_num; i++)
+    {
+        if (rt_mtd_nand_check_block(stripe->member[i], block) != RT_EOK)
+        {
+            return -RT_ERROR;
+        }
+    }
+
+    return RT_EOK;
+}
+
+static rt_err_t nand_stripe_mark_badblock(struct rt_mtd_nand_device *device, rt_uint32_t block)
+{
+    rt_err_t result = RT_EOK;
+    struct nand_stripe *stripe = NAND_STRIPE_GET(device);
+    rt_uint32_t i;
+
+    for (i = 0; i < stripe->member_num; i++)
+    {
+        if (rt_mtd_nand_mark_badblock(stripe->member[i], block) != RT_EOK)
+        {
+            result = -RT_ERROR;
+        }
+    }
+
+    return result;
+}
+
+static const struct rt_mtd_nand_driver_ops stripe_ops =
+{
+    nand_stripe_read_id,
+    nand_stripe_read_page,
+    nand_stripe_write_page,
+    nand_stripe_move_page,
+    nand_stripe_erase_block,
+    nand_stripe_check_block,
+    nand_stripe_mark_badblock,
+};
+
+/**
+ * rt_spi_nand_stripe_register: register a striped device over probed nand
+ * devices with the same geometry, each member should be on its own bus.
+ *
+ * @param stripe_dev_name the striped device name
+ * @param member_dev_name the member nand device names, @see rt_spi_nand_probe
+ * @param member_num member number, RT_NAND_STRIPE_MAX at most
+ *
+ * @return RT_EOK on success
+ */
+rt_err_t rt_spi_nand_stripe_register(const char *stripe_dev_name, const char *member_dev_name[], rt_size_t member_num)
+{
+    rt_err_t result = RT_EOK;
+    struct nand_stripe *stripe = RT_NULL;
+    struct rt_mtd_nand_device *member = RT_NULL;
+    rt_size_t i, j;
+
+    RT_ASSERT(stripe_dev_name);
+    RT_ASSERT(member_dev_name);
+
+    if (member_num == 0 || member_num > RT_NAND_STRIPE_MAX)
+    {
+        LOG_E("stripe member number %d is not supported.", member_num);
+        return -RT_EINVAL;
+    }
+
+    stripe = (struct nand_stripe *)rt_malloc(sizeof(struct nand_stripe));
+    if (stripe == RT_NULL)
+    {
+        return -RT_ENOMEM;
+    }
+    rt_memset(stripe, 0, sizeof(struct nand_stripe));
+
+    for (i = 0; i < member_num; i++)
+    {
+        member = (struct rt_mtd_nand_device *)rt_device_find(member_dev_name[i]);
+        /* only a spi nand device has the async engine, another stripe or MTD driver is rejected */
+        if (member == RT_NULL || member->parent.type != RT_Device_Class_MTD || !spi_nand_device_check(member)
+                || rt_container_of(member, struct spi_nand_flash_mtd, mtd_nand_device)->async == RT_NULL)
+        {
+            LOG_E("nand device %s not found or without the async engine.", member_dev_name[i]);
+            result = -RT_ERROR;
+            goto __exit;
+        }
+        /* one chip in two lanes would alias the pages of the lanes */
+        for (j = 0; j < i; j++)
+        {
+            if (stripe->member[j] == member)
+            {
+                LOG_E("nand device %s is in the stripe twice.", member_dev_name[i]);
+                result = -RT_ERROR;
+                goto __exit;
+            }
+        }
+        if (i > 0 && (member->page_size != stripe->member[0]->page_size
+                      || member->oob_size != stripe->member[0]->oob_size
+                      || member->pages_per_block != stripe->member[0]->pages_per_block
+                      || member->block_end - member->block_start
+                      != stripe->member[0]->block_end - stripe->member[0]->block_start))
+        {
+            LOG_E("nand device %s geometry is different from %s.", member_dev_name[i], member_dev_name[0]);
+            result = -RT_ERROR;
+            goto __exit;
+        }
+        stripe->member[i] = member;
+    }
+    stripe->member_num = member_num;
+
+    member = stripe->member[0];
+    stripe->parent.page_size       = member->page_size * member_num;
+    stripe->parent.pages_per_block = member->pages_per_block;
+    stripe->parent.plane_num       = member->plane_num;
+    stripe->parent.oob_size        = member->oob_size * member_num;
+    /* the free spare from the start of the page is the one of the first member */
+    stripe->parent.oob_free        = member->oob_free;
+    stripe->parent.block_start     = 0;
+    stripe->parent.block_end       = member->block_end - member->block_start;
+    stripe->parent.block_total     = stripe->parent.block_end;
+    stripe->parent.ops             = &stripe_ops;
+
+    result = rt_mtd_nand_register_device(stripe_dev_name, &stripe->parent);
+    if (result != RT_EOK)
+    {
+        goto __exit;
+    }
+
+    LOG_I("Nand stripe device %s with %d chips registered.", stripe_dev_name, member_num);
+
+    return RT_EOK;
+
+__exit:
+    rt_free(stripe);
+
+    return result;
+}
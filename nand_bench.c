@@ -0,0 +1,561 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-12-02     yangjie      the first version
+ */
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include <stdlib.h>
+#include "drv_mtd_nand.h"
+
+#define DBG_TAG     "nand_bench"
+#define DBG_LVL     DBG_LOG
+#include <rtdbg.h>
+
+/*
+ * Throughput and latency benchmark of a nand device. The tests go through
+ * the MTD nand device operations, so they measure whatever is behind them:
+ * the driver and its modules over any nand_spi transport, the simulator
+ * included. The blocks of the range are erased and programmed, bad blocks
+ * are skipped. Each test reports MB/s, IOPS and the p50/p99/max latency of
+ * a single operation, optionally as CSV lines for comparing runs.
+ */
+
+/*
+ * microsecond clock of the latencies: the statistics clock when it is mapped
+ * to a cycle counter, the host monotonic clock on the simulator, else the
+ * tick. The tick is too coarse for a single operation, the percentiles are
+ * not reported then.
+ */
+#ifndef RT_NAND_BENCH_TIME_US
+#if defined(NAND_USING_STAT) && !defined(NAND_STAT_TICK_CLOCK)
+#define RT_NAND_BENCH_TIME_US()       RT_NAND_STAT_TIME_US()
+#elif defined(NAND_USING_SIM)
+#include <time.h>
+
+static rt_uint32_t nand_bench_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (rt_uint32_t)((rt_uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+#define RT_NAND_BENCH_TIME_US()       nand_bench_time_us()
+#else
+#define RT_NAND_BENCH_TIME_US()       ((rt_uint32_t)rt_tick_get() * (1000000 / RT_TICK_PER_SECOND))
+#define NAND_BENCH_TICK_CLOCK
+#endif
+#endif
+
+/* read operations out of 100 in the mixed test */
+#ifndef RT_NAND_BENCH_READ_PERCENT
+#define RT_NAND_BENCH_READ_PERCENT    (70)
+#endif
+
+#define NAND_BENCH_OPS                (1000)
+
+struct nand_bench
+{
+    struct rt_mtd_nand_device *device;
+    rt_uint32_t *blocks;                         /**< the good blocks of the range */
+    rt_uint32_t block_num;
+    rt_uint32_t page_num;                        /**< pages of the good blocks */
+    rt_uint32_t programmed;                      /**< pages programmed from the first one */
+    rt_bool_t erased;                            /**< the whole range is erased */
+    rt_uint32_t ops;
+    rt_uint32_t seed;
+    rt_bool_t csv;
+    rt_uint8_t *data;
+    rt_uint8_t *spare;
+    rt_uint32_t *lat;                            /**< latency of each operation */
+};
+
+struct nand_bench_result
+{
+    const char *name;
+    rt_uint32_t ops;
+    rt_uint32_t errors;
+    rt_uint64_t bytes;
+    rt_uint32_t us;
+};
+
+static rt_uint32_t nand_bench_rand(struct nand_bench *bench)
+{
+    /* xorshift32, the same seed gives the same access pattern */
+    bench->seed ^= bench->seed << 13;
+    bench->seed ^= bench->seed >> 17;
+    bench->seed ^= bench->seed << 5;
+
+    return bench->seed;
+}
+
+/* the device page of the index-th page of the good blocks */
+static rt_off_t nand_bench_page(struct nand_bench *bench, rt_uint32_t index)
+{
+    rt_uint32_t pages_per_block = bench->device->pages_per_block;
+
+    return (rt_off_t)bench->blocks[index / pages_per_block] * pages_per_block + index % pages_per_block;
+}
+
+static rt_err_t nand_bench_erase(struct nand_bench *bench, rt_uint32_t index)
+{
+    return rt_mtd_nand_erase_block(bench->device, bench->blocks[index]);
+}
+
+static rt_err_t nand_bench_program(struct nand_bench *bench, rt_uint32_t index)
+{
+    struct rt_mtd_nand_device *device = bench->device;
+
+    /* a different page content each time, the bad block marker stays 0xff */
+    bench->data[0] = index & 0xff;
+    bench->data[1] = (index >> 8) & 0xff;
+    bench->spare[2] = index & 0xff;
+
+    return rt_mtd_nand_write(device, nand_bench_page(bench, index), bench->data, device->page_size,
+                             bench->spare, device->oob_free);
+}
+
+static rt_err_t nand_bench_read(struct nand_bench *bench, rt_uint32_t index, rt_bool_t spare)
+{
+    struct rt_mtd_nand_device *device = bench->device;
+    rt_err_t result;
+
+    result = rt_mtd_nand_read(device, nand_bench_page(bench, index), bench->data, device->page_size,
+                              spare ? bench->spare : RT_NULL, spare ? device->oob_size : 0);
+
+    return result == -RT_MTD_EECC_CORRECT ? RT_EOK : result;
+}
+
+/* erase and program the range untimed, for the read tests */
+static rt_err_t nand_bench_prepare(struct nand_bench *bench, rt_bool_t program)
+{
+    rt_uint32_t i = 0;
+
+    if (!bench->erased && (!program || bench->programmed == 0))
+    {
+        for (i = 0; i < bench->block_num; i++)
+        {
+            if (nand_bench_erase(bench, i) != RT_EOK)
+            {
+                return -RT_EIO;
+            }
+        }
+        bench->erased = RT_TRUE;
+        bench->programmed = 0;
+    }
+
+    if (program && bench->programmed == 0)
+    {
+        for (i = 0; i < bench->page_num; i++)
+        {
+            if (nand_bench_program(bench, i) != RT_EOK)
+            {
+                return -RT_EIO;
+            }
+        }
+        bench->erased = RT_FALSE;
+        bench->programmed = bench->page_num;
+    }
+
+    return RT_EOK;
+}
+
+static int nand_bench_cmp(const void *a, const void *b)
+{
+    rt_uint32_t x = *(const rt_uint32_t *)a, y = *(const rt_uint32_t *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+#ifndef NAND_BENCH_TICK_CLOCK
+/* the nearest rank percentile of the sorted latencies */
+static rt_uint32_t nand_bench_percentile(const rt_uint32_t *lat, rt_uint32_t count, rt_uint32_t percent)
+{
+    rt_uint32_t rank = (count * percent + 99) / 100;
+
+    return count == 0 ? 0 : lat[rank == 0 ? 0 : rank - 1];
+}
+#endif
+
+static void nand_bench_report(struct nand_bench *bench, const struct nand_bench_result *result)
+{
+    rt_uint32_t us = result->us ? result->us : 1;
+    rt_uint32_t kbps = (rt_uint32_t)(result->bytes * 1000 / us);
+    rt_uint32_t iops = (rt_uint32_t)((rt_uint64_t)result->ops * 1000000 / us);
+    rt_uint32_t max = 0;
+#ifndef NAND_BENCH_TICK_CLOCK
+    rt_uint32_t p50 = 0, p99 = 0;
+#endif
+
+    if (result->ops != 0)
+    {
+        qsort(bench->lat, result->ops, sizeof(rt_uint32_t), nand_bench_cmp);
+#ifndef NAND_BENCH_TICK_CLOCK
+        p50 = nand_bench_percentile(bench->lat, result->ops, 50);
+        p99 = nand_bench_percentile(bench->lat, result->ops, 99);
+#endif
+        max = bench->lat[result->ops - 1];
+    }
+
+#ifdef NAND_BENCH_TICK_CLOCK
+    /* no percentile out of tick samples, they would read 0 */
+    if (bench->csv)
+    {
+        rt_kprintf("nand_bench,%s,%s,%d,%d,%d,%d,%d,%d,,,%d\n", bench->device->parent.parent.name,
+                   result->name, result->ops, result->errors, (rt_uint32_t)result->bytes, result->us,
+                   kbps, iops, max);
+    }
+    else
+    {
+        rt_kprintf("%-8s %8d %6d %6d.%03d %8d %8s %8s %8d\n", result->name, result->ops, result->errors,
+                   kbps / 1000, kbps % 1000, iops, "-", "-", max);
+    }
+#else
+    if (bench->csv)
+    {
+        rt_kprintf("nand_bench,%s,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", bench->device->parent.parent.name,
+                   result->name, result->ops, result->errors, (rt_uint32_t)result->bytes, result->us,
+                   kbps, iops, p50, p99, max);
+    }
+    else
+    {
+        rt_kprintf("%-8s %8d %6d %6d.%03d %8d %8d %8d %8d\n", result->name, result->ops, result->errors,
+                   kbps / 1000, kbps % 1000, iops, p50, p99, max);
+    }
+#endif /* NAND_BENCH_TICK_CLOCK */
+}
+
+static void nand_bench_erase_test(struct nand_bench *bench, struct nand_bench_result *result)
+{
+    rt_uint32_t ops = bench->ops < bench->block_num ? bench->ops : bench->block_num;
+    rt_uint32_t i = 0, start = 0, op_start = 0;
+
+    start = RT_NAND_BENCH_TIME_US();
+    for (i = 0; i < ops; i++)
+    {
+        op_start = RT_NAND_BENCH_TIME_US();
+        if (nand_bench_erase(bench, i) != RT_EOK)
+        {
+            result->errors++;
+        }
+        bench->lat[i] = RT_NAND_BENCH_TIME_US() - op_start;
+    }
+    result->us = RT_NAND_BENCH_TIME_US() - start;
+    result->ops = ops;
+
+    bench->erased = ops == bench->block_num && result->errors == 0;
+    bench->programmed = 0;
+}
+
+static void nand_bench_program_test(struct nand_bench *bench, struct nand_bench_result *result)
+{
+    rt_uint32_t ops = bench->ops < bench->page_num ? bench->ops : bench->page_num;
+    rt_uint32_t i = 0, start = 0, op_start = 0;
+
+    if (nand_bench_prepare(bench, RT_FALSE) != RT_EOK)
+    {
+        result->errors++;
+        return;
+    }
+
+    start = RT_NAND_BENCH_TIME_US();
+    for (i = 0; i < ops; i++)
+    {
+        op_start = RT_NAND_BENCH_TIME_US();
+        if (nand_bench_program(bench, i) != RT_EOK)
+        {
+            result->errors++;
+        }
+        bench->lat[i] = RT_NAND_BENCH_TIME_US() - op_start;
+    }
+    result->us = RT_NAND_BENCH_TIME_US() - start;
+    result->ops = ops;
+    result->bytes = (rt_uint64_t)ops * (bench->device->page_size + bench->device->oob_free);
+
+    bench->erased = RT_FALSE;
+    bench->programmed = ops;
+}
+
+/* seqread, randread or readoob, over the programmed pages */
+static void nand_bench_read_test(struct nand_bench *bench, struct nand_bench_result *result,
+                                 rt_bool_t random, rt_bool_t spare)
+{
+    rt_uint32_t i = 0, index = 0, start = 0, op_start = 0;
+
+    if (nand_bench_prepare(bench, RT_TRUE) != RT_EOK)
+    {
+        result->errors++;
+        return;
+    }
+
+    start = RT_NAND_BENCH_TIME_US();
+    for (i = 0; i < bench->ops; i++)
+    {
+        index = (random ? nand_bench_rand(bench) : i) % bench->programmed;
+        op_start = RT_NAND_BENCH_TIME_US();
+        if (nand_bench_read(bench, index, spare) != RT_EOK)
+        {
+            result->errors++;
+        }
+        bench->lat[i] = RT_NAND_BENCH_TIME_US() - op_start;
+    }
+    result->us = RT_NAND_BENCH_TIME_US() - start;
+    result->ops = bench->ops;
+    result->bytes = (rt_uint64_t)bench->ops * (bench->device->page_size + (spare ? bench->device->oob_size : 0));
+}
+
+/*
+ * nand_bench_mixed_test: random reads of the programmed pages and
+ * sequential programs, the range is used as a ring and the oldest block
+ * is erased when the programs wrap to it.
+ */
+static void nand_bench_mixed_test(struct nand_bench *bench, struct nand_bench_result *result)
+{
+    rt_uint32_t pages_per_block = bench->device->pages_per_block;
+    rt_uint32_t reads = 0, programs = 0, erases = 0;
+    rt_uint32_t head = 0, valid = 0;
+    rt_uint32_t i = 0, index = 0, start = 0, op_start = 0;
+    rt_err_t err = RT_EOK;
+
+    if (nand_bench_prepare(bench, RT_FALSE) != RT_EOK)
+    {
+        result->errors++;
+        return;
+    }
+
+    start = RT_NAND_BENCH_TIME_US();
+    for (i = 0; i < bench->ops; i++)
+    {
+        if (valid != 0 && nand_bench_rand(bench) % 100 < RT_NAND_BENCH_READ_PERCENT)
+        {
+            index = (head + bench->page_num - 1 - nand_bench_rand(bench) % valid) % bench->page_num;
+            op_start = RT_NAND_BENCH_TIME_US();
+            err = nand_bench_read(bench, index, RT_FALSE);
+            result->bytes += bench->device->page_size;
+            reads++;
+        }
+        else if (head % pages_per_block == 0 && valid > bench->page_num - pages_per_block)
+        {
+            op_start = RT_NAND_BENCH_TIME_US();
+            err = nand_bench_erase(bench, head / pages_per_block);
+            valid -= pages_per_block;
+            erases++;
+        }
+        else
+        {
+            op_start = RT_NAND_BENCH_TIME_US();
+            err = nand_bench_program(bench, head);
+            result->bytes += bench->device->page_size + bench->device->oob_free;
+            head = (head + 1) % bench->page_num;
+            valid++;
+            programs++;
+        }
+        bench->lat[i] = RT_NAND_BENCH_TIME_US() - op_start;
+        if (err != RT_EOK)
+        {
+            result->errors++;
+        }
+    }
+    result->us = RT_NAND_BENCH_TIME_US() - start;
+    result->ops = bench->ops;
+
+    /* the next read test programs the range again */
+    bench->erased = RT_FALSE;
+    bench->programmed = 0;
+
+    if (!bench->csv)
+    {
+        rt_kprintf("mixed: %d reads, %d programs, %d erases\n", reads, programs, erases);
+    }
+}
+
+static const char *const nand_bench_tests[] = { "erase", "program", "seqread", "randread", "readoob", "mixed" };
+
+static void nand_bench_test(struct nand_bench *bench, rt_uint8_t test)
+{
+    struct nand_bench_result result;
+
+    rt_memset(&result, 0, sizeof(result));
+    result.name = nand_bench_tests[test];
+
+    switch (test)
+    {
+    case 0:
+        nand_bench_erase_test(bench, &result);
+        break;
+    case 1:
+        nand_bench_program_test(bench, &result);
+        break;
+    case 2:
+        nand_bench_read_test(bench, &result, RT_FALSE, RT_FALSE);
+        break;
+    case 3:
+        nand_bench_read_test(bench, &result, RT_TRUE, RT_FALSE);
+        break;
+    case 4:
+        nand_bench_read_test(bench, &result, RT_FALSE, RT_TRUE);
+        break;
+    default:
+        nand_bench_mixed_test(bench, &result);
+        break;
+    }
+
+    nand_bench_report(bench, &result);
+}
+
+/**
+ * nand_bench_run: run a benchmark test on a block range of the device,
+ * the data in the range is lost.
+ *
+ * @param device the nand device
+ * @param test erase, program, seqread, randread, readoob, mixed or all
+ * @param block the first block of the range
+ * @param block_count blocks in the range, bad blocks are skipped
+ * @param ops operations per test, the erase and program tests are limited to the range
+ * @param seed the seed of the random accesses
+ * @param csv print the results as CSV lines
+ *
+ * @return RT_EOK on success
+ */
+rt_err_t nand_bench_run(struct rt_mtd_nand_device *device, const char *test, rt_uint32_t block,
+                        rt_uint32_t block_count, rt_uint32_t ops, rt_uint32_t seed, rt_bool_t csv)
+{
+    struct nand_bench bench;
+    rt_err_t result = RT_EOK;
+    rt_uint8_t i = 0, first = 0, last = 0;
+    rt_uint32_t n = 0;
+
+    RT_ASSERT(device);
+
+    rt_memset(&bench, 0, sizeof(bench));
+
+    for (i = 0; i < sizeof(nand_bench_tests) / sizeof(nand_bench_tests[0]); i++)
+    {
+        if (!rt_strcmp(test, nand_bench_tests[i]))
+        {
+            break;
+        }
+    }
+    if (!rt_strcmp(test, "all"))
+    {
+        first = 0;
+        last = sizeof(nand_bench_tests) / sizeof(nand_bench_tests[0]) - 1;
+    }
+    else if (i < sizeof(nand_bench_tests) / sizeof(nand_bench_tests[0]))
+    {
+        first = last = i;
+    }
+    else
+    {
+        LOG_E("unknown test %s.", test);
+        return -RT_EINVAL;
+    }
+
+    if (block_count == 0 || ops == 0 || block + block_count > device->block_end - device->block_start)
+    {
+        LOG_E("invalid block range %d+%d or operations %d.", block, block_count, ops);
+        return -RT_EINVAL;
+    }
+
+    bench.device = device;
+    bench.ops = ops;
+    bench.seed = seed ? seed : 1;
+    bench.csv = csv;
+    bench.blocks = (rt_uint32_t *)rt_malloc(block_count * sizeof(rt_uint32_t));
+    bench.data = (rt_uint8_t *)rt_malloc(device->page_size);
+    bench.spare = (rt_uint8_t *)rt_malloc(device->oob_size);
+    bench.lat = (rt_uint32_t *)rt_malloc(ops * sizeof(rt_uint32_t));
+    if (bench.blocks == RT_NULL || bench.data == RT_NULL || bench.spare == RT_NULL || bench.lat == RT_NULL)
+    {
+        result = -RT_ENOMEM;
+        goto __exit;
+    }
+
+    for (n = 0; n < device->page_size; n++)
+    {
+        bench.data[n] = nand_bench_rand(&bench) & 0xff;
+    }
+    rt_memset(bench.spare, 0xff, device->oob_size);
+
+    for (block_count += block; block < block_count; block++)
+    {
+        if (rt_mtd_nand_check_block(device, block) == RT_EOK)
+        {
+            bench.blocks[bench.block_num++] = block;
+        }
+    }
+    if (bench.block_num == 0)
+    {
+        LOG_E("no good block in the range.");
+        result = -RT_ERROR;
+        goto __exit;
+    }
+    bench.page_num = bench.block_num * device->pages_per_block;
+
+    if (csv)
+    {
+        rt_kprintf("nand_bench,device,test,ops,errors,bytes,us,kB/s,iops,p50_us,p99_us,max_us\n");
+    }
+    else
+    {
+        rt_kprintf("%s: page %d+%d, %d pages per block, %d good blocks, %d operations\n",
+                   device->parent.parent.name, device->page_size, device->oob_size, device->pages_per_block,
+                   bench.block_num, ops);
+        rt_kprintf("%-8s %8s %6s %10s %8s %8s %8s %8s\n", "test", "ops", "errors", "MB/s", "IOPS",
+                   "p50(us)", "p99(us)", "max(us)");
+    }
+
+    for (i = first; i <= last; i++)
+    {
+        nand_bench_test(&bench, i);
+    }
+
+__exit:
+    rt_free(bench.lat);
+    rt_free(bench.spare);
+    rt_free(bench.data);
+    rt_free(bench.blocks);
+
+    return result;
+}
+
+#ifdef RT_USING_FINSH
+#include <finsh.h>
+
+static int nand_bench(int argc, char **argv)
+{
+    rt_device_t dev = RT_NULL;
+    rt_bool_t csv = RT_FALSE;
+
+    if (argc > 5 && !rt_strcmp(argv[argc - 1], "csv"))
+    {
+        csv = RT_TRUE;
+        argc--;
+    }
+
+    if (argc < 5)
+    {
+        rt_kprintf("Usage: nand_bench <nand device> <test> <block> <block count> [ops] [seed] [csv]\n");
+        rt_kprintf("  test: erase, program, seqread, randread, readoob, mixed or all\n");
+        rt_kprintf("  the data in the blocks is lost.\n");
+        return -RT_EINVAL;
+    }
+
+    dev = rt_device_find(argv[1]);
+    if (dev == RT_NULL || dev->type != RT_Device_Class_MTD)
+    {
+        rt_kprintf("nand device %s not found.\n", argv[1]);
+        return -RT_ERROR;
+    }
+
+    return nand_bench_run((struct rt_mtd_nand_device *)dev, argv[2], atoi(argv[3]), atoi(argv[4]),
+                          argc > 5 ? atoi(argv[5]) : NAND_BENCH_OPS, argc > 6 ? atoi(argv[6]) : 1, csv);
+}
+MSH_CMD_EXPORT(nand_bench, nand throughput and latency benchmark);
+#endif /* RT_USING_FINSH */